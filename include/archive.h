@@ -0,0 +1,58 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+/*
+ *	archive.h
+ *	This file is part of bc-dl.
+ *	See bc-dl.c for copyright or LICENSE for license information.
+ */
+
+/* from archive.c */
+
+#define ARCHIVE_BLOCK 512 /* tar */
+#define ARCHIVE_USTAR_NAME 100
+#define ARCHIVE_USTAR_PREFIX 155
+#define ARCHIVE_USTAR_SIZE 077777777777ULL /* largest size in a ustar header */
+#define ARCHIVE_ZIP32 0xFFFFFFFFUL /* larger sizes and offsets need zip64 fields */
+#define ARCHIVE_ZIP32_ENTRIES 0xFFFFUL
+
+/* same order as BCDL_ARCHIVE_* */
+enum _archive_format {
+	ARCHIVE_NONE = 0,
+	ARCHIVE_TAR = 1, /* ustar, pax records for long names */
+	ARCHIVE_ZIP = 2 /* stored, zip64 where needed */
+};
+
+/* zip central directory record, kept until the archive is closed */
+struct _archive_entry {
+	char *name;
+	unsigned long crc;
+	unsigned long long size;
+	unsigned long long offset; /* of local header */
+};
+
+struct _archive {
+	int format;
+	int fd;
+	int owned; /* fd was opened here, closed and renamed into place on close */
+	char *filename; /* NULL if streamed */
+	char *part;
+	unsigned long long written;
+	int failed; /* a write failed, nothing more is written */
+	unsigned long dos_time; /* zip, date << 16 | time */
+	long mtime; /* tar */
+	struct _archive_entry *entries;
+	size_t entry_count, entry_alloc;
+	pthread_mutex_t lock; /* members are added from writer threads */
+};
+
+typedef enum _archive_format archive_format_t;
+typedef struct _archive archive_t;
+
+archive_t *archive_open(const char *, archive_format_t);
+archive_t *archive_stream(int, archive_format_t);
+ferror_t archive_add(archive_t *, const char *, const char *, size_t, const char *, size_t);
+ferror_t archive_close(archive_t *, int);
+const char *archive_extension(archive_format_t);
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+/*
+ *	arena.h
+ *	This file is part of bc-dl.
+ *	See bc-dl.c for copyright or LICENSE for license information.
+ */
+
+/* from arena.c */
+
+#define ARENA_CHUNK 4096 /* smallest chunk, larger requests get a chunk of their own size */
+#define ARENA_ALIGN (sizeof(void *))
+
+struct _arena_chunk {
+	struct _arena_chunk *next;
+	size_t size; /* usable bytes, which follow this header */
+	size_t used;
+};
+
+/* bump allocator, everything in it is freed at once by a reset
+ * chunks are kept across resets, so refilling it costs no allocations
+ */
+struct _arena {
+	struct _arena_chunk *chunks; /* current chunk first */
+};
+
+typedef struct _arena arena_t;
+
+void arena_init(arena_t *);
+void *arena_alloc(arena_t *, size_t);
+char *arena_strdup(arena_t *, const char *);
+void arena_reset(arena_t *);
+void arena_free(arena_t *);
+
+#endif
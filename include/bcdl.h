@@ -0,0 +1,167 @@
+#ifndef BCDL_H
+#define BCDL_H
+
+/*
+ *	bcdl.h
+ *	This file is part of bc-dl.
+ *	See bc-dl.c for copyright or LICENSE for license information.
+ */
+
+/* from bcdl.c */
+
+/* PUBLIC INTERFACE OF LIBBCDL
+ * one bcdl_t drives any number of album downloads from a single thread
+ * nothing blocks, call bcdl_perform() when bcdl_wait() returns, or when
+ * descriptors from bcdl_fdset() become ready in your own event loop
+ * tracks are tagged and written out on threads of libbcdl's own,
+ * callbacks still run on the thread calling bcdl_perform()
+ * nothing is printed, errors are reported as error codes
+ */
+
+#include <stddef.h>
+#include <sys/select.h>
+
+#include "error.h"
+
+#define BCDL_TRACKS_IN_FLIGHT 16 /* per album, handed to the engine, which limits each host itself */
+#define BCDL_TRACK_RETRIES 2 /* re-downloads of a track that failed or didn't verify */
+#define BCDL_WRITERS 4 /* threads tagging and writing out tracks */
+#define BCDL_DEFAULT_SPLIT (32UL * 1024 * 1024) /* tracks larger than this are fetched in ranges */
+#define BCDL_TAG_ESTIMATE 4096 /* bytes of tag per track besides art, padding included */
+#define BCDL_BLOCK_ESTIMATE 4096 /* bytes per file, files take up whole blocks */
+
+/* MEMORY BUDGET
+ * every buffer held by libbcdl is charged to one process-wide budget
+ * once it runs out, or a single track grows past the spill threshold,
+ * the download continues into an unlinked temp file instead of memory
+ * new tracks aren't started while the budget is exhausted
+ * limit of 0 means no limit, threshold of 0 means large tracks stay in memory
+ */
+
+/* BUFFER POOL
+ * track buffers are kept once freed and handed to the next track that
+ * needs one of the same size class, already faulted in
+ * idle buffers are capped separately from the memory budget
+ */
+
+/* PLANNING
+ * once an album's page is parsed, the size of every track and of the art
+ * is asked for with HEAD requests, all at once, tracks are then fetched
+ * largest first so the last one to finish isn't a long one started late
+ * an album is only started once free space in the working directory
+ * covers its estimated size, on top of what albums already downloading
+ * have still to write, and waits in BCDL_WAIT_SPACE until it does
+ * with no other album downloading it fails with ERROR_DISK_SPACE instead
+ * albums opened with BCDL_NO_PLAN or BCDL_RETAG skip straight to BCDL_PARSED,
+ * sizes unknown and tracks in album order
+ */
+
+/* BANDWIDTH
+ * one rate limit covers every transfer in the process, split evenly
+ * between albums downloading at the time so small albums aren't
+ * starved by large ones, each album's share can be capped too
+ */
+
+enum _bcdl_flags {
+	BCDL_AUTOSTART = 0,
+	BCDL_DEFER = 1, /* stop after parsing until bcdl_album_start() */
+	BCDL_RETAG = 2, /* rewrite tags of tracks already on disk, download nothing else */
+	BCDL_NO_PLAN = 4 /* sizes aren't asked for, for albums only wanted for their details */
+};
+
+/* duplicate audio, see bcdl_set_manifest() */
+enum _bcdl_link {
+	BCDL_LINK_NONE = 0, /* every track is written out in full */
+	BCDL_LINK_HARD = 1, /* duplicates are hard links, only if their tag is the first copy's too */
+	BCDL_LINK_REFLINK = 2 /* duplicates share audio only, needs btrfs, xfs or similar */
+};
+
+/* how finished files are written out, see bcdl_set_io() */
+enum _bcdl_io {
+	BCDL_IO_AUTO = 0, /* io_uring where the kernel allows it, pwrite otherwise */
+	BCDL_IO_URING = 1,
+	BCDL_IO_PWRITE = 2
+};
+
+/* output as an archive per album, or one for many, see bcdl_set_archive() */
+enum _bcdl_archive {
+	BCDL_ARCHIVE_NONE = 0, /* every track is a file in the album's folder */
+	BCDL_ARCHIVE_TAR = 1,
+	BCDL_ARCHIVE_ZIP = 2 /* stored, audio and art don't compress */
+};
+
+/* states are ordered, later states never go back to earlier ones */
+enum _bcdl_state {
+	BCDL_FETCH_PAGE,
+	BCDL_PLAN, /* sizes being asked for, see PLANNING */
+	BCDL_PARSED, /* details known, waiting for bcdl_album_start() */
+	BCDL_WAIT_SPACE, /* started, waiting for free space, see PLANNING */
+	BCDL_FETCH_ART,
+	BCDL_FETCH_TRACKS,
+	BCDL_DONE,
+	BCDL_FAILED
+};
+
+typedef struct _bcdl bcdl_t;
+typedef struct _bcdl_album bcdl_album_t;
+typedef enum _bcdl_state bcdl_state_t;
+
+/* callbacks run from inside bcdl_perform(), any of them may be NULL
+ * don't call bcdl_album_close() from inside a callback
+ */
+struct _bcdl_callbacks {
+	void (*parsed)(bcdl_album_t *, void *);
+	void (*progress)(bcdl_album_t *, size_t, void *); /* bytes received so far */
+	void (*track)(bcdl_album_t *, unsigned, int, void *); /* track written, or skipped if nonzero */
+	void (*complete)(bcdl_album_t *, ferror_t, void *);
+};
+
+typedef struct _bcdl_callbacks bcdl_callbacks_t;
+
+/* process-wide counters, see bcdl_stats() */
+struct _bcdl_stats {
+	size_t memory_peak; /* most bytes charged to the memory budget at once */
+	unsigned spills; /* buffers moved to temp files */
+	unsigned long pool_hits; /* buffers reused from the pool */
+	unsigned long pool_misses; /* buffers mapped fresh */
+	unsigned long pool_drops; /* buffers unmapped, pool was full */
+	size_t pool_idle; /* bytes kept for reuse */
+};
+
+typedef struct _bcdl_stats bcdl_stats_t;
+
+bcdl_t *bcdl_init(void);
+unsigned bcdl_perform(bcdl_t *);
+size_t bcdl_throughput(bcdl_t *);
+void bcdl_wait(bcdl_t *, int);
+int bcdl_fdset(bcdl_t *, fd_set *, fd_set *, fd_set *, int *);
+long bcdl_timeout(bcdl_t *);
+void bcdl_cleanup(bcdl_t *);
+void bcdl_set_memory_budget(size_t, size_t);
+void bcdl_set_buffer_pool(size_t, int);
+void bcdl_stats(bcdl_stats_t *);
+int bcdl_set_manifest(bcdl_t *, const char *, int);
+void bcdl_set_max_jobs(bcdl_t *, unsigned);
+void bcdl_set_split(bcdl_t *, size_t);
+int bcdl_set_io(int);
+int bcdl_set_archive(bcdl_t *, int, int);
+void bcdl_set_bandwidth(size_t, size_t);
+void bcdl_scale_bandwidth(int);
+size_t bcdl_bandwidth(void);
+int bcdl_set_schedule(const char *);
+struct _membuf *bcdl_fetch_page(bcdl_t *, const char *, ferror_t *); /* see membuf.h */
+
+bcdl_album_t *bcdl_album_open(bcdl_t *, const char *, int, const bcdl_callbacks_t *, void *);
+void bcdl_album_start(bcdl_album_t *);
+void bcdl_album_set_callbacks(bcdl_album_t *, const bcdl_callbacks_t *, void *);
+bcdl_state_t bcdl_album_state(bcdl_album_t *);
+ferror_t bcdl_album_error(bcdl_album_t *);
+const char *bcdl_album_url(bcdl_album_t *);
+const char *bcdl_album_folder(bcdl_album_t *);
+const char *bcdl_album_track_filename(bcdl_album_t *, unsigned);
+size_t bcdl_album_track_size(bcdl_album_t *, unsigned);
+size_t bcdl_album_size(bcdl_album_t *, unsigned *);
+struct _album_container *bcdl_album_data(bcdl_album_t *); /* see parse.h */
+void bcdl_album_close(bcdl_album_t *);
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef BUFPOOL_H
+#define BUFPOOL_H
+
+/*
+ *	bufpool.h
+ *	This file is part of bc-dl.
+ *	See bc-dl.c for copyright or LICENSE for license information.
+ */
+
+/* from bufpool.c */
+
+#define BUFPOOL_MIN_SHIFT 16 /* 64K, smaller buffers come from malloc */
+#define BUFPOOL_MAX_SHIFT 26 /* 64M, the default spill size, larger ones come from malloc */
+#define BUFPOOL_CLASSES (BUFPOOL_MAX_SHIFT - BUFPOOL_MIN_SHIFT + 1)
+#define BUFPOOL_DEFAULT_IDLE (256UL * 1024 * 1024) /* bytes kept for reuse */
+#define BUFPOOL_HUGE_PAGE (2UL * 1024 * 1024)
+
+/* idle buffers are linked through their own first bytes */
+struct _bufpool_idle {
+	struct _bufpool_idle *next;
+};
+
+struct _bufpool {
+	size_t idle_limit; /* 0 turns the pool off */
+	int hugepages; /* classes of BUFPOOL_HUGE_PAGE and up are backed by huge pages */
+	size_t idle; /* bytes waiting for reuse */
+	unsigned long hits; /* buffers handed out again */
+	unsigned long misses; /* buffers mapped fresh */
+	unsigned long drops; /* buffers unmapped, pool was full */
+	struct _bufpool_idle *classes[BUFPOOL_CLASSES]; /* most recently used first */
+};
+
+extern struct _bufpool BUFPOOL;
+
+void bufpool_set(size_t, int);
+size_t bufpool_capacity(size_t);
+char *bufpool_get(size_t);
+void bufpool_put(char *, size_t);
+void bufpool_stats(struct _bufpool *);
+
+#endif
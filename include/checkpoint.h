@@ -0,0 +1,42 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+/*
+ *	checkpoint.h
+ *	This file is part of bc-dl.
+ *	See bc-dl.c for copyright or LICENSE for license information.
+ */
+
+/* from checkpoint.c */
+
+#define CHECKPOINT_FILENAME ".bc-dl.checkpoint"
+#define CHECKPOINT_BUCKETS 256 /* initial size, grows as needed */
+
+enum _checkpoint_state {
+	CHECKPOINT_STARTED,
+	CHECKPOINT_DONE
+};
+
+struct _checkpoint_entry {
+	char *url;
+	char *folder;
+	enum _checkpoint_state state;
+	struct _checkpoint_entry *next;
+};
+
+struct _checkpoint {
+	FILE *log; /* append-only */
+	struct _checkpoint_entry **buckets;
+	unsigned bucket_count;
+	unsigned entries;
+};
+
+typedef enum _checkpoint_state cpstate_t;
+typedef struct _checkpoint checkpoint_t;
+
+checkpoint_t *checkpoint_open(const char *);
+const char *checkpoint_completed(checkpoint_t *, const char *);
+void checkpoint_record(checkpoint_t *, cpstate_t, const char *, const char *);
+void checkpoint_close(checkpoint_t *);
+
+#endif
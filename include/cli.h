@@ -10,33 +10,18 @@
 
 /* from cli.c */
 
-/* ERRORS DEFINED HERE */
-
-#define NUMBER_OF_ERRORS 5
-
-enum _error_flag {
-	EVERYTHING_IS_FINE = -1, /* not a real error */
-	ERROR_INVALID_URL,
-	ERROR_CONNECTION,
-	ERROR_JSON,
-	ERROR_FILE_IO,
-	ERROR_MEM_IO
-};
-
-struct _error {
-	const enum _error_flag err;
-	const char *desc;
-};
-
 /* CLI OPTION FLAGS DEFINED HERE */
 
-#define NUMBER_OF_MODES 3
+#define NUMBER_OF_MODES 6
 
 enum _flag_mode {
 	MODE_NORMAL = -1, /* doesn't count as a real mode */
 	MODE_HELP = 0,
 	MODE_VERSION = 1,
-	MODE_MULTI = 2
+	MODE_MULTI = 2,
+	MODE_DAEMON = 3,
+	MODE_RETAG = 4,
+	MODE_DUMP = 5
 };
 
 struct _cli_flags {
@@ -46,19 +31,92 @@ struct _cli_flags {
 	const enum _flag_mode mode;
 };
 
+/* settings take a value, --name=value, and may appear anywhere */
+
+#define NUMBER_OF_OPTIONS 16
+
+enum _option {
+	OPTION_MEMORY = 0,
+	OPTION_SPILL = 1,
+	OPTION_MANIFEST = 2,
+	OPTION_LINK = 3,
+	OPTION_JOBS = 4,
+	OPTION_RATE = 5,
+	OPTION_ALBUM_RATE = 6,
+	OPTION_SCHEDULE = 7,
+	OPTION_LOOKAHEAD = 8,
+	OPTION_SPLIT = 9,
+	OPTION_IO = 10,
+	OPTION_ARCHIVE = 11,
+	OPTION_ARCHIVE_TO = 12,
+	OPTION_POOL = 13,
+	OPTION_HUGEPAGES = 14,
+	OPTION_VERBOSE = 15
+};
+
+struct _cli_options {
+	const char *gnuflag;
+	const char *desc;
+	const enum _option option;
+	const int runtime; /* may be changed while running, through the daemon socket */
+};
+
+struct _settings {
+	size_t memory; /* bytes */
+	size_t spill; /* bytes */
+	const char *manifest; /* NULL for none */
+	int link; /* BCDL_LINK_* */
+	unsigned jobs; /* 0 for library default */
+	size_t rate; /* bytes per second, 0 for unlimited */
+	size_t album_rate; /* bytes per second, 0 for unlimited */
+	unsigned lookahead; /* album pages fetched ahead with -i */
+	size_t split; /* bytes, 0 for never */
+	int io; /* BCDL_IO_* */
+	int archive; /* BCDL_ARCHIVE_* */
+	const char *archive_to; /* NULL for one archive per album, "-" for stdout */
+	size_t pool; /* bytes, 0 for none */
+	int hugepages;
+	int verbose; /* statistics printed once done */
+};
+
+extern struct _settings SETTINGS;
+
+#define DISCOGRAPHY_WINDOW 8 /* album pages fetched ahead */
+#define DEFAULT_LOOKAHEAD 2 /* album pages fetched ahead with -i */
+#define MAX_LOOKAHEAD 64
+
+/* -i job whose album page may be fetched ahead of its turn */
+struct _cli_job {
+	unsigned number;
+	char *url;
+	bcdl_album_t *album; /* NULL unless fetched ahead */
+	int reported; /* failed ahead of its turn, already told the user */
+};
 enum _verbose {
 	NORMAL,
 	VERBOSE
 };
 
-void program_error(enum _error_flag);
+void program_error(ferror_t);
+bcdl_t *cli_init(void);
+void cli_cleanup(bcdl_t *);
 enum _flag_mode get_mode(const char *);
+int parse_setting(const char *, int);
+int parse_options(int *, char **);
+void apply_signals(void);
 void program_help(void);
 void program_identification(enum _verbose);
 void program_usage(enum _verbose);
+void program_stats(void);
 void progress_indicator(char *, unsigned, unsigned, char *);
+void display_plan(bcdl_t *, bcdl_album_t *);
+ferror_t download_album(bcdl_t *, bcdl_album_t *, checkpoint_t *);
+ferror_t download_album_at_URL(bcdl_t *, const char *, checkpoint_t *);
+ferror_t download_discography_at_URL(bcdl_t *, const char *, checkpoint_t *);
+ferror_t download_URL(bcdl_t *, const char *, checkpoint_t *);
+ferror_t retag_URL(bcdl_t *, const char *);
+void download_list(bcdl_t *, url_reader_t *, checkpoint_t *);
 
 typedef enum _flag_mode fmode_t;
-typedef enum _error_flag ferror_t;
 
 #endif
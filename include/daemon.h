@@ -0,0 +1,60 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+/*
+ *	daemon.h
+ *	This file is part of bc-dl.
+ *	See bc-dl.c for copyright or LICENSE for license information.
+ */
+
+/* from daemon.c */
+
+#define DAEMON_SOCKET "bc-dl.sock" /* default, in working directory */
+#define DAEMON_MAX_ALBUMS 4 /* albums downloading at once */
+#define DAEMON_DEFAULT_PRIORITY 5
+#define DAEMON_AGING 60 /* seconds queued per priority level gained */
+#define DAEMON_MAX_LINE 4096
+
+/* control traffic is kept out of the download memory budget */
+struct _daemon_client {
+	int fd;
+	char in[DAEMON_MAX_LINE + 1]; /* partial request line */
+	size_t in_len;
+	char *out; /* status lines not yet sent */
+	size_t out_len;
+	size_t out_size;
+	unsigned running; /* jobs of this client downloading now */
+	int closed;
+	struct _daemon_client *next;
+};
+
+struct _daemon_job {
+	unsigned id;
+	char *url;
+	int priority; /* higher runs first */
+	time_t queued;
+	struct _daemon_client *client; /* NULL once client hangs up */
+	bcdl_album_t *album; /* NULL while queued */
+	int started; /* reported as STARTED */
+	int finished;
+	struct _daemon_job *next;
+};
+
+struct _daemon {
+	int listen_fd;
+	bcdl_t *bcdl; /* one warm transfer engine for every job */
+	checkpoint_t *cp;
+	struct _daemon_job *queue;
+	struct _daemon_job *running;
+	unsigned running_count;
+	struct _daemon_client *clients;
+	unsigned next_id;
+};
+
+typedef struct _daemon_client client_t;
+typedef struct _daemon_job job_t;
+typedef struct _daemon daemon_t;
+
+int daemon_run(const char *);
+
+#endif
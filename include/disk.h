@@ -0,0 +1,44 @@
+#ifndef DISK_H
+#define DISK_H
+
+/*
+ *	disk.h
+ *	This file is part of bc-dl.
+ *	See bc-dl.c for copyright or LICENSE for license information.
+ */
+
+/* from disk.c */
+
+#define DISK_RING_ENTRIES 64 /* per thread */
+#define DISK_MAX_WRITE (1UL << 30) /* bytes per write request */
+#define DISK_PART_SUFFIX ".part" /* file is written here first, then renamed */
+
+/* same order as BCDL_IO_* */
+enum _disk_backend {
+	DISK_AUTO = 0, /* io_uring if the kernel allows it */
+	DISK_URING = 1,
+	DISK_PWRITE = 2
+};
+
+/* io_uring rings as mapped from the kernel, one per writing thread */
+struct _disk_ring {
+	int fd;
+	unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	unsigned tail; /* next free entry, published to sq_tail by disk_ring_submit() */
+	unsigned queued; /* entries filled in since the last submit */
+	void *sq_map, *cq_map;
+	size_t sq_map_len, cq_map_len, sqes_len;
+};
+
+typedef enum _disk_backend disk_backend_t;
+typedef struct _disk_ring disk_ring_t;
+
+int disk_set_backend(disk_backend_t);
+disk_backend_t disk_backend(void);
+int disk_write(const char *, const char *, size_t, const char *, size_t);
+int disk_free(const char *, unsigned long long *);
+
+#endif
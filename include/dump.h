@@ -0,0 +1,30 @@
+#ifndef DUMP_H
+#define DUMP_H
+
+/*
+ *	dump.h
+ *	This file is part of bc-dl.
+ *	See bc-dl.c for copyright or LICENSE for license information.
+ */
+
+/* from dump.c */
+
+#define DUMP_WINDOW 32 /* album pages fetched at once */
+
+struct _dump {
+	bcdl_t *bcdl;
+	const char *single; /* or a single URL, until it's opened */
+	url_reader_t *reader; /* NULL for a single URL */
+	char **pending; /* releases of a discography not yet opened */
+	unsigned pending_count;
+	unsigned next_pending;
+	bcdl_album_t *window[DUMP_WINDOW];
+	unsigned open;
+	unsigned failed;
+};
+
+typedef struct _dump dump_t;
+
+int dump_run(const char *);
+
+#endif
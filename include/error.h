@@ -0,0 +1,36 @@
+#ifndef ERROR_H
+#define ERROR_H
+
+/*
+ *	error.h
+ *	This file is part of bc-dl.
+ *	See bc-dl.c for copyright or LICENSE for license information.
+ */
+
+/* from error.c */
+
+/* ERRORS DEFINED HERE */
+
+#define NUMBER_OF_ERRORS 7
+
+enum _error_flag {
+	EVERYTHING_IS_FINE = -1, /* not a real error */
+	ERROR_INVALID_URL,
+	ERROR_CONNECTION,
+	ERROR_JSON,
+	ERROR_FILE_IO,
+	ERROR_MEM_IO,
+	ERROR_STREAM,
+	ERROR_DISK_SPACE
+};
+
+struct _error {
+	const enum _error_flag err;
+	const char *desc;
+};
+
+typedef enum _error_flag ferror_t;
+
+const char *error_string(ferror_t);
+
+#endif
@@ -20,6 +20,6 @@ struct _global {
 
 /* from bc-dl.c */
 
-struct _global GLOBAL;
+extern struct _global GLOBAL;
 
 #endif
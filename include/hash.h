@@ -0,0 +1,31 @@
+#ifndef HASH_H
+#define HASH_H
+
+/*
+ *	hash.h
+ *	This file is part of bc-dl.
+ *	See bc-dl.c for copyright or LICENSE for license information.
+ */
+
+/* from hash.c */
+
+#define HASH_HEX_LENGTH 16 /* digest as a hex string, without terminator */
+
+typedef unsigned long long hash64_t; /* needs 64 bits */
+
+/* streaming XXH64 state */
+struct _hash {
+	hash64_t v[4];
+	unsigned char buffer[32]; /* input not yet consumed as a full stripe */
+	unsigned buffered;
+	hash64_t total;
+};
+
+typedef struct _hash hash_t;
+
+void hash_init(hash_t *);
+void hash_update(hash_t *, const void *, size_t);
+hash64_t hash_digest(const hash_t *);
+void hash_hex(hash64_t, char *);
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef ID3_H
+#define ID3_H
+
+/*
+ *	id3.h
+ *	This file is part of bc-dl.
+ *	See bc-dl.c for copyright or LICENSE for license information.
+ */
+
+/* from id3.c */
+
+/* CONSTANTS */
+
+#define ID3_HEADER_LENGTH 10 /* tag header and frame header alike */
+#define ID3_HEADER_LEN_OFFSET 6
+#define ID3_FRAME_LEN_OFFSET 4
+#define ID3_PADDING 2048 /* room for later edits, see id3_retag_file() */
+#define ID3_MAX_FIELDS 5
+
+/* one frame, as a list of byte strings written back to back */
+struct _id3_field {
+	const char *data;
+	size_t len;
+};
+
+struct _id3_payload {
+	const char *id; /* 4 characters */
+	struct _id3_field field[ID3_MAX_FIELDS];
+	unsigned fields;
+};
+
+typedef struct _id3_payload payload_t;
+
+unsigned long id3_syncsafe_decode(const void *);
+void id3_syncsafe_encode(unsigned long, void *);
+size_t id3_tag_length(const char *, size_t);
+const char *id3_find_frame(const char *, size_t, const char *, size_t *);
+void id3_add_field(payload_t *, const char *, size_t);
+size_t id3_frame_length(const payload_t *);
+membuf_t *id3_serialize(const payload_t *, unsigned, size_t);
+
+#endif
@@ -14,6 +14,28 @@ enum _filename_mode {
 	FOLDER_MODE = 1
 };
 
-void download_album_at_URL(const char *);
+#define PATH_BUILDER_MAX 4096 /* PATH_MAX on Linux */
+
+/* see PATH BUILDER in interface.c */
+struct _path {
+	char buf[PATH_BUILDER_MAX]; /* always terminated */
+	size_t len;
+};
+
+typedef struct _path path_t;
+
+void sanitize_range(char *, size_t);
+void sanitize_filename(char *, enum _filename_mode);
+char *create_string(const char *);
+char *concat_strings(const char *, const char *);
+int create_folder(const char *);
+void path_reset(path_t *);
+void path_truncate(path_t *, size_t);
+int path_add(path_t *, const char *);
+int path_add_folder(path_t *, album_t *);
+int path_add_track(path_t *, album_t *, unsigned);
+int link_file(const char *, const char *, int);
+int file_begins_with(const char *, const char *, size_t, size_t);
+long file_exists(const char *);
 
 #endif
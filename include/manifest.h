@@ -0,0 +1,35 @@
+#ifndef MANIFEST_H
+#define MANIFEST_H
+
+/*
+ *	manifest.h
+ *	This file is part of bc-dl.
+ *	See bc-dl.c for copyright or LICENSE for license information.
+ */
+
+/* from manifest.c */
+
+#define MANIFEST_FILENAME ".bc-dl.manifest"
+#define MANIFEST_BUCKETS 1024 /* initial size, grows as needed */
+
+struct _manifest_entry {
+	hash64_t hash;
+	char *path;
+	struct _manifest_entry *next;
+};
+
+struct _manifest {
+	FILE *log; /* append-only */
+	struct _manifest_entry **buckets;
+	unsigned bucket_count;
+	unsigned entries;
+};
+
+typedef struct _manifest manifest_t;
+
+manifest_t *manifest_open(const char *);
+const char *manifest_lookup(manifest_t *, hash64_t);
+void manifest_record(manifest_t *, hash64_t, const char *);
+void manifest_close(manifest_t *);
+
+#endif
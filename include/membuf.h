@@ -9,18 +9,50 @@
 
 /* from membuf.c */
 
+/* MEMORY BUDGET DEFAULTS */
+
+#define MEMBUF_DEFAULT_BUDGET (1024UL * 1024 * 1024) /* all buffers together */
+#define MEMBUF_DEFAULT_SPILL (64UL * 1024 * 1024) /* one buffer */
+
 struct _membuf {
 	char *memory;
 	size_t size;
+	size_t capacity; /* 0 unless memory is a buffer pool buffer, see bufpool.c */
 	char *filename; /* optional */
+	int borrowed; /* filename isn't the membuf's, it's not freed with it */
+	size_t offset; /* leading bytes not part of the content, eg. stale tags */
+	struct _membuf *header; /* optional, written out before content */
+	size_t reserved; /* bytes charged to memory budget */
+	int can_spill; /* buffer may be moved to a temp file */
+	int spill_fd; /* -1 unless buffer was moved to a temp file */
+	int mapped; /* memory is a mapping of the temp file */
+};
+
+struct _membuf_budget {
+	size_t limit; /* 0 for no limit */
+	size_t spill_threshold; /* 0 to never spill large buffers */
+	size_t used;
+	size_t peak;
+	unsigned spills;
 };
 
 typedef struct _membuf membuf_t;
 
+extern struct _membuf_budget MEMBUF_BUDGET;
+
+void membuf_set_budget(size_t, size_t);
+int membuf_budget_headroom(size_t);
+void membuf_budget_stats(struct _membuf_budget *);
 size_t membuf_write(void *, size_t, size_t, void *);
 membuf_t *membuf_init(void);
-membuf_t *membuf_download(const char *, char *);
-void membuf_commit_to_disk(membuf_t *);
+membuf_t *membuf_alloc(size_t);
+void membuf_expect(membuf_t *, size_t);
+int membuf_temp_file(void);
+int membuf_reserve(membuf_t *, size_t);
+int membuf_write_at(membuf_t *, size_t, const char *, size_t);
+int membuf_map(membuf_t *);
+membuf_t *membuf_load(const char *);
+ferror_t membuf_commit_to_disk(membuf_t *);
 void membuf_free(membuf_t *);
 
 #endif
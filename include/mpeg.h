@@ -0,0 +1,46 @@
+#ifndef MPEG_H
+#define MPEG_H
+
+/*
+ *	mpeg.h
+ *	This file is part of bc-dl.
+ *	See bc-dl.c for copyright or LICENSE for license information.
+ */
+
+/* from mpeg.c */
+
+#define MPEG_MAX_HEAD 38 /* frame header + CRC + largest side info */
+
+enum _mpeg_status {
+	MPEG_OK,
+	MPEG_LOST_SYNC, /* not an MPEG frame where one was expected */
+	MPEG_BAD_CRC,
+	MPEG_TRUNCATED, /* stream ends partway through a frame */
+	MPEG_EMPTY /* no frames at all */
+};
+
+/* walker state, carried between chunks */
+struct _mpeg_stream {
+	unsigned char head[MPEG_MAX_HEAD]; /* start of current frame */
+	unsigned have; /* bytes of head collected so far */
+	unsigned need; /* bytes of head needed before it can be checked */
+	size_t skip; /* bytes left to skip in current frame or tag */
+	size_t position;
+	int trailer; /* ID3v1 tag seen, stream must end */
+	int tail; /* APEv2 or Lyrics3 tag seen, the rest is tags */
+	int in_frame; /* bytes being skipped are audio, not a tag */
+	hash_t hash; /* of audio frames only, tags are left out */
+	unsigned long frames;
+	double duration; /* seconds */
+	enum _mpeg_status status;
+};
+
+typedef struct _mpeg_stream mpeg_t;
+typedef enum _mpeg_status mstatus_t;
+
+void mpeg_init(mpeg_t *);
+mstatus_t mpeg_feed(mpeg_t *, const char *, size_t);
+mstatus_t mpeg_finish(mpeg_t *);
+unsigned long mpeg_duration_ms(mpeg_t *);
+
+#endif
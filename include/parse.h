@@ -25,6 +25,10 @@ struct _album_container {
 typedef struct _album_container album_t;
 
 album_t *parse_album_data(membuf_t *);
+int album_page_complete(membuf_t *, size_t *);
+int page_is_album(membuf_t *);
+char **parse_discography(membuf_t *, const char *, unsigned *);
+void free_discography(char **, unsigned);
 void display_album_data(album_t *);
 void free_album_data(album_t *);
 
@@ -0,0 +1,49 @@
+#ifndef POOL_H
+#define POOL_H
+
+/*
+ *	pool.h
+ *	This file is part of bc-dl.
+ *	See bc-dl.c for copyright or LICENSE for license information.
+ */
+
+/* from pool.c */
+
+#define POOL_MAX_THREADS 16
+
+struct _pool_job;
+
+typedef void (*pool_job_cb)(struct _pool_job *);
+
+/* embed as the first member of a larger struct to carry the job's data */
+struct _pool_job {
+	pool_job_cb run; /* on a worker thread */
+	void *owner; /* jobs cancelled together, see pool_cancel() */
+	int running; /* picked up by a worker */
+	struct _pool_job *next;
+};
+
+struct _pool {
+	pthread_t threads[POOL_MAX_THREADS];
+	unsigned thread_count;
+	pthread_mutex_t lock;
+	pthread_cond_t work; /* job queued or pool stopping */
+	pthread_cond_t idle; /* a job finished */
+	struct _pool_job *queue, *queue_tail; /* waiting for a worker */
+	struct _pool_job *running; /* on a worker right now */
+	struct _pool_job *done; /* finished, waiting for pool_reap() */
+	int stopping;
+	void (*notify)(void *); /* optional, from a worker when a job finishes */
+	void *userdata;
+};
+
+typedef struct _pool_job pool_job_t;
+typedef struct _pool pool_t;
+
+pool_t *pool_init(unsigned, void (*)(void *), void *);
+void pool_submit(pool_t *, pool_job_t *);
+pool_job_t *pool_reap(pool_t *);
+pool_job_t *pool_cancel(pool_t *, void *);
+void pool_cleanup(pool_t *);
+
+#endif
@@ -9,19 +9,14 @@
 
 /* from tag.c */
 
-/* CONSTANTS */
-
-#define ID3_HEADER_LENGTH 10
-#define ID3_HEADER_LEN_OFFSET 6
-#define ID3_FRAME_LEN_OFFSET 4
-
 /* ID3 FRAMES DEFINED HERE */
 
-#define NUMBER_OF_FRAMES 8
+#define NUMBER_OF_FRAMES 9
 
 enum _id3_frame_type {
 	TIT2, TPE1, TALB, TDRC,
-	TRCK, COMM, TPE2, APIC
+	TRCK, COMM, TPE2, APIC,
+	TLEN
 };
 
 struct _id3_frame {
@@ -31,6 +26,7 @@ struct _id3_frame {
 
 typedef struct _id3_frame frame_t;
 
-membuf_t *write_id3_tags(membuf_t *, membuf_t *, album_t *, unsigned);
+ferror_t write_id3_tags(membuf_t *, membuf_t *, album_t *, unsigned, unsigned long);
+ferror_t id3_retag_file(const char *, membuf_t *, album_t *, unsigned);
 
 #endif
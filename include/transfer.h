@@ -0,0 +1,183 @@
+#ifndef TRANSFER_H
+#define TRANSFER_H
+
+/*
+ *	transfer.h
+ *	This file is part of bc-dl.
+ *	See bc-dl.c for copyright or LICENSE for license information.
+ */
+
+/* from transfer.c */
+
+/* CONNECTION LIMITS SHARED BY ALL TRANSFERS */
+
+#define TRANSFER_MAX_CONNECTIONS 64
+#define TRANSFER_MAX_HOST_CONNECTIONS 16 /* ceiling for the controller */
+#define TRANSFER_DNS_CACHE_TIMEOUT 300 /* seconds */
+#define TRANSFER_WARM_AGE 30 /* seconds an idle connection is trusted to stay open */
+#define TRANSFER_CONNECT_TIMEOUT 30 /* seconds */
+#define TRANSFER_EVENTS 256 /* socket events handled per engine_perform() */
+
+/* STALLS AND STRAGGLERS */
+
+#define TRANSFER_STALL_RATE 1024 /* bytes per second, anything slower is stalled */
+#define TRANSFER_STALL_TIME 20 /* seconds a transfer may be stalled before it's aborted */
+#define TRANSFER_HEDGE_AGE 2.0 /* seconds before a transfer is compared to its peers */
+#define TRANSFER_HEDGE_RATIO 4.0 /* times slower than the average peer to be duplicated */
+#define TRANSFER_MAX_HEDGES 4 /* duplicates in flight */
+
+/* PER-HOST CONCURRENCY CONTROLLER */
+
+#define TRANSFER_INITIAL_HOST_LIMIT 2
+#define TRANSFER_TUNE_INTERVAL 1000 /* ms between controller steps */
+#define TRANSFER_GAIN 1.05 /* throughput must rise 5% to keep growing */
+#define TRANSFER_LATENCY_SPIKE 4.0 /* times best time to first byte */
+#define TRANSFER_LATENCY_FLOOR 0.25 /* seconds, spikes below this are ignored */
+
+/* BANDWIDTH SHAPING */
+
+#define TRANSFER_SHAPE_INTERVAL 20 /* ms between refills while a transfer is paused */
+#define TRANSFER_BURST 0.25 /* seconds of a group's rate its bucket can save up */
+#define TRANSFER_MAX_WINDOWS 8 /* time of day schedule entries */
+
+/* RANGE REQUESTS */
+
+#define TRANSFER_SEGMENTS 4 /* requests a large body is split between */
+
+struct _rate_window {
+	unsigned start, end; /* minutes past midnight, local time, wraps if end < start */
+	size_t rate; /* bytes per second, 0 for unlimited */
+};
+
+struct _shaper {
+	size_t rate; /* bytes per second for every transfer together, 0 for unlimited */
+	size_t share; /* bytes per second for any one group, 0 for no cap */
+	struct _rate_window schedule[TRANSFER_MAX_WINDOWS]; /* overrides rate */
+	unsigned windows;
+	int halvings; /* of whichever rate is in effect, negative doubles it */
+};
+
+extern struct _shaper TRANSFER_SHAPER;
+
+struct _transfer;
+
+/* transfers sharing bandwidth and host slots fairly with other groups,
+ * usually one album, transfers added without one share the engine's
+ */
+struct _group {
+	unsigned running; /* transfers in flight */
+	size_t rate; /* bytes per second at last refill, 0 for unlimited */
+	double tokens; /* bytes that may be received before pausing */
+	int paused; /* a transfer ran out of tokens */
+	double bytes, seconds; /* received by finished transfers and time they took */
+	unsigned finished;
+	double live_bytes, live_started; /* sums over peers in flight, see transfer_peer_speed() */
+	unsigned live;
+	struct _group *next; /* in engine's list while running */
+};
+
+struct _host {
+	char *name; /* host[:port] */
+	unsigned active; /* transfers in flight */
+	unsigned limit; /* transfers allowed in flight */
+	double throughput; /* bytes per second at last step */
+	double best_latency; /* lowest time to first byte, seconds */
+	int backoff; /* error or latency spike since last step */
+	double last_used; /* last transfer finished, seconds */
+	struct _transfer *running; /* in flight */
+	struct _transfer *queue, *queue_tail; /* waiting for a slot */
+	struct _host *next;
+};
+
+typedef void (*transfer_cb)(struct _transfer *, void *);
+typedef int (*transfer_data_cb)(struct _transfer *, const char *, size_t, void *);
+
+struct _transfer {
+	char *url;
+	membuf_t *membuf; /* response body */
+	CURL *handle; /* NULL unless in flight */
+	CURLcode result;
+	long status; /* HTTP response code */
+	curl_off_t content_length; /* as the response gave it once done, -1 if it didn't */
+	int done;
+	int compressed; /* ask for gzip, brotli or zstd, decoded as it arrives */
+	int head_only; /* HEAD request, no body */
+	int internal; /* started by the engine itself, freed once done */
+	int out_of_memory; /* membuf could not be expanded */
+	int unordered; /* on_data didn't see the body in order, if at all */
+	size_t split; /* bodies larger than this are fetched in ranges, 0 for never */
+	transfer_data_cb on_data; /* optional, sees each chunk, return 0 to stop */
+	transfer_cb on_done; /* optional */
+	void *userdata;
+	struct _host *host;
+	struct _group *group; /* optional, set before engine_add() */
+	int paused; /* waiting for tokens */
+	int queued; /* waiting for a slot, not yet handed to libcurl */
+	struct _transfer *next; /* in host's running list or queue */
+	double started; /* seconds */
+	int peer; /* counted in its group's live sums */
+	curl_off_t peer_bytes; /* received as of the last progress call */
+	double window_start; /* seconds, start of stall detection window */
+	curl_off_t window_bytes; /* received by window_start */
+	struct _transfer *hedge; /* duplicate racing this one, on a connection of its own */
+	struct _transfer *hedge_of; /* transfer a duplicate stands in for */
+	/* split transfers, the whole request fetches the first segment */
+	int split_checked; /* first chunk seen */
+	int split_pending; /* segments to be started */
+	int split_failed; /* server ignored a range, whole request fetches everything */
+	int segmented; /* body is written in place, membuf was reserved up front */
+	int cut; /* whole request stopped once its segment was in */
+	int finished; /* whole request's own response is over */
+	char *split_url; /* after redirects */
+	struct _transfer *parent; /* whole transfer of a segment */
+	struct _transfer *segments; /* of a whole transfer, linked by sibling */
+	struct _transfer *sibling;
+	size_t offset, length; /* range of the body, whole transfers start at 0 */
+	size_t received; /* bytes of the range written */
+	int confirmed; /* server answered with the range asked for */
+};
+
+struct _engine {
+	CURLM *multi; /* owns connection cache */
+	int epoll; /* every socket libcurl wants watched, and wake[0] */
+	int wake[2]; /* pipe, see engine_wakeup() */
+	double deadline; /* seconds, libcurl's timer, negative if not set */
+	CURLSH *share; /* DNS and TLS session cache */
+	unsigned active; /* including queued transfers */
+	struct _host *hosts;
+	unsigned max_host; /* ceiling for every host's limit */
+	double last_tune; /* seconds */
+	struct _group *groups; /* groups with transfers in flight */
+	struct _group loose; /* for transfers without a group */
+	size_t rate; /* TRANSFER_SHAPER limit as of last tune */
+	double last_shape; /* seconds */
+	unsigned hedges; /* duplicates in flight */
+};
+
+typedef struct _transfer transfer_t;
+typedef struct _engine engine_t;
+typedef struct _host host_t;
+typedef struct _group group_t;
+
+engine_t *engine_init(void);
+void engine_add(engine_t *, transfer_t *);
+void engine_remove(engine_t *, transfer_t *);
+unsigned engine_perform(engine_t *);
+void engine_wait(engine_t *, int);
+int engine_fdset(engine_t *, fd_set *, fd_set *, fd_set *, int *);
+long engine_timeout(engine_t *);
+void engine_run(engine_t *);
+void engine_cleanup(engine_t *);
+void engine_set_max_host(engine_t *, unsigned);
+void engine_prewarm(engine_t *, const char *);
+void engine_wakeup(engine_t *);
+void transfer_set_bandwidth(size_t, size_t);
+void transfer_scale_bandwidth(int);
+size_t transfer_rate(void);
+double transfer_clock(void);
+int transfer_set_schedule(const char *);
+transfer_t *transfer_init(const char *, char *);
+ferror_t transfer_error(transfer_t *);
+void transfer_free(transfer_t *);
+
+#endif
@@ -9,12 +9,30 @@
 
 /* from utilities.c */
 
-char *create_filebuffer(const char *);
-void destroy_filebuffer(char *);
-char **create_URL_buffer(const char *, unsigned *);
-void destroy_URL_buffer(char **, unsigned);
+struct _url_reader {
+	FILE *fp;
+	char *token; /* holds the current URL only */
+	size_t capacity;
+	unsigned count; /* URLs read so far */
+};
+
+typedef struct _url_reader url_reader_t;
+
+enum _url_type {
+	URL_INVALID,
+	URL_ALBUM, /* also singles and tracks */
+	URL_DISCOGRAPHY /* artist root or /music page */
+};
+
+url_reader_t *url_reader_open(const char *);
+char *url_reader_next(url_reader_t *);
+void url_reader_close(url_reader_t *);
+enum _url_type URL_type(const char *);
 int URL_is_valid(const char *);
+int parse_size(const char *, size_t *);
+int parse_uint(const char *, unsigned *);
 unsigned uintlen(unsigned);
+void human_readable_filesize(size_t);
 void animate_progress_bar(size_t);
 
 #endif
@@ -0,0 +1,428 @@
+#define _POSIX_C_SOURCE 200809L /* localtime_r, pthreads */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "error.h"
+#include "archive.h"
+
+/*
+ *	archive.c
+ *	This file is part of bc-dl.
+ *	See bc-dl.c for copyright or LICENSE for license information.
+ */
+
+/* ARCHIVE OUTPUT
+ * tracks and art are appended to a tar or zip archive as they're written
+ * out instead of going to files of their own, so nothing has to be read
+ * back to archive an album
+ * every member is in memory, whole, before it's added, so its size and
+ * checksum are known up front and nothing is ever seeked back to, which
+ * lets an archive be streamed down a pipe
+ * writer threads add members concurrently, each member is written out
+ * in one piece under the archive's lock, zip checksums are worked out
+ * before taking it
+ */
+
+/* ZIP CHECKSUMS */
+
+unsigned long ARCHIVE_CRC_TABLE[256];
+pthread_once_t ARCHIVE_CRC_ONCE = PTHREAD_ONCE_INIT;
+
+void archive_crc_init(void)
+{
+	unsigned long i, j;
+	for (i = 0; i < 256; i++)
+	{
+		unsigned long c = i;
+		for (j = 0; j < 8; j++)
+			c = (c & 1) ? 0xEDB88320UL ^ (c >> 1) : c >> 1;
+		ARCHIVE_CRC_TABLE[i] = c;
+	}
+}
+
+unsigned long archive_crc(unsigned long crc, const char *data, size_t len)
+{
+	/* CRC-32 as zip uses it, start with 0 and feed the result back in */
+	const unsigned char *p = (const unsigned char *) data;
+	crc = ~crc & 0xFFFFFFFFUL;
+	while (len--)
+		crc = ARCHIVE_CRC_TABLE[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+	return ~crc & 0xFFFFFFFFUL;
+}
+
+/* OUTPUT */
+
+void archive_write(archive_t *a, const void *data, size_t len)
+{
+	/* once anything fails, the rest is dropped and the archive is failed */
+	const char *p = (const char *) data;
+	while (len && !a->failed)
+	{
+		ssize_t written = write(a->fd, p, len);
+		if (written < 0)
+		{
+			if (errno != EINTR)
+				a->failed = 1;
+			continue;
+		}
+		p += written;
+		len -= written;
+		a->written += written;
+	}
+}
+
+void archive_pad(archive_t *a, size_t len)
+{
+	static const char zeros[ARCHIVE_BLOCK];
+	while (len)
+	{
+		size_t n = (len < sizeof(zeros)) ? len : sizeof(zeros);
+		archive_write(a, zeros, n);
+		len -= n;
+	}
+}
+
+void archive_put(unsigned char *p, unsigned long long value, unsigned bytes)
+{
+	/* little endian, zip */
+	unsigned i;
+	for (i = 0; i < bytes; i++, value >>= 8)
+		p[i] = (unsigned char) (value & 0xFF);
+}
+
+void archive_octal(char *field, unsigned width, unsigned long long value)
+{
+	/* zero padded, terminated, tar */
+	field[--width] = '\0';
+	while (width--)
+	{
+		field[width] = (char) ('0' + (value & 7));
+		value >>= 3;
+	}
+}
+
+/* TAR */
+
+void archive_tar_header(archive_t *a, const char *name, size_t split, unsigned long long size, char type)
+{
+	/* name is cut at split into prefix and name, 0 keeps it whole */
+	unsigned char block[ARCHIVE_BLOCK];
+	char *h = (char *) block;
+	memset(block, 0, sizeof(block));
+	if (split)
+	{
+		memcpy(h + 345, name, split);
+		name += split + 1;
+	}
+	strncpy(h, name, ARCHIVE_USTAR_NAME);
+	archive_octal(h + 100, 8, 0644); /* mode */
+	archive_octal(h + 108, 8, 0); /* uid */
+	archive_octal(h + 116, 8, 0); /* gid */
+	archive_octal(h + 124, 12, size > ARCHIVE_USTAR_SIZE ? 0 : size);
+	archive_octal(h + 136, 12, (unsigned long long) a->mtime);
+	h[156] = type;
+	memcpy(h + 257, "ustar", 6);
+	memcpy(h + 263, "00", 2);
+	memset(h + 148, ' ', 8);
+	unsigned long sum = 0;
+	unsigned i;
+	for (i = 0; i < ARCHIVE_BLOCK; i++)
+		sum += block[i];
+	archive_octal(h + 148, 7, sum); /* six digits, then NUL and space */
+	h[155] = ' ';
+	archive_write(a, block, sizeof(block));
+}
+
+size_t archive_pax_record(char *out, const char *key, const char *value)
+{
+	/* "LENGTH key=value\n", where LENGTH counts itself
+	 * returns length, writes nothing if out is NULL
+	 */
+	size_t base = strlen(key) + strlen(value) + 3, len = base + 1;
+	for (;;)
+	{
+		size_t digits = 1, n;
+		for (n = len; n >= 10; n /= 10)
+			digits++;
+		if (base + digits == len)
+			break;
+		len = base + digits;
+	}
+	if (out)
+		sprintf(out, "%lu %s=%s\n", (unsigned long) len, key, value);
+	return len;
+}
+
+void archive_tar_add(archive_t *a, const char *name, unsigned long long size)
+{
+	/* header of a member, its content follows */
+	size_t name_len = strlen(name), split = 0;
+	if (name_len > ARCHIVE_USTAR_NAME)
+	{
+		/* prefix and name must each fit, split at a slash */
+		const char *slash;
+		for (slash = name + name_len - 1; slash > name; slash--)
+		{
+			if (*slash == '/' && (size_t) (slash - name) <= ARCHIVE_USTAR_PREFIX &&
+			    name_len - (slash - name) - 1 <= ARCHIVE_USTAR_NAME)
+				break;
+		}
+		split = (*slash == '/' && slash > name) ? (size_t) (slash - name) : (size_t) -1;
+	}
+	if (split == (size_t) -1 || size > ARCHIVE_USTAR_SIZE)
+	{
+		/* pax extended header for what ustar can't hold */
+		char size_str[24], *records;
+		sprintf(size_str, "%llu", size);
+		size_t len = 0;
+		if (split == (size_t) -1)
+			len += archive_pax_record(NULL, "path", name);
+		if (size > ARCHIVE_USTAR_SIZE)
+			len += archive_pax_record(NULL, "size", size_str);
+		records = (char *) malloc(len + 1);
+		len = 0;
+		if (split == (size_t) -1)
+			len += archive_pax_record(records + len, "path", name);
+		if (size > ARCHIVE_USTAR_SIZE)
+			len += archive_pax_record(records + len, "size", size_str);
+		archive_tar_header(a, "PaxHeader", 0, len, 'x');
+		archive_write(a, records, len);
+		archive_pad(a, (ARCHIVE_BLOCK - len % ARCHIVE_BLOCK) % ARCHIVE_BLOCK);
+		free(records);
+		if (split == (size_t) -1)
+			split = 0; /* truncated, path record wins */
+	}
+	archive_tar_header(a, name, split, size, '0');
+}
+
+/* ZIP */
+
+void archive_zip_add(archive_t *a, const char *name, unsigned long crc, unsigned long long size)
+{
+	/* local header of a stored member, its content follows */
+	if (a->entry_count == a->entry_alloc)
+	{
+		a->entry_alloc = a->entry_alloc ? a->entry_alloc * 2 : 64;
+		a->entries = (struct _archive_entry *) realloc(a->entries,
+		             sizeof(struct _archive_entry) * a->entry_alloc);
+	}
+	struct _archive_entry *e = &a->entries[a->entry_count++];
+	size_t name_len = strlen(name);
+	e->name = (char *) malloc(name_len + 1);
+	strcpy(e->name, name);
+	e->crc = crc;
+	e->size = size;
+	e->offset = a->written;
+	int zip64 = size >= ARCHIVE_ZIP32;
+	unsigned char h[30 + 20];
+	archive_put(h, 0x04034b50UL, 4);
+	archive_put(h + 4, zip64 ? 45 : 20, 2); /* version needed */
+	archive_put(h + 6, 0x0800, 2); /* names are UTF-8 */
+	archive_put(h + 8, 0, 2); /* stored */
+	archive_put(h + 10, a->dos_time, 4);
+	archive_put(h + 14, crc, 4);
+	archive_put(h + 18, zip64 ? ARCHIVE_ZIP32 : size, 4);
+	archive_put(h + 22, zip64 ? ARCHIVE_ZIP32 : size, 4);
+	archive_put(h + 26, name_len, 2);
+	archive_put(h + 28, zip64 ? 20 : 0, 2);
+	archive_write(a, h, 30);
+	archive_write(a, name, name_len);
+	if (zip64)
+	{
+		archive_put(h, 0x0001, 2);
+		archive_put(h + 2, 16, 2);
+		archive_put(h + 4, size, 8);
+		archive_put(h + 12, size, 8);
+		archive_write(a, h, 20);
+	}
+}
+
+void archive_zip_finish(archive_t *a)
+{
+	/* central directory, then its end records */
+	unsigned long long start = a->written;
+	unsigned char h[46 + 28];
+	size_t i;
+	for (i = 0; i < a->entry_count; i++)
+	{
+		struct _archive_entry *e = &a->entries[i];
+		int big = e->size >= ARCHIVE_ZIP32, far = e->offset >= ARCHIVE_ZIP32;
+		unsigned extra = (big || far) ? 4 + (big ? 16 : 0) + (far ? 8 : 0) : 0;
+		size_t name_len = strlen(e->name);
+		archive_put(h, 0x02014b50UL, 4);
+		archive_put(h + 4, (3 << 8) | 45, 2); /* made on unix */
+		archive_put(h + 6, extra ? 45 : 20, 2);
+		archive_put(h + 8, 0x0800, 2);
+		archive_put(h + 10, 0, 2);
+		archive_put(h + 12, a->dos_time, 4);
+		archive_put(h + 16, e->crc, 4);
+		archive_put(h + 20, big ? ARCHIVE_ZIP32 : e->size, 4);
+		archive_put(h + 24, big ? ARCHIVE_ZIP32 : e->size, 4);
+		archive_put(h + 28, name_len, 2);
+		archive_put(h + 30, extra, 2);
+		archive_put(h + 32, 0, 2); /* comment */
+		archive_put(h + 34, 0, 2); /* disk */
+		archive_put(h + 36, 0, 2); /* internal attributes */
+		archive_put(h + 38, 0100644UL << 16, 4); /* regular file, rw-r--r-- */
+		archive_put(h + 42, far ? ARCHIVE_ZIP32 : e->offset, 4);
+		archive_write(a, h, 46);
+		archive_write(a, e->name, name_len);
+		if (!extra)
+			continue;
+		unsigned char *x = h;
+		archive_put(x, 0x0001, 2);
+		archive_put(x + 2, extra - 4, 2);
+		x += 4;
+		if (big)
+		{
+			archive_put(x, e->size, 8);
+			archive_put(x + 8, e->size, 8);
+			x += 16;
+		}
+		if (far)
+			archive_put(x, e->offset, 8);
+		archive_write(a, h, extra);
+	}
+	unsigned long long size = a->written - start;
+	int zip64 = a->entry_count >= ARCHIVE_ZIP32_ENTRIES || start >= ARCHIVE_ZIP32 || size >= ARCHIVE_ZIP32;
+	if (zip64)
+	{
+		unsigned long long end = a->written;
+		archive_put(h, 0x06064b50UL, 4);
+		archive_put(h + 4, 44, 8); /* size of the rest of this record */
+		archive_put(h + 12, (3 << 8) | 45, 2);
+		archive_put(h + 14, 45, 2);
+		archive_put(h + 16, 0, 4);
+		archive_put(h + 20, 0, 4);
+		archive_put(h + 24, a->entry_count, 8);
+		archive_put(h + 32, a->entry_count, 8);
+		archive_put(h + 40, size, 8);
+		archive_put(h + 48, start, 8);
+		archive_write(a, h, 56);
+		archive_put(h, 0x07064b50UL, 4); /* locator */
+		archive_put(h + 4, 0, 4);
+		archive_put(h + 8, end, 8);
+		archive_put(h + 16, 1, 4);
+		archive_write(a, h, 20);
+	}
+	archive_put(h, 0x06054b50UL, 4);
+	archive_put(h + 4, 0, 2);
+	archive_put(h + 6, 0, 2);
+	archive_put(h + 8, zip64 ? ARCHIVE_ZIP32_ENTRIES : a->entry_count, 2);
+	archive_put(h + 10, zip64 ? ARCHIVE_ZIP32_ENTRIES : a->entry_count, 2);
+	archive_put(h + 12, zip64 ? ARCHIVE_ZIP32 : size, 4);
+	archive_put(h + 16, zip64 ? ARCHIVE_ZIP32 : start, 4);
+	archive_put(h + 20, 0, 2); /* comment */
+	archive_write(a, h, 22);
+}
+
+/* ARCHIVES */
+
+const char *archive_extension(archive_format_t format)
+{
+	return (format == ARCHIVE_ZIP) ? ".zip" : ".tar";
+}
+
+archive_t *archive_stream(int fd, archive_format_t format)
+{
+	/* archive written to fd as it goes, fd is left open on close */
+	pthread_once(&ARCHIVE_CRC_ONCE, archive_crc_init);
+	archive_t *a = (archive_t *) calloc(1, sizeof(archive_t));
+	a->format = format;
+	a->fd = fd;
+	pthread_mutex_init(&a->lock, NULL);
+	time_t now = time(NULL);
+	struct tm tm;
+	localtime_r(&now, &tm);
+	a->mtime = (long) now;
+	a->dos_time = ((unsigned long) (tm.tm_year - 80) << 25) | ((unsigned long) (tm.tm_mon + 1) << 21) |
+	              ((unsigned long) tm.tm_mday << 16) | (tm.tm_hour << 11) | (tm.tm_min << 5) | (tm.tm_sec / 2);
+	return a;
+}
+
+archive_t *archive_open(const char *filename, archive_format_t format)
+{
+	/* archive file, written beside filename and renamed into place once
+	 * closed, returns NULL if it can't be created
+	 */
+	char *part = (char *) malloc(strlen(filename) + sizeof(".part"));
+	strcpy(part, filename);
+	strcat(part, ".part");
+	int fd = open(part, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (fd < 0)
+	{
+		free(part);
+		return NULL;
+	}
+	archive_t *a = archive_stream(fd, format);
+	a->owned = 1;
+	a->part = part;
+	a->filename = (char *) malloc(strlen(filename) + 1);
+	strcpy(a->filename, filename);
+	return a;
+}
+
+ferror_t archive_add(archive_t *a, const char *name, const char *head, size_t head_len,
+                     const char *body, size_t body_len)
+{
+	/* member made of head then body, may be called from any thread */
+	unsigned long crc = 0;
+	if (a->format == ARCHIVE_ZIP)
+		crc = archive_crc(archive_crc(0, head, head_len), body, body_len);
+	unsigned long long size = (unsigned long long) head_len + body_len;
+	pthread_mutex_lock(&a->lock);
+	if (a->format == ARCHIVE_ZIP)
+		archive_zip_add(a, name, crc, size);
+	else
+		archive_tar_add(a, name, size);
+	archive_write(a, head, head_len);
+	archive_write(a, body, body_len);
+	if (a->format == ARCHIVE_TAR)
+		archive_pad(a, (ARCHIVE_BLOCK - size % ARCHIVE_BLOCK) % ARCHIVE_BLOCK);
+	int failed = a->failed;
+	pthread_mutex_unlock(&a->lock);
+	return failed ? ERROR_FILE_IO : EVERYTHING_IS_FINE;
+}
+
+ferror_t archive_close(archive_t *a, int discard)
+{
+	/* finish and free archive, or with discard set, drop a file archive
+	 * altogether, a stream is left as it is
+	 */
+	if (!discard)
+	{
+		if (a->format == ARCHIVE_ZIP)
+			archive_zip_finish(a);
+		else
+			archive_pad(a, 2 * ARCHIVE_BLOCK);
+	}
+	if (a->owned)
+	{
+		if (!discard && !a->failed && fsync(a->fd))
+			a->failed = 1;
+		if (close(a->fd))
+			a->failed = 1;
+		if (discard || a->failed || rename(a->part, a->filename))
+		{
+			a->failed = 1;
+			unlink(a->part);
+		}
+	}
+	ferror_t err = (a->failed && !discard) ? ERROR_FILE_IO : EVERYTHING_IS_FINE;
+	size_t i;
+	for (i = 0; i < a->entry_count; i++)
+		free(a->entries[i].name);
+	free(a->entries);
+	free(a->filename);
+	free(a->part);
+	pthread_mutex_destroy(&a->lock);
+	free(a);
+	return err;
+}
@@ -0,0 +1,78 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+/*
+ *	arena.c
+ *	This file is part of bc-dl.
+ *	See bc-dl.c for copyright or LICENSE for license information.
+ */
+
+/* strings that live exactly as long as something else, eg. an album's
+ * folder and track paths, are carved out of one arena and freed together
+ */
+
+void arena_init(arena_t *arena)
+{
+	arena->chunks = NULL;
+}
+
+char *arena_chunk_data(struct _arena_chunk *chunk)
+{
+	return (char *) chunk + sizeof(struct _arena_chunk);
+}
+
+void *arena_alloc(arena_t *arena, size_t size)
+{
+	/* returns NULL if out of memory */
+	size = (size + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN;
+	struct _arena_chunk *chunk, **link;
+	for (link = &arena->chunks; (chunk = *link); link = &chunk->next)
+	{
+		/* first chunk with room, chunks emptied by a reset included */
+		if (chunk->size - chunk->used >= size)
+			break;
+	}
+	if (!chunk)
+	{
+		size_t chunk_size = (size > ARENA_CHUNK) ? size : ARENA_CHUNK;
+		chunk = (struct _arena_chunk *) malloc(sizeof(struct _arena_chunk) + chunk_size);
+		if (!chunk)
+			return NULL;
+		chunk->size = chunk_size;
+		chunk->used = 0;
+		chunk->next = arena->chunks;
+		arena->chunks = chunk;
+	}
+	void *out = arena_chunk_data(chunk) + chunk->used;
+	chunk->used += size;
+	return out;
+}
+
+char *arena_strdup(arena_t *arena, const char *str)
+{
+	size_t len = strlen(str) + 1;
+	char *out = (char *) arena_alloc(arena, len);
+	if (out)
+		memcpy(out, str, len);
+	return out;
+}
+
+void arena_reset(arena_t *arena)
+{
+	/* everything handed out is gone, chunks are kept for reuse */
+	struct _arena_chunk *chunk;
+	for (chunk = arena->chunks; chunk; chunk = chunk->next)
+		chunk->used = 0;
+}
+
+void arena_free(arena_t *arena)
+{
+	while (arena->chunks)
+	{
+		struct _arena_chunk *next = arena->chunks->next;
+		free(arena->chunks);
+		arena->chunks = next;
+	}
+}
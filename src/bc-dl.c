@@ -1,11 +1,18 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <time.h>
 
 #include "global.h"
-#include "cli.h"
-#include "interface.h"
+#include "error.h"
+#include "bcdl.h"
 #include "utilities.h"
+#include "membuf.h"
+#include "checkpoint.h"
+#include "cli.h"
+#include "daemon.h"
+#include "dump.h"
 
 /*
  *	bc-dl - basic CLI downloader for bandcamp.com
@@ -46,7 +53,7 @@ struct _global GLOBAL = {
 
 int main(int argc, char **argv)
 {
-	if (argc < 2 || argc > 3) /* invalid usage */
+	if (parse_options(&argc, argv) || argc < 2 || argc > 3) /* invalid usage */
 	{
 		program_identification(NORMAL);
 		program_usage(VERBOSE);
@@ -67,22 +74,31 @@ int main(int argc, char **argv)
 	else if (mode == MODE_MULTI) /* -i, --iterate */
 	{
 		program_identification(NORMAL);
-		if (argv[2])
+		const char *list = argv[2];
+		if (!list && !isatty(STDIN_FILENO)) /* URLs piped in */
+			list = "-";
+		if (list)
 		{
-			char *buf = create_filebuffer(argv[2]);
-			unsigned elements = 0;
-			char **url_buffer = create_URL_buffer(buf, &elements);
-			destroy_filebuffer(buf);
-			unsigned i;
-			for (i = 0; i < elements; i++)
+			/* jobs are started as URLs are read, total is unknown */
+			/* albums completed by an earlier run are skipped without network I/O */
+			url_reader_t *reader = url_reader_open(list);
+			if (!reader)
 			{
-				progress_indicator("Job", i+1, elements, url_buffer[i]);
-				if (URL_is_valid(url_buffer[i]))
-					download_album_at_URL(url_buffer[i]);
-				else
-					program_error(ERROR_INVALID_URL);
+				perror("[!] Could not open file");
+				return 1;
 			}
-			destroy_URL_buffer(url_buffer, elements);
+			checkpoint_t *cp = checkpoint_open(CHECKPOINT_FILENAME);
+			if (!cp)
+			{
+				program_error(ERROR_FILE_IO);
+				url_reader_close(reader);
+				return 1;
+			}
+			bcdl_t *bcdl = cli_init();
+			download_list(bcdl, reader, cp);
+			cli_cleanup(bcdl);
+			checkpoint_close(cp);
+			url_reader_close(reader);
 			goto end;
 		}
 		else
@@ -91,6 +107,72 @@ int main(int argc, char **argv)
 			return 1;
 		}
 	}
+	else if (mode == MODE_DAEMON) /* -d, --daemon */
+	{
+		program_identification(NORMAL);
+		return daemon_run(argv[2] ? argv[2] : DAEMON_SOCKET);
+	}
+	else if (mode == MODE_RETAG) /* -r, --retag */
+	{
+		/* argument is an album URL or a list of them, like -i */
+		program_identification(NORMAL);
+		if (!argv[2])
+		{
+			program_usage(VERBOSE);
+			return 1;
+		}
+		int failed = 0;
+		bcdl_t *bcdl = cli_init();
+		if (URL_is_valid(argv[2]))
+		{
+			progress_indicator("Job", 1, 1, argv[2]);
+			ferror_t err = retag_URL(bcdl, argv[2]);
+			if (err != EVERYTHING_IS_FINE)
+			{
+				program_error(err);
+				failed = 1;
+			}
+		}
+		else
+		{
+			url_reader_t *reader = url_reader_open(argv[2]);
+			if (!reader)
+			{
+				perror("[!] Could not open file");
+				cli_cleanup(bcdl);
+				return 1;
+			}
+			char *url;
+			while ((url = url_reader_next(reader)))
+			{
+				progress_indicator("Job", reader->count, 0, url);
+				ferror_t err = retag_URL(bcdl, url);
+				if (err != EVERYTHING_IS_FINE) /* carry on with next job */
+				{
+					program_error(err);
+					failed = 1;
+				}
+			}
+			url_reader_close(reader);
+		}
+		cli_cleanup(bcdl);
+		if (failed)
+			return 1;
+	}
+	else if (mode == MODE_DUMP) /* -j, --dump */
+	{
+		/* stdout carries nothing but records, like -i a list may be piped in */
+		const char *source = argv[2];
+		if (!source && !isatty(STDIN_FILENO))
+			source = "-";
+		if (!source)
+		{
+			program_identification(NORMAL);
+			program_usage(VERBOSE);
+			return 1;
+		}
+		return dump_run(source);
+	}
 	else /* MODE_NORMAL */
 	{
 		if (strlen(argv[1]) < 6) /* still invalid */
@@ -101,10 +183,14 @@ int main(int argc, char **argv)
 		}
 		program_identification(NORMAL);
 		progress_indicator("Job", 1, 1, argv[1]);
-		if (URL_is_valid(argv[1]))
-			download_album_at_URL(argv[1]);
-		else
-			program_error(ERROR_INVALID_URL);
+		bcdl_t *bcdl = cli_init();
+		ferror_t err = download_URL(bcdl, argv[1], NULL);
+		cli_cleanup(bcdl);
+		if (err != EVERYTHING_IS_FINE)
+		{
+			program_error(err);
+			return 1;
+		}
 	}
 
 	end: return 0;
@@ -0,0 +1,1204 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <curl/curl.h> /* libcurl */
+
+#include "bcdl.h"
+#include "membuf.h"
+#include "bufpool.h"
+#include "transfer.h"
+#include "pool.h"
+#include "disk.h"
+#include "archive.h"
+#include "parse.h"
+#include "hash.h"
+#include "manifest.h"
+#include "mpeg.h"
+#include "tag.h"
+#include "arena.h"
+#include "interface.h"
+
+/*
+ *	bcdl.c
+ *	This file is part of bc-dl.
+ *	See bc-dl.c for copyright or LICENSE for license information.
+ */
+
+/* ALBUM STATE MACHINE
+ * FETCH_PAGE -> PLAN -> PARSED -> WAIT_SPACE -> FETCH_ART -> FETCH_TRACKS -> DONE
+ * WAIT_SPACE is skipped if the album fits, see PLANNING in bcdl.h
+ * albums opened with BCDL_RETAG retag their tracks in place of FETCH_TRACKS,
+ * and make no plan, neither do those opened with BCDL_NO_PLAN
+ * every state change happens in a transfer completion callback,
+ * which runs from inside bcdl_perform()
+ * any error cancels transfers in flight and moves album to FAILED
+ *
+ * verified tracks are tagged and written out on worker threads, which
+ * see nothing but the track's buffer and album details that no longer
+ * change, and are handed back to bcdl_perform() once on disk
+ * art is written out the same way, the album isn't done until it's in
+ * with archives enabled, both go into the album's archive instead
+ *
+ * an album's paths are composed in the context's path builder and kept
+ * in the album's arena, transfers borrow them rather than taking copies
+ * the arena goes back to the context when the album is closed, so the
+ * next album's paths take no allocations
+ */
+
+struct _bcdl {
+	engine_t *engine;
+	pool_t *writers; /* NULL if no thread could be started, tracks are written in place */
+	bcdl_album_t *albums; /* every open album */
+	unsigned unfinished;
+	manifest_t *manifest; /* NULL unless enabled */
+	int link;
+	size_t split; /* see bcdl_set_split() */
+	int archive_format; /* BCDL_ARCHIVE_* */
+	archive_t *archive; /* every album streamed into one, see bcdl_set_archive() */
+	path_t path; /* scratch, bcdl_perform() thread only */
+	arena_t spare_names; /* arena of a closed album, for the next one */
+	int space_freed; /* an album is over, ones waiting for space may fit now */
+	double busy; /* seconds albums were downloading, see bcdl_throughput() */
+	double busy_bytes; /* received in that time */
+	double last_perform; /* seconds */
+};
+
+struct _bcdl_album {
+	bcdl_t *owner;
+	char *url;
+	int flags;
+	bcdl_state_t state;
+	ferror_t error;
+	album_t *album;
+	arena_t names; /* everything below, see ALBUM STATE MACHINE */
+	char *folder;
+	char **filenames; /* folder + track filename */
+	char *art_filename;
+	char *on_disk; /* each track, as of naming or since written, never if archiving or retagging */
+	int art_on_disk;
+	membuf_t *art;
+	int art_writing; /* art is with a writer thread */
+	archive_t *archive; /* NULL unless archiving, the album's own or the context's */
+	transfer_t *page; /* NULL unless in flight */
+	size_t page_scanned; /* see album_page_complete() */
+	int page_complete; /* stopped early, the rest of the page isn't needed */
+	transfer_t **probes; /* HEAD requests of each track, then art, NULL once done */
+	unsigned probing;
+	size_t *sizes; /* of each track, 0 if unknown */
+	size_t art_size;
+	unsigned *order; /* tracks largest first */
+	transfer_t *art_transfer;
+	transfer_t **tracks;
+	group_t group; /* bandwidth and host slots shared fairly with other albums */
+	mpeg_t *streams; /* frame walker for each track in flight */
+	unsigned *attempts;
+	unsigned next_track;
+	unsigned tracks_done;
+	unsigned in_flight;
+	size_t bytes;
+	bcdl_callbacks_t callbacks;
+	void *userdata;
+	bcdl_album_t *prev, *next;
+};
+
+/* track or art handed to a writer thread */
+struct _bcdl_write {
+	pool_job_t job; /* first, see pool.h */
+	bcdl_album_t *album;
+	int art; /* file is the album's art, not owned */
+	unsigned track;
+	membuf_t *file;
+	unsigned long length_ms;
+	hash64_t digest;
+	char *copy; /* earlier copy of the same audio to link to, NULL for none */
+	ferror_t err;
+};
+
+void album_track_done(transfer_t *, void *);
+
+void album_free_write(struct _bcdl_write *w)
+{
+	if (!w->art)
+		membuf_free(w->file);
+	free(w->copy);
+	free(w);
+}
+
+ferror_t album_close_archive(bcdl_album_t *a, int discard)
+{
+	/* an album's own archive is finished, or dropped if discard is set
+	 * one shared with other albums stays open
+	 */
+	archive_t *archive = a->archive;
+	a->archive = NULL;
+	if (!archive || archive == a->owner->archive)
+		return EVERYTHING_IS_FINE;
+	return archive_close(archive, discard);
+}
+
+void album_cancel(bcdl_album_t *a)
+{
+	/* drop every transfer still in flight */
+	engine_t *engine = a->owner->engine;
+	if (a->page)
+	{
+		engine_remove(engine, a->page);
+		transfer_free(a->page);
+		a->page = NULL;
+	}
+	if (a->art_transfer)
+	{
+		engine_remove(engine, a->art_transfer);
+		transfer_free(a->art_transfer);
+		a->art_transfer = NULL;
+	}
+	unsigned i;
+	for (i = 0; a->probes && i <= a->album->track_count; i++)
+	{
+		if (a->probes[i])
+		{
+			engine_remove(engine, a->probes[i]);
+			transfer_free(a->probes[i]);
+			a->probes[i] = NULL;
+		}
+	}
+	a->probing = 0;
+	for (i = 0; a->tracks && i < a->album->track_count; i++)
+	{
+		if (a->tracks[i])
+		{
+			engine_remove(engine, a->tracks[i]);
+			transfer_free(a->tracks[i]);
+			a->tracks[i] = NULL;
+		}
+	}
+	a->in_flight = 0;
+	pool_job_t *job = a->owner->writers ? pool_cancel(a->owner->writers, a) : NULL;
+	while (job) /* waits for tracks being written right now */
+	{
+		struct _bcdl_write *w = (struct _bcdl_write *) job;
+		job = job->next;
+		album_free_write(w);
+	}
+	a->art_writing = 0;
+}
+
+void album_finish(bcdl_album_t *a, ferror_t err)
+{
+	album_cancel(a);
+	ferror_t closed = album_close_archive(a, err != EVERYTHING_IS_FINE);
+	if (err == EVERYTHING_IS_FINE)
+		err = closed;
+	a->state = (err == EVERYTHING_IS_FINE) ? BCDL_DONE : BCDL_FAILED;
+	a->error = err;
+	a->owner->unfinished--;
+	a->owner->space_freed = 1;
+	if (a->callbacks.complete)
+		a->callbacks.complete(a, err, a->userdata);
+}
+
+int album_data(transfer_t *t, const char *data, size_t len, void *userdata)
+{
+	bcdl_album_t *a = (bcdl_album_t *) userdata;
+	a->bytes += len;
+	if (a->state >= BCDL_FETCH_ART)
+		a->owner->busy_bytes += len;
+	if (a->callbacks.progress)
+		a->callbacks.progress(a, a->bytes, a->userdata);
+	return 1;
+}
+
+transfer_t *album_transfer(bcdl_album_t *a, const char *url, char *filename, int borrowed,
+                           int compressed, transfer_cb on_done)
+{
+	/* only text is worth compressing, audio and art already are
+	 * borrowed filenames are the album's and aren't freed with the transfer
+	 */
+	transfer_t *t = transfer_init(url, filename);
+	t->membuf->borrowed = borrowed;
+	t->compressed = compressed;
+	t->on_data = album_data;
+	t->on_done = on_done;
+	t->userdata = (void *) a;
+	t->group = &a->group;
+	engine_add(a->owner->engine, t);
+	return t;
+}
+
+int album_track_data(transfer_t *t, const char *data, size_t len, void *userdata)
+{
+	/* MP3 stream is checked as it arrives, anything else is cut off early
+	 * a track fetched in ranges, or by a duplicate request, is checked once done
+	 */
+	bcdl_album_t *a = (bcdl_album_t *) userdata;
+	unsigned i;
+	if (t->unordered)
+		return album_data(t, data, len, userdata);
+	for (i = 0; a->tracks[i] != t; i++);
+	if (mpeg_feed(&a->streams[i], data, len) != MPEG_OK)
+		return 0;
+	return album_data(t, data, len, userdata);
+}
+
+int album_page_data(transfer_t *t, const char *data, size_t len, void *userdata)
+{
+	/* page is cut off as soon as the album details are in */
+	bcdl_album_t *a = (bcdl_album_t *) userdata;
+	album_data(t, data, len, userdata);
+	if (album_page_complete(t->membuf, &a->page_scanned))
+	{
+		a->page_complete = 1;
+		return 0;
+	}
+	return 1;
+}
+
+void album_start_track(bcdl_album_t *a, unsigned i)
+{
+	mpeg_init(&a->streams[i]);
+	a->tracks[i] = album_transfer(a, a->album->stream_urls[i],
+	                              a->filenames[i], 1, 0, album_track_done);
+	a->tracks[i]->on_data = album_track_data;
+	a->tracks[i]->split = a->owner->split;
+	a->in_flight++;
+}
+
+void album_next_tracks(bcdl_album_t *a)
+{
+	/* keep up to BCDL_TRACKS_IN_FLIGHT tracks downloading, largest first
+	 * fewer while memory budget is exhausted
+	 * tracks already on disk are skipped, unless archiving
+	 */
+	while (a->in_flight < BCDL_TRACKS_IN_FLIGHT && a->next_track < a->album->track_count)
+	{
+		if (a->in_flight && !membuf_budget_headroom(MEMBUF_BUDGET.spill_threshold))
+			break; /* out of memory budget, wait for a track to finish */
+		unsigned i = a->order[a->next_track++];
+		if (a->on_disk[i])
+		{
+			a->tracks_done++;
+			if (a->callbacks.track)
+				a->callbacks.track(a, i, 1, a->userdata);
+			continue;
+		}
+		album_start_track(a, i);
+	}
+	if (a->tracks_done == a->album->track_count && !a->art_writing)
+		album_finish(a, EVERYTHING_IS_FINE);
+}
+
+int album_link_track(struct _bcdl_write *w)
+{
+	/* on a writer thread, link track to a copy of the same audio
+	 * a reflinked copy gets its own tag, written over the shared one in place
+	 * a hard link shares the copy's tag, so it's only made if the track's
+	 * own tag, already in w->file's header, would be the same bytes
+	 * returns 0 on success
+	 */
+	bcdl_album_t *a = w->album;
+	const char *filename = a->filenames[w->track];
+	if (a->owner->link == BCDL_LINK_HARD)
+	{
+		membuf_t *header = w->file->header;
+		size_t audio = w->file->size - w->file->offset;
+		if (!header || !file_begins_with(w->copy, header->memory, header->size, header->size + audio))
+			return -1;
+		return link_file(w->copy, filename, 0);
+	}
+	if (link_file(w->copy, filename, 1))
+		return -1;
+	if (id3_retag_file(filename, a->art, a->album, w->track) != EVERYTHING_IS_FINE)
+	{
+		remove(filename);
+		return -1;
+	}
+	return 0;
+}
+
+ferror_t album_commit_file(bcdl_album_t *a, membuf_t *file)
+{
+	/* to its own file, or into the album's archive under the same path */
+	if (!a->archive)
+		return membuf_commit_to_disk(file);
+	return archive_add(a->archive, file->filename,
+	                   file->header ? file->header->memory : NULL,
+	                   file->header ? file->header->size : 0,
+	                   file->memory + file->offset, file->size - file->offset);
+}
+
+void album_write_track(pool_job_t *job)
+{
+	/* on a writer thread, tracks are linked to an earlier copy if they
+	 * can be, written out in full otherwise
+	 */
+	struct _bcdl_write *w = (struct _bcdl_write *) job;
+	w->err = EVERYTHING_IS_FINE;
+	if (w->copy && w->album->owner->link == BCDL_LINK_REFLINK && !album_link_track(w))
+		return;
+	if (!w->art)
+		w->err = write_id3_tags(w->file, w->album->art, w->album->album, w->track, w->length_ms);
+	if (w->err == EVERYTHING_IS_FINE && w->copy && w->album->owner->link == BCDL_LINK_HARD &&
+	    !album_link_track(w))
+		return;
+	if (w->err == EVERYTHING_IS_FINE)
+		w->err = album_commit_file(w->album, w->file);
+}
+
+void album_track_written(bcdl_album_t *a, unsigned i, hash64_t digest, ferror_t err)
+{
+	/* track is on disk, or failed to be written */
+	manifest_t *manifest = a->owner->manifest;
+	if (err == EVERYTHING_IS_FINE && manifest)
+		manifest_record(manifest, digest, a->filenames[i]);
+	if (err != EVERYTHING_IS_FINE)
+	{
+		album_finish(a, err);
+		return;
+	}
+	a->on_disk[i] = !a->archive;
+	a->tracks_done++;
+	if (a->callbacks.track)
+		a->callbacks.track(a, i, 0, a->userdata);
+	album_next_tracks(a);
+}
+
+void album_art_written(bcdl_album_t *a, ferror_t err)
+{
+	a->art_writing = 0;
+	if (err != EVERYTHING_IS_FINE)
+	{
+		album_finish(a, err);
+		return;
+	}
+	a->art_on_disk = !a->archive;
+	album_next_tracks(a); /* may have been waiting on art to finish */
+}
+
+void album_write_done(struct _bcdl_write *w)
+{
+	/* back from a writer, frees w */
+	bcdl_album_t *a = w->album;
+	if (a->state < BCDL_DONE) /* may have failed since */
+	{
+		if (w->art)
+			album_art_written(a, w->err);
+		else
+			album_track_written(a, w->track, w->digest, w->err);
+	}
+	album_free_write(w);
+}
+
+void album_write(bcdl_album_t *a, struct _bcdl_write *w)
+{
+	/* hand w to a writer, or write it right here if there are none */
+	w->job.run = album_write_track;
+	w->job.owner = (void *) a;
+	w->album = a;
+	if (a->owner->writers)
+	{
+		pool_submit(a->owner->writers, &w->job);
+		return;
+	}
+	album_write_track(&w->job);
+	album_write_done(w);
+}
+
+void album_commit_track(bcdl_album_t *a, unsigned i, membuf_t *file, mpeg_t *stream)
+{
+	/* tag and write out a verified track, takes ownership of file
+	 * audio already in the manifest is linked to instead, if enabled
+	 * and possible, see album_write_track()
+	 */
+	manifest_t *manifest = a->owner->manifest;
+	hash64_t digest = hash_digest(&stream->hash);
+	const char *copy = manifest ? manifest_lookup(manifest, digest) : NULL;
+	struct _bcdl_write *w = (struct _bcdl_write *) calloc(1, sizeof(struct _bcdl_write));
+	w->track = i;
+	w->file = file;
+	w->length_ms = mpeg_duration_ms(stream);
+	w->digest = digest;
+	if (copy && !a->archive && a->owner->link != BCDL_LINK_NONE && strcmp(copy, a->filenames[i]))
+		w->copy = create_string(copy); /* manifest may change while w is with a writer */
+	album_write(a, w);
+}
+
+void album_track_done(transfer_t *t, void *userdata)
+{
+	bcdl_album_t *a = (bcdl_album_t *) userdata;
+	unsigned i;
+	for (i = 0; a->tracks[i] != t; i++);
+	a->tracks[i] = NULL;
+	a->in_flight--;
+	ferror_t err = transfer_error(t);
+	mpeg_t *stream = &a->streams[i];
+	if (t->unordered && err == EVERYTHING_IS_FINE)
+	{
+		mpeg_init(stream);
+		mpeg_feed(stream, t->membuf->memory, t->membuf->size);
+	}
+	if (stream->status != MPEG_OK || (err == EVERYTHING_IS_FINE && mpeg_finish(stream) != MPEG_OK))
+		err = ERROR_STREAM;
+	if ((err == ERROR_STREAM || err == ERROR_CONNECTION) && a->attempts[i]++ < BCDL_TRACK_RETRIES)
+	{
+		transfer_free(t);
+		album_start_track(a, i); /* try again from scratch */
+		return;
+	}
+	membuf_t *file = t->membuf;
+	t->membuf = NULL;
+	transfer_free(t);
+	if (err != EVERYTHING_IS_FINE)
+	{
+		membuf_free(file);
+		album_finish(a, err);
+		return;
+	}
+	album_commit_track(a, i, file, stream);
+}
+
+const char *album_find_track(bcdl_album_t *a, unsigned track)
+{
+	/* path of a track already on disk, NULL if there isn't one
+	 * a track renamed since it was downloaded is found by its number,
+	 * its path is left in the context's path builder
+	 */
+	if (file_exists(a->filenames[track]))
+		return a->filenames[track];
+	path_t *path = &a->owner->path;
+	path_reset(path);
+	if (path_add(path, a->folder))
+		return NULL;
+	DIR *dir = opendir(a->folder);
+	if (!dir)
+		return NULL;
+	char prefix[16];
+	sprintf(prefix, "%02u. ", track+1);
+	size_t prefix_len = strlen(prefix);
+	size_t type_len = strlen(a->album->filetype);
+	const char *found = NULL;
+	struct dirent *entry;
+	while (!found && (entry = readdir(dir)))
+	{
+		size_t len = strlen(entry->d_name);
+		if (len > prefix_len + type_len && !strncmp(entry->d_name, prefix, prefix_len) &&
+		    entry->d_name[len - type_len - 1] == '.' &&
+		    !strcmp(entry->d_name + len - type_len, a->album->filetype) &&
+		    !path_add(path, entry->d_name))
+			found = path->buf;
+	}
+	closedir(dir);
+	return found;
+}
+
+void album_retag(bcdl_album_t *a)
+{
+	/* retag every track on disk, renaming any whose title changed
+	 * only the tag region of each file is rewritten where possible
+	 */
+	a->state = BCDL_FETCH_TRACKS;
+	unsigned i;
+	for (i = 0; i < a->album->track_count; i++)
+	{
+		const char *path = album_find_track(a, i);
+		if (!path)
+		{
+			if (a->callbacks.track)
+				a->callbacks.track(a, i, 1, a->userdata);
+			continue;
+		}
+		ferror_t err = id3_retag_file(path, a->art, a->album, i);
+		if (err == EVERYTHING_IS_FINE && strcmp(path, a->filenames[i]) &&
+		    rename(path, a->filenames[i]))
+			err = ERROR_FILE_IO;
+		if (err != EVERYTHING_IS_FINE)
+		{
+			album_finish(a, err);
+			return;
+		}
+		a->tracks_done++;
+		if (a->callbacks.track)
+			a->callbacks.track(a, i, 0, a->userdata);
+	}
+	album_finish(a, EVERYTHING_IS_FINE);
+}
+
+void album_art_done(transfer_t *t, void *userdata)
+{
+	/* art is kept in memory for the APIC frame of every track */
+	bcdl_album_t *a = (bcdl_album_t *) userdata;
+	a->art_transfer = NULL;
+	ferror_t err = transfer_error(t);
+	if (err == EVERYTHING_IS_FINE)
+	{
+		a->art = t->membuf;
+		t->membuf = NULL;
+		if ((a->flags & BCDL_RETAG) && !file_exists(a->art->filename))
+			err = membuf_commit_to_disk(a->art);
+	}
+	transfer_free(t);
+	if (err != EVERYTHING_IS_FINE)
+	{
+		album_finish(a, err);
+		return;
+	}
+	if (a->flags & BCDL_RETAG)
+	{
+		album_retag(a);
+		return;
+	}
+	a->state = BCDL_FETCH_TRACKS;
+	if (a->art_on_disk)
+	{
+		album_next_tracks(a);
+		return;
+	}
+	/* tracks start while art is written out */
+	a->art_writing = 1;
+	album_next_tracks(a);
+	struct _bcdl_write *w = (struct _bcdl_write *) calloc(1, sizeof(struct _bcdl_write));
+	w->art = 1;
+	w->file = a->art;
+	album_write(a, w);
+}
+
+/* PLANNING, see bcdl.h */
+
+void album_parsed(bcdl_album_t *a)
+{
+	a->state = BCDL_PARSED;
+	if (a->callbacks.parsed)
+		a->callbacks.parsed(a, a->userdata);
+	if (!(a->flags & BCDL_DEFER))
+		bcdl_album_start(a);
+}
+
+void album_probe_done(transfer_t *t, void *userdata)
+{
+	/* a size is in, tracks are put in order once every size is
+	 * a size that can't be had is left unknown, the track is still fetched
+	 */
+	bcdl_album_t *a = (bcdl_album_t *) userdata;
+	unsigned count = a->album->track_count;
+	unsigned i, j;
+	for (i = 0; a->probes[i] != t; i++);
+	a->probes[i] = NULL;
+	size_t size = 0;
+	if (transfer_error(t) == EVERYTHING_IS_FINE && t->content_length > 0)
+		size = (size_t) t->content_length;
+	if (i < count)
+		a->sizes[i] = size;
+	else
+		a->art_size = size;
+	transfer_free(t);
+	if (--a->probing)
+		return;
+	for (i = 1; i < count; i++) /* stable, unknown sizes last */
+	{
+		unsigned track = a->order[i];
+		for (j = i; j > 0 && a->sizes[a->order[j - 1]] < a->sizes[track]; j--)
+			a->order[j] = a->order[j - 1];
+		a->order[j] = track;
+	}
+	album_parsed(a);
+}
+
+void album_plan(bcdl_album_t *a)
+{
+	/* HEAD request for every track and the art at once */
+	unsigned count = a->album->track_count;
+	unsigned i;
+	a->state = BCDL_PLAN;
+	a->probes = (transfer_t **) calloc(count + 1, sizeof(transfer_t *));
+	a->probing = count + 1;
+	for (i = 0; i <= count; i++)
+	{
+		transfer_t *t = transfer_init((i < count) ? a->album->stream_urls[i] : a->album->url_album_art, NULL);
+		t->head_only = 1;
+		t->on_done = album_probe_done;
+		t->userdata = (void *) a;
+		t->group = &a->group;
+		a->probes[i] = t;
+		engine_add(a->owner->engine, t);
+	}
+}
+
+size_t album_estimate(bcdl_album_t *a, unsigned *unknown)
+{
+	/* bytes still to be written, tags included, tracks of unknown size
+	 * are counted at the average of the rest, every file in whole blocks
+	 * tracks and art already on disk are left out, unless archiving
+	 * nothing is stat'ed, see album_name_files()
+	 */
+	size_t tag = a->art_size + BCDL_TAG_ESTIMATE + BCDL_BLOCK_ESTIMATE;
+	size_t total = 0;
+	unsigned known = 0, missing = 0;
+	unsigned i;
+	for (i = 0; i < a->album->track_count; i++)
+	{
+		if (a->on_disk[i])
+			continue;
+		if (!a->sizes[i])
+			missing++;
+		else
+		{
+			total += a->sizes[i] + tag;
+			known++;
+		}
+	}
+	if (known)
+		total += missing * (total / known);
+	if (!a->art_on_disk)
+		total += a->art_size + BCDL_BLOCK_ESTIMATE;
+	*unknown = missing;
+	return total;
+}
+
+int album_admit(bcdl_album_t *a)
+{
+	/* nonzero if a has to wait for free space, or failed for the lack of it
+	 * nothing is checked if every album goes into one archive, which may
+	 * be anywhere
+	 */
+	bcdl_t *bcdl = a->owner;
+	unsigned unknown;
+	unsigned long long free_space;
+	unsigned long long needed = album_estimate(a, &unknown);
+	if (bcdl->archive || !needed || disk_free(".", &free_space))
+		return 0;
+	int others = 0;
+	bcdl_album_t *b;
+	for (b = bcdl->albums; b; b = b->next)
+	{
+		if (b == a || b->state < BCDL_FETCH_ART || b->state >= BCDL_DONE)
+			continue;
+		others = 1;
+		needed += album_estimate(b, &unknown); /* tracks in memory count as unwritten */
+	}
+	if (free_space >= needed)
+		return 0;
+	if (others) /* retried as albums finish */
+	{
+		a->state = BCDL_WAIT_SPACE;
+		return -1;
+	}
+	album_finish(a, ERROR_DISK_SPACE);
+	return -1;
+}
+
+int album_name_files(bcdl_album_t *a)
+{
+	/* output paths, nonzero if any is too long to be opened
+	 * which of them are on disk already is looked up once, here
+	 */
+	path_t *path = &a->owner->path;
+	path_reset(path);
+	if (path_add_folder(path, a->album))
+		return -1;
+	size_t folder_len = path->len;
+	a->names = a->owner->spare_names;
+	arena_init(&a->owner->spare_names);
+	char *folder = arena_strdup(&a->names, path->buf);
+	char **filenames = (char **) arena_alloc(&a->names, sizeof(char *) * a->album->track_count);
+	char *on_disk = (char *) arena_alloc(&a->names, a->album->track_count);
+	if (!folder || !filenames || !on_disk)
+		return -1;
+	int look = (a->owner->archive_format == BCDL_ARCHIVE_NONE && !(a->flags & BCDL_RETAG));
+	unsigned i;
+	for (i = 0; i < a->album->track_count; i++)
+	{
+		path_truncate(path, folder_len);
+		if (path_add_track(path, a->album, i) ||
+		    !(filenames[i] = arena_strdup(&a->names, path->buf)))
+			return -1;
+		on_disk[i] = look && file_exists(filenames[i]);
+	}
+	path_truncate(path, folder_len);
+	if (path_add(path, "album.jpg") ||
+	    !(a->art_filename = arena_strdup(&a->names, path->buf)))
+		return -1;
+	a->art_on_disk = look && file_exists(a->art_filename);
+	a->on_disk = on_disk;
+	a->folder = folder;
+	a->filenames = filenames;
+	return 0;
+}
+
+void album_page_done(transfer_t *t, void *userdata)
+{
+	bcdl_album_t *a = (bcdl_album_t *) userdata;
+	a->page = NULL;
+	ferror_t err = a->page_complete ? EVERYTHING_IS_FINE : transfer_error(t);
+	if (err == EVERYTHING_IS_FINE)
+		a->album = parse_album_data(t->membuf);
+	transfer_free(t);
+	if (err == EVERYTHING_IS_FINE && !a->album)
+		err = ERROR_JSON;
+	if (err != EVERYTHING_IS_FINE)
+	{
+		album_finish(a, err);
+		return;
+	}
+
+	if (album_name_files(a))
+	{
+		album_finish(a, ERROR_FILE_IO);
+		return;
+	}
+	a->tracks = (transfer_t **) calloc(a->album->track_count, sizeof(transfer_t *));
+	a->streams = (mpeg_t *) malloc(sizeof(mpeg_t) * a->album->track_count);
+	a->attempts = (unsigned *) calloc(a->album->track_count, sizeof(unsigned));
+	a->sizes = (size_t *) calloc(a->album->track_count, sizeof(size_t));
+	a->order = (unsigned *) malloc(sizeof(unsigned) * a->album->track_count);
+	unsigned i;
+	for (i = 0; i < a->album->track_count; i++)
+		a->order[i] = i;
+	if (a->flags & (BCDL_RETAG | BCDL_NO_PLAN))
+		album_parsed(a);
+	else
+		album_plan(a);
+}
+
+/* CONTEXT */
+
+void bcdl_wake(void *userdata)
+{
+	/* a writer finished a track, have bcdl_perform() pick it up */
+	engine_wakeup(((bcdl_t *) userdata)->engine);
+}
+
+bcdl_t *bcdl_init(void)
+{
+	bcdl_t *bcdl = (bcdl_t *) malloc(sizeof(bcdl_t));
+	bcdl->engine = engine_init();
+	bcdl->writers = pool_init(BCDL_WRITERS, bcdl_wake, (void *) bcdl);
+	bcdl->albums = NULL;
+	bcdl->unfinished = 0;
+	bcdl->manifest = NULL;
+	bcdl->link = BCDL_LINK_NONE;
+	bcdl->split = BCDL_DEFAULT_SPLIT;
+	bcdl->archive_format = BCDL_ARCHIVE_NONE;
+	bcdl->archive = NULL;
+	bcdl->space_freed = 0;
+	bcdl->busy = bcdl->busy_bytes = 0;
+	bcdl->last_perform = transfer_clock();
+	path_reset(&bcdl->path);
+	arena_init(&bcdl->spare_names);
+	return bcdl;
+}
+
+unsigned bcdl_perform(bcdl_t *bcdl)
+{
+	/* returns number of albums not yet done or failed */
+	double now = transfer_clock();
+	bcdl_album_t *a;
+	for (a = bcdl->albums; a; a = a->next)
+	{
+		if (a->state == BCDL_FETCH_ART || a->state == BCDL_FETCH_TRACKS)
+		{
+			bcdl->busy += now - bcdl->last_perform;
+			break;
+		}
+	}
+	bcdl->last_perform = now;
+	engine_perform(bcdl->engine);
+	pool_job_t *job = bcdl->writers ? pool_reap(bcdl->writers) : NULL;
+	while (job)
+	{
+		struct _bcdl_write *w = (struct _bcdl_write *) job;
+		job = job->next;
+		album_write_done(w);
+	}
+	if (bcdl->space_freed)
+	{
+		bcdl->space_freed = 0;
+		for (a = bcdl->albums; a; a = a->next)
+		{
+			if (a->state == BCDL_WAIT_SPACE)
+				bcdl_album_start(a);
+		}
+	}
+	return bcdl->unfinished;
+}
+
+size_t bcdl_throughput(bcdl_t *bcdl)
+{
+	/* bytes per second received while albums were downloading, 0 until
+	 * there's a second's worth to go on
+	 */
+	if (bcdl->busy < 1.0)
+		return 0;
+	return (size_t) (bcdl->busy_bytes / bcdl->busy);
+}
+
+void bcdl_wait(bcdl_t *bcdl, int timeout_ms)
+{
+	engine_wait(bcdl->engine, timeout_ms);
+}
+
+int bcdl_fdset(bcdl_t *bcdl, fd_set *read_fds, fd_set *write_fds, fd_set *exc_fds, int *max_fd)
+{
+	return engine_fdset(bcdl->engine, read_fds, write_fds, exc_fds, max_fd);
+}
+
+long bcdl_timeout(bcdl_t *bcdl)
+{
+	return engine_timeout(bcdl->engine);
+}
+
+membuf_t *bcdl_fetch_page(bcdl_t *bcdl, const char *url, ferror_t *err)
+{
+	/* blocking download of a page that isn't an album's, such as an
+	 * artist's discography, on the context's engine like everything else
+	 * albums in flight carry on meanwhile, NULL and err set on failure
+	 */
+	transfer_t *t = transfer_init(url, create_string("page.html"));
+	t->compressed = 1;
+	engine_add(bcdl->engine, t);
+	while (!t->done)
+	{
+		bcdl_perform(bcdl);
+		if (!t->done)
+			bcdl_wait(bcdl, 1000);
+	}
+	*err = transfer_error(t);
+	membuf_t *membuf = NULL;
+	if (*err == EVERYTHING_IS_FINE)
+	{
+		membuf = t->membuf;
+		t->membuf = NULL; /* caller owns it now */
+	}
+	transfer_free(t);
+	return membuf;
+}
+
+void bcdl_cleanup(bcdl_t *bcdl)
+{
+	while (bcdl->albums)
+		bcdl_album_close(bcdl->albums);
+	if (bcdl->writers)
+		pool_cleanup(bcdl->writers);
+	if (bcdl->archive)
+		archive_close(bcdl->archive, 0);
+	engine_cleanup(bcdl->engine);
+	if (bcdl->manifest)
+		manifest_close(bcdl->manifest);
+	arena_free(&bcdl->spare_names);
+	free(bcdl);
+}
+
+void bcdl_set_memory_budget(size_t limit, size_t spill_threshold)
+{
+	/* applies to every context in the process */
+	membuf_set_budget(limit, spill_threshold);
+}
+
+void bcdl_set_buffer_pool(size_t idle_limit, int hugepages)
+{
+	/* bytes of freed buffers kept for reuse, 0 for none, set before
+	 * downloading, huge pages back buffers of 2M and up if nonzero
+	 */
+	bufpool_set(idle_limit, hugepages);
+}
+
+void bcdl_stats(bcdl_stats_t *stats)
+{
+	struct _bufpool pool;
+	struct _membuf_budget budget;
+	bufpool_stats(&pool);
+	membuf_budget_stats(&budget);
+	stats->memory_peak = budget.peak;
+	stats->spills = budget.spills;
+	stats->pool_hits = pool.hits;
+	stats->pool_misses = pool.misses;
+	stats->pool_drops = pool.drops;
+	stats->pool_idle = pool.idle;
+}
+
+void bcdl_set_bandwidth(size_t rate, size_t album_rate)
+{
+	/* bytes per second for every context in the process together, and
+	 * for any one album, 0 for unlimited
+	 * the total is split evenly between albums downloading at the time
+	 * may be called at any time, takes effect within a second
+	 */
+	transfer_set_bandwidth(rate, album_rate);
+}
+
+void bcdl_scale_bandwidth(int halvings)
+{
+	/* halve the total rate this many times, double it for negative,
+	 * whichever of the rate or a schedule window is in effect, now or later
+	 * an unlimited rate stays unlimited, bcdl_set_bandwidth() starts over
+	 */
+	transfer_scale_bandwidth(halvings);
+}
+
+size_t bcdl_bandwidth(void)
+{
+	/* total rate limit in effect right now, 0 for unlimited */
+	return transfer_rate();
+}
+
+int bcdl_set_schedule(const char *schedule)
+{
+	/* time of day overrides for the total rate, local time
+	 * "HH:MM-HH:MM=RATE[,...]", first window that matches wins,
+	 * "" clears them, returns nonzero on a malformed schedule
+	 */
+	return transfer_set_schedule(schedule);
+}
+
+void bcdl_set_max_jobs(bcdl_t *bcdl, unsigned jobs)
+{
+	/* ceiling for concurrent transfers to any one host
+	 * the number actually in flight is tuned to observed throughput
+	 */
+	engine_set_max_host(bcdl->engine, jobs);
+}
+
+void bcdl_set_split(bcdl_t *bcdl, size_t split)
+{
+	/* tracks larger than split are fetched over several connections at
+	 * once, in byte ranges, 0 fetches every track in one request
+	 * servers that don't honour ranges get one request anyway
+	 */
+	bcdl->split = split;
+}
+
+int bcdl_set_io(int io)
+{
+	/* BCDL_IO_*, for every context in the process, set before downloading
+	 * every file is written beside its final name, synced and renamed
+	 * into place, with io_uring this is two system calls per file
+	 * returns nonzero if io_uring was asked for but isn't available,
+	 * pwrite is used instead
+	 */
+	return disk_set_backend((disk_backend_t) io);
+}
+
+int bcdl_set_archive(bcdl_t *bcdl, int format, int fd)
+{
+	/* BCDL_ARCHIVE_TAR or BCDL_ARCHIVE_ZIP writes each album to FOLDER.tar
+	 * or FOLDER.zip in place of its folder, dropped if the album fails
+	 * with fd other than -1, every album goes into one archive streamed
+	 * down fd instead, which is left open, members of an album that fails
+	 * stay in it
+	 * applies to albums started from now on, a previous stream is
+	 * finished here or by bcdl_cleanup(), so don't switch while albums
+	 * are in progress
+	 * returns nonzero if finishing the previous stream failed
+	 */
+	int err = 0;
+	if (bcdl->archive)
+		err = archive_close(bcdl->archive, 0) != EVERYTHING_IS_FINE;
+	bcdl->archive = NULL;
+	bcdl->archive_format = format;
+	if (format != BCDL_ARCHIVE_NONE && fd >= 0)
+		bcdl->archive = archive_stream(fd, (archive_format_t) format);
+	return err;
+}
+
+int bcdl_set_manifest(bcdl_t *bcdl, const char *filename, int link)
+{
+	/* hash the audio of every track written and log it to a manifest
+	 * tracks with audio already listed are linked to it if link is set
+	 * returns 0 on success, nonzero if manifest can't be opened
+	 */
+	if (bcdl->manifest)
+		manifest_close(bcdl->manifest);
+	bcdl->manifest = manifest_open(filename);
+	bcdl->link = link;
+	return bcdl->manifest ? 0 : -1;
+}
+
+/* ALBUM HANDLES */
+
+bcdl_album_t *bcdl_album_open(bcdl_t *bcdl, const char *url, int flags,
+                              const bcdl_callbacks_t *callbacks, void *userdata)
+{
+	/* album page is requested right away */
+	bcdl_album_t *a = (bcdl_album_t *) calloc(1, sizeof(bcdl_album_t));
+	a->owner = bcdl;
+	a->url = create_string(url);
+	a->flags = flags;
+	a->state = BCDL_FETCH_PAGE;
+	a->error = EVERYTHING_IS_FINE;
+	if (callbacks)
+		a->callbacks = *callbacks;
+	a->userdata = userdata;
+	a->next = bcdl->albums;
+	if (bcdl->albums)
+		bcdl->albums->prev = a;
+	bcdl->albums = a;
+	bcdl->unfinished++;
+	a->page = album_transfer(a, url, "album.html", 1, 1, album_page_done);
+	a->page->on_data = album_page_data;
+	return a;
+}
+
+void bcdl_album_start(bcdl_album_t *a)
+{
+	/* start art and track downloads, or as soon as parsing is done
+	 * album waits in BCDL_WAIT_SPACE, or fails, if it doesn't fit on disk
+	 * with BCDL_RETAG, retagging may finish before this returns
+	 */
+	a->flags &= ~BCDL_DEFER;
+	if (a->state != BCDL_PARSED && a->state != BCDL_WAIT_SPACE)
+		return;
+	if (!(a->flags & BCDL_RETAG) && album_admit(a))
+		return;
+	if (a->flags & BCDL_RETAG)
+	{
+		/* album has to be on disk already, art is reused if it's there */
+		DIR *dir = opendir(a->folder);
+		if (!dir)
+		{
+			album_finish(a, ERROR_FILE_IO);
+			return;
+		}
+		closedir(dir);
+		a->art = membuf_load(a->art_filename);
+		if (a->art)
+		{
+			album_retag(a);
+			return;
+		}
+	}
+	else if (a->owner->archive_format != BCDL_ARCHIVE_NONE)
+	{
+		/* nothing goes in the folder, it names the archive */
+		a->archive = a->owner->archive;
+		if (!a->archive)
+		{
+			size_t len = strlen(a->folder);
+			char *filename = (char *) malloc(len + 5);
+			strcpy(filename, a->folder);
+			if (len && filename[len - 1] == '/')
+				filename[len - 1] = '\0';
+			strcat(filename, archive_extension((archive_format_t) a->owner->archive_format));
+			a->archive = archive_open(filename, (archive_format_t) a->owner->archive_format);
+			free(filename);
+		}
+		if (!a->archive)
+		{
+			album_finish(a, ERROR_FILE_IO);
+			return;
+		}
+	}
+	else if (create_folder(a->folder))
+	{
+		album_finish(a, ERROR_FILE_IO);
+		return;
+	}
+	a->state = BCDL_FETCH_ART;
+	a->art_transfer = album_transfer(a, a->album->url_album_art,
+	                                 a->art_filename, 1, 0, album_art_done);
+	if (a->flags & BCDL_RETAG)
+		return;
+	/* connect to stream hosts while art downloads, so the first track
+	 * doesn't wait on DNS and handshakes, the engine skips warm hosts
+	 */
+	unsigned i;
+	for (i = 0; i < a->album->track_count; i++)
+		engine_prewarm(a->owner->engine, a->album->stream_urls[i]);
+}
+
+bcdl_state_t bcdl_album_state(bcdl_album_t *a)
+{
+	return a->state;
+}
+
+void bcdl_album_set_callbacks(bcdl_album_t *a, const bcdl_callbacks_t *callbacks, void *userdata)
+{
+	/* replaces callbacks given to bcdl_album_open(), NULL for none */
+	memset(&a->callbacks, 0, sizeof(a->callbacks));
+	if (callbacks)
+		a->callbacks = *callbacks;
+	a->userdata = userdata;
+}
+
+ferror_t bcdl_album_error(bcdl_album_t *a)
+{
+	return a->error;
+}
+
+const char *bcdl_album_url(bcdl_album_t *a)
+{
+	return a->url;
+}
+
+const char *bcdl_album_folder(bcdl_album_t *a)
+{
+	/* NULL until parsed */
+	return a->folder;
+}
+
+const char *bcdl_album_track_filename(bcdl_album_t *a, unsigned track)
+{
+	if (!a->filenames || track >= a->album->track_count)
+		return NULL;
+	return a->filenames[track];
+}
+
+size_t bcdl_album_track_size(bcdl_album_t *a, unsigned track)
+{
+	/* bytes of the track's audio as its server gave them, 0 if unknown */
+	if (!a->sizes || track >= a->album->track_count)
+		return 0;
+	return a->sizes[track];
+}
+
+size_t bcdl_album_size(bcdl_album_t *a, unsigned *unknown)
+{
+	/* estimated bytes still to be written once parsed, 0 before
+	 * unknown, if not NULL, is set to the number of tracks whose size
+	 * isn't known, which are counted at the average of the rest
+	 */
+	unsigned missing = 0;
+	size_t size = (a->state >= BCDL_PARSED && a->sizes) ? album_estimate(a, &missing) : 0;
+	if (unknown)
+		*unknown = missing;
+	return size;
+}
+
+album_t *bcdl_album_data(bcdl_album_t *a)
+{
+	/* NULL until parsed */
+	return a->album;
+}
+
+void bcdl_album_close(bcdl_album_t *a)
+{
+	/* cancels album if it's still in progress, no callbacks are run */
+	album_cancel(a);
+	album_close_archive(a, 1);
+	if (a->state < BCDL_DONE)
+		a->owner->unfinished--;
+	if (a->prev)
+		a->prev->next = a->next;
+	else
+		a->owner->albums = a->next;
+	if (a->next)
+		a->next->prev = a->prev;
+	free(a->tracks);
+	free(a->streams);
+	free(a->attempts);
+	free(a->probes);
+	free(a->sizes);
+	free(a->order);
+	if (a->art)
+		membuf_free(a->art);
+	if (a->owner->spare_names.chunks)
+		arena_free(&a->names);
+	else
+	{
+		arena_reset(&a->names);
+		a->owner->spare_names = a->names;
+	}
+	if (a->album)
+		free_album_data(a->album);
+	free(a->url);
+	free(a);
+}
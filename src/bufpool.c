@@ -0,0 +1,149 @@
+#define _DEFAULT_SOURCE /* MAP_ANONYMOUS, madvise */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <pthread.h>
+
+#include "bufpool.h"
+
+/*
+ *	bufpool.c
+ *	This file is part of bc-dl.
+ *	See bc-dl.c for copyright or LICENSE for license information.
+ */
+
+/* BUFFER POOL
+ * track-sized buffers come in power of two classes and go back to the
+ * pool when their membuf is freed, the next track of that class gets
+ * one whose pages are already faulted in instead of fresh ones
+ * the pool holds at most idle_limit bytes, anything past that is unmapped
+ * buffers are freed on writer threads, so the pool is locked
+ */
+
+pthread_mutex_t BUFPOOL_LOCK = PTHREAD_MUTEX_INITIALIZER;
+
+struct _bufpool BUFPOOL = {
+	.idle_limit = BUFPOOL_DEFAULT_IDLE,
+	.hugepages = 0,
+	.idle = 0,
+	.hits = 0,
+	.misses = 0,
+	.drops = 0
+};
+
+unsigned bufpool_class(size_t capacity)
+{
+	/* index of a class, capacity is one of bufpool_capacity()'s */
+	unsigned shift = BUFPOOL_MIN_SHIFT;
+	while (((size_t) 1 << shift) < capacity)
+		shift++;
+	return shift - BUFPOOL_MIN_SHIFT;
+}
+
+size_t bufpool_capacity(size_t size)
+{
+	/* smallest class holding size bytes, 0 if none does or pool is off */
+	size_t capacity = (size_t) 1 << BUFPOOL_MIN_SHIFT;
+	if (!BUFPOOL.idle_limit || size < capacity || size > ((size_t) 1 << BUFPOOL_MAX_SHIFT))
+		return 0;
+	while (capacity < size)
+		capacity <<= 1;
+	return capacity;
+}
+
+char *bufpool_map(size_t capacity)
+{
+	/* fresh buffer, huge page aligned if it's to be backed by them */
+	if (!BUFPOOL.hugepages || capacity < BUFPOOL_HUGE_PAGE)
+	{
+		void *map = mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		return (map == MAP_FAILED) ? NULL : (char *) map;
+	}
+	size_t len = capacity + BUFPOOL_HUGE_PAGE;
+	void *map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (map == MAP_FAILED)
+		return NULL;
+	char *start = (char *) map;
+	char *aligned = (char *) (((uintptr_t) start + BUFPOOL_HUGE_PAGE - 1) & ~(uintptr_t) (BUFPOOL_HUGE_PAGE - 1));
+	if (aligned > start)
+		munmap(start, aligned - start);
+	if (start + len > aligned + capacity)
+		munmap(aligned + capacity, start + len - (aligned + capacity));
+	#ifdef MADV_HUGEPAGE
+		madvise(aligned, capacity, MADV_HUGEPAGE); /* a hint, pages are small if it's refused */
+	#endif
+	return aligned;
+}
+
+char *bufpool_get(size_t capacity)
+{
+	/* buffer of a bufpool_capacity() class, NULL if out of memory */
+	unsigned i = bufpool_class(capacity);
+	pthread_mutex_lock(&BUFPOOL_LOCK);
+	struct _bufpool_idle *buf = BUFPOOL.classes[i];
+	if (buf)
+	{
+		BUFPOOL.classes[i] = buf->next;
+		BUFPOOL.idle -= capacity;
+		BUFPOOL.hits++;
+	}
+	else
+		BUFPOOL.misses++;
+	pthread_mutex_unlock(&BUFPOOL_LOCK);
+	return buf ? (char *) buf : bufpool_map(capacity);
+}
+
+void bufpool_put(char *memory, size_t capacity)
+{
+	/* buffer from bufpool_get() is done with */
+	struct _bufpool_idle *buf = (struct _bufpool_idle *) memory;
+	unsigned i = bufpool_class(capacity);
+	pthread_mutex_lock(&BUFPOOL_LOCK);
+	int keep = BUFPOOL.idle + capacity <= BUFPOOL.idle_limit;
+	if (keep)
+	{
+		buf->next = BUFPOOL.classes[i];
+		BUFPOOL.classes[i] = buf;
+		BUFPOOL.idle += capacity;
+	}
+	else
+		BUFPOOL.drops++;
+	pthread_mutex_unlock(&BUFPOOL_LOCK);
+	if (!keep)
+		munmap(memory, capacity);
+}
+
+void bufpool_set(size_t idle_limit, int hugepages)
+{
+	/* idle buffers past the new limit are unmapped, largest first
+	 * huge pages apply to buffers mapped from now on
+	 */
+	unsigned i = BUFPOOL_CLASSES;
+	pthread_mutex_lock(&BUFPOOL_LOCK);
+	BUFPOOL.idle_limit = idle_limit;
+	BUFPOOL.hugepages = hugepages;
+	while (BUFPOOL.idle > idle_limit && i--)
+	{
+		size_t capacity = (size_t) 1 << (BUFPOOL_MIN_SHIFT + i);
+		while (BUFPOOL.idle > idle_limit && BUFPOOL.classes[i])
+		{
+			struct _bufpool_idle *buf = BUFPOOL.classes[i];
+			BUFPOOL.classes[i] = buf->next;
+			BUFPOOL.idle -= capacity;
+			munmap(buf, capacity);
+		}
+	}
+	pthread_mutex_unlock(&BUFPOOL_LOCK);
+}
+
+void bufpool_stats(struct _bufpool *out)
+{
+	/* consistent copy of the counters, idle lists left out */
+	unsigned i;
+	pthread_mutex_lock(&BUFPOOL_LOCK);
+	*out = BUFPOOL;
+	pthread_mutex_unlock(&BUFPOOL_LOCK);
+	for (i = 0; i < BUFPOOL_CLASSES; i++)
+		out->classes[i] = NULL;
+}
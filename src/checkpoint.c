@@ -0,0 +1,208 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "checkpoint.h"
+
+/*
+ *	checkpoint.c
+ *	This file is part of bc-dl.
+ *	See bc-dl.c for copyright or LICENSE for license information.
+ */
+
+/* CHECKPOINT LOG FORMAT
+ * one record per line, appended as jobs progress, last record for a URL wins
+ * STATE <tab> URL <tab> FOLDER <newline>
+ *
+ * STARTED  album page was resolved, folder is known
+ * DONE     every track was written to folder
+ *
+ * a record cut short by a crash has no newline and is ignored on reload
+ */
+
+const char *CHECKPOINT_STATE[] = { "STARTED", "DONE" };
+
+unsigned long checkpoint_hash(const char *str)
+{
+	/* djb2 */
+	unsigned long hash = 5381;
+	while (*str)
+		hash = hash * 33 + (unsigned char) *str++;
+	return hash;
+}
+
+char *checkpoint_strdup(const char *str)
+{
+	char *out = (char *) malloc(sizeof(char) * (strlen(str) + 1));
+	strcpy(out, str);
+	return out;
+}
+
+struct _checkpoint_entry *checkpoint_lookup(checkpoint_t *cp, const char *url)
+{
+	struct _checkpoint_entry *entry = cp->buckets[checkpoint_hash(url) % cp->bucket_count];
+	while (entry && strcmp(entry->url, url))
+		entry = entry->next;
+	return entry;
+}
+
+void checkpoint_grow(checkpoint_t *cp)
+{
+	/* double bucket count, rehash every entry */
+	unsigned new_count = cp->bucket_count * 2;
+	struct _checkpoint_entry **new_buckets =
+		(struct _checkpoint_entry **) calloc(new_count, sizeof(struct _checkpoint_entry *));
+	unsigned i;
+	for (i = 0; i < cp->bucket_count; i++)
+	{
+		struct _checkpoint_entry *entry = cp->buckets[i];
+		while (entry)
+		{
+			struct _checkpoint_entry *next = entry->next;
+			unsigned long slot = checkpoint_hash(entry->url) % new_count;
+			entry->next = new_buckets[slot];
+			new_buckets[slot] = entry;
+			entry = next;
+		}
+	}
+	free(cp->buckets);
+	cp->buckets = new_buckets;
+	cp->bucket_count = new_count;
+}
+
+void checkpoint_update(checkpoint_t *cp, cpstate_t state, const char *url, const char *folder)
+{
+	/* update in-memory state only */
+	struct _checkpoint_entry *entry = checkpoint_lookup(cp, url);
+	if (!entry)
+	{
+		if (cp->entries >= cp->bucket_count * 2)
+			checkpoint_grow(cp);
+		unsigned long slot = checkpoint_hash(url) % cp->bucket_count;
+		entry = (struct _checkpoint_entry *) malloc(sizeof(struct _checkpoint_entry));
+		entry->url = checkpoint_strdup(url);
+		entry->folder = NULL;
+		entry->next = cp->buckets[slot];
+		cp->buckets[slot] = entry;
+		cp->entries++;
+	}
+	if (folder)
+	{
+		free(entry->folder);
+		entry->folder = checkpoint_strdup(folder);
+	}
+	entry->state = state;
+}
+
+char *checkpoint_read_line(FILE *fp, char **line, size_t *capacity)
+{
+	/* read one complete line, growing buffer as needed
+	 * returns NULL at EOF or on a truncated final line
+	 */
+	size_t len = 0;
+	while (fgets(*line + len, *capacity - len, fp))
+	{
+		len += strlen(*line + len);
+		if ((*line)[len - 1] == '\n')
+		{
+			(*line)[len - 1] = '\0';
+			return *line;
+		}
+		*capacity *= 2;
+		*line = (char *) realloc(*line, *capacity);
+	}
+	return NULL;
+}
+
+void checkpoint_load(checkpoint_t *cp, FILE *fp)
+{
+	size_t capacity = 512;
+	char *line = (char *) malloc(sizeof(char) * capacity);
+	while (checkpoint_read_line(fp, &line, &capacity))
+	{
+		char *url = strchr(line, '\t');
+		char *folder = url ? strchr(url + 1, '\t') : NULL;
+		if (!folder) /* malformed */
+			continue;
+		*url++ = '\0';
+		*folder++ = '\0';
+		unsigned i;
+		for (i = 0; i <= CHECKPOINT_DONE; i++)
+		{
+			if (!strcmp(line, CHECKPOINT_STATE[i]))
+				checkpoint_update(cp, (cpstate_t) i, url, folder);
+		}
+	}
+	free(line);
+}
+
+void checkpoint_free_entries(checkpoint_t *cp)
+{
+	unsigned i;
+	for (i = 0; i < cp->bucket_count; i++)
+	{
+		struct _checkpoint_entry *entry = cp->buckets[i];
+		while (entry)
+		{
+			struct _checkpoint_entry *next = entry->next;
+			free(entry->url);
+			free(entry->folder);
+			free(entry);
+			entry = next;
+		}
+	}
+	free(cp->buckets);
+}
+
+checkpoint_t *checkpoint_open(const char *filename)
+{
+	/* load previous runs, then reopen log for appending
+	 * returns NULL if log can't be opened
+	 */
+	checkpoint_t *cp = (checkpoint_t *) malloc(sizeof(checkpoint_t));
+	cp->bucket_count = CHECKPOINT_BUCKETS;
+	cp->buckets = (struct _checkpoint_entry **) calloc(cp->bucket_count, sizeof(struct _checkpoint_entry *));
+	cp->entries = 0;
+	int torn = 0;
+	FILE *prev = fopen(filename, "r");
+	if (prev)
+	{
+		checkpoint_load(cp, prev);
+		if (!fseek(prev, -1, SEEK_END)) /* non-empty */
+			torn = (getc(prev) != '\n');
+		fclose(prev);
+	}
+	cp->log = fopen(filename, "a");
+	if (!cp->log)
+	{
+		checkpoint_free_entries(cp);
+		free(cp);
+		return NULL;
+	}
+	if (torn) /* keep new records off the end of a truncated one */
+		fputc('\n', cp->log);
+	return cp;
+}
+
+const char *checkpoint_completed(checkpoint_t *cp, const char *url)
+{
+	/* return folder name if URL was completed in a previous run */
+	struct _checkpoint_entry *entry = checkpoint_lookup(cp, url);
+	if (entry && entry->state == CHECKPOINT_DONE)
+		return entry->folder;
+	return NULL;
+}
+
+void checkpoint_record(checkpoint_t *cp, cpstate_t state, const char *url, const char *folder)
+{
+	checkpoint_update(cp, state, url, folder);
+	fprintf(cp->log, "%s\t%s\t%s\n", CHECKPOINT_STATE[state], url, folder);
+	fflush(cp->log); /* survive a crash partway through the next album */
+}
+
+void checkpoint_close(checkpoint_t *cp)
+{
+	checkpoint_free_entries(cp);
+	fclose(cp->log);
+	free(cp);
+}
@@ -1,7 +1,21 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
 
 #include "global.h"
+#include "error.h"
+#include "bcdl.h"
+#include "membuf.h"
+#include "bufpool.h"
+#include "parse.h"
+#include "utilities.h"
+#include "checkpoint.h"
+#include "hash.h"
+#include "manifest.h"
+#include "interface.h"
 #include "cli.h"
 
 /*
@@ -14,18 +28,108 @@
 
 /* PROGRAM ERROR HANDLING */
 
-const struct _error ERROR_INDEX[NUMBER_OF_ERRORS] = {
-	{.err = ERROR_INVALID_URL, .desc = "URL is invalid." },
-	{.err = ERROR_CONNECTION, .desc = "Connection error." },
-	{.err = ERROR_JSON, .desc = "JSON inconsistency error. Webpage layout might have changed. If this persists, contact maintainer." },
-	{.err = ERROR_FILE_IO, .desc = "Cannot write to disk." },
-	{.err = ERROR_MEM_IO, .desc = "Cannot expand memory buffer. Out of memory." }
-};
-
-void program_error(enum _error_flag err)
+void program_error(ferror_t err)
 {
 	fprintf(stderr, "[!] Error! -- ");
-	fprintf(stderr, "%s\n", ERROR_INDEX[err].desc);
+	fprintf(stderr, "%s\n", error_string(err));
+}
+
+/* SIGUSR1 halves the rate limit, SIGUSR2 doubles it, during schedule windows too */
+
+volatile sig_atomic_t rate_signal = 0; /* net halvings asked for, doublings count down */
+
+void cli_rate_signal(int sig)
+{
+	signal(sig, cli_rate_signal); /* handler may be reset on delivery */
+	rate_signal += (sig == SIGUSR1) ? 1 : -1;
+}
+
+void apply_signals(void)
+{
+	/* called from main loops, an unlimited rate stays unlimited */
+	int halvings = rate_signal;
+	if (!halvings)
+		return;
+	rate_signal -= halvings; /* more may arrive meanwhile */
+	bcdl_scale_bandwidth(halvings);
+}
+
+/* ARCHIVE OUTPUT, with --archive-to everything goes down one descriptor */
+
+int archive_fd = -1;
+
+int cli_archive_fd(void)
+{
+	/* descriptor for --archive-to, -1 for an archive per album
+	 * streaming to stdout moves everything printed over to stderr
+	 */
+	const char *to = SETTINGS.archive_to;
+	if (SETTINGS.archive == BCDL_ARCHIVE_NONE || !to)
+		return -1;
+	if (strcmp(to, "-"))
+	{
+		int fd = open(to, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+		if (fd < 0)
+			perror("[!] Could not open archive, writing one per album instead");
+		return fd;
+	}
+	if (isatty(STDOUT_FILENO))
+	{
+		fprintf(stderr, "[!] Won't write an archive to a terminal, writing one per album instead\n");
+		return -1;
+	}
+	/* anything printed so far is still buffered, stdout isn't a terminal,
+	 * so it's flushed to stderr too
+	 */
+	int fd = dup(STDOUT_FILENO);
+	if (fd >= 0)
+		dup2(STDERR_FILENO, STDOUT_FILENO);
+	return fd;
+}
+
+void program_stats(void)
+{
+	/* --verbose, once every buffer is back */
+	bcdl_stats_t stats;
+	bcdl_stats(&stats);
+	printf("Memory: ");
+	human_readable_filesize(stats.memory_peak);
+	printf("at most, %u track%s moved to temp files.\n", stats.spills, (stats.spills == 1) ? "" : "s");
+	printf("Buffer pool: %lu reused, %lu new, %lu released, ", stats.pool_hits, stats.pool_misses, stats.pool_drops);
+	human_readable_filesize(stats.pool_idle);
+	printf("kept.\n");
+}
+
+bcdl_t *cli_init(void)
+{
+	/* downloader context with settings from the command line applied */
+	bcdl_t *bcdl = bcdl_init();
+	signal(SIGUSR1, cli_rate_signal);
+	signal(SIGUSR2, cli_rate_signal);
+	if (SETTINGS.jobs)
+		bcdl_set_max_jobs(bcdl, SETTINGS.jobs);
+	bcdl_set_split(bcdl, SETTINGS.split);
+	bcdl_set_buffer_pool(SETTINGS.pool, SETTINGS.hugepages);
+	if (bcdl_set_io(SETTINGS.io))
+		fprintf(stderr, "[!] io_uring isn't available, writing with pwrite instead\n");
+	archive_fd = cli_archive_fd();
+	bcdl_set_archive(bcdl, SETTINGS.archive, archive_fd);
+	if (SETTINGS.manifest && bcdl_set_manifest(bcdl, SETTINGS.manifest, SETTINGS.link))
+		perror("[!] Could not open manifest, carrying on without it");
+	return bcdl;
+}
+
+void cli_cleanup(bcdl_t *bcdl)
+{
+	/* finishes an --archive-to archive, if any, then the context */
+	if (bcdl_set_archive(bcdl, BCDL_ARCHIVE_NONE, -1))
+		program_error(ERROR_FILE_IO);
+	if (archive_fd >= 0 && close(archive_fd))
+		program_error(ERROR_FILE_IO);
+	archive_fd = -1;
+	bcdl_cleanup(bcdl);
+	if (SETTINGS.verbose)
+		program_stats();
 }
 
 /* CLI OPTION FLAG INFORMATION */
@@ -33,9 +137,53 @@ void program_error(enum _error_flag err)
 const struct _cli_flags MODE_FLAGS[NUMBER_OF_MODES] = {
 	{.flag = "-h", .gnuflag = "--help", .desc = "Display this help screen.", .mode = MODE_HELP },
 	{.flag = "-v", .gnuflag = "--version", .desc = "Version and license information.", .mode = MODE_VERSION },
-	{.flag = "-i", .gnuflag = "--iterate", .desc = "Provide iterated list of urls.", .mode = MODE_MULTI }
+	{.flag = "-i", .gnuflag = "--iterate", .desc = "Provide iterated list of urls, '-' reads from stdin.", .mode = MODE_MULTI },
+	{.flag = "-d", .gnuflag = "--daemon", .desc = "Accept album URLs as jobs on a local socket, default 'bc-dl.sock'.", .mode = MODE_DAEMON },
+	{.flag = "-r", .gnuflag = "--retag", .desc = "Rewrite tags of an album already downloaded, from a url or list of urls.", .mode = MODE_RETAG },
+	{.flag = "-j", .gnuflag = "--dump", .desc = "Print album details as JSON lines without downloading, from a url or list of urls.", .mode = MODE_DUMP }
 };
 
+const struct _cli_options OPTIONS[NUMBER_OF_OPTIONS] = {
+	{.gnuflag = "--memory", .desc = "Memory budget for downloads in bytes, K, M or G, 0 for none.", .option = OPTION_MEMORY, .runtime = 1 },
+	{.gnuflag = "--spill", .desc = "Tracks larger than this go to a temp file, 0 for never.", .option = OPTION_SPILL, .runtime = 1 },
+	{.gnuflag = "--manifest", .desc = "Log a hash of every track's audio to this file.", .option = OPTION_MANIFEST, .runtime = 0 },
+	{.gnuflag = "--link", .desc = "Duplicate audio found in the manifest is 'hard' linked or 'reflink'ed.", .option = OPTION_LINK, .runtime = 0 },
+	{.gnuflag = "--jobs", .desc = "Most downloads at once from one host, fewer are used if more don't help.", .option = OPTION_JOBS, .runtime = 0 },
+	{.gnuflag = "--rate", .desc = "Bytes per second for all downloads together, shared evenly by albums, 0 for unlimited.", .option = OPTION_RATE, .runtime = 1 },
+	{.gnuflag = "--album-rate", .desc = "Bytes per second for any one album, 0 for unlimited.", .option = OPTION_ALBUM_RATE, .runtime = 1 },
+	{.gnuflag = "--schedule", .desc = "Rate by time of day instead, eg. '09:00-18:00=256K,18:00-23:00=1M'.", .option = OPTION_SCHEDULE, .runtime = 1 },
+	{.gnuflag = "--lookahead", .desc = "Album pages fetched ahead of their turn with -i, 0 for none.", .option = OPTION_LOOKAHEAD, .runtime = 0 },
+	{.gnuflag = "--split", .desc = "Tracks larger than this are fetched over several connections at once, 0 for never.", .option = OPTION_SPLIT, .runtime = 0 },
+	{.gnuflag = "--io", .desc = "Write files with 'uring' or 'pwrite', default 'auto' picks io_uring if available.", .option = OPTION_IO, .runtime = 0 },
+	{.gnuflag = "--archive", .desc = "Write each album as one 'tar' or 'zip' archive instead of a folder.", .option = OPTION_ARCHIVE, .runtime = 0 },
+	{.gnuflag = "--archive-to", .desc = "Put every album in this one archive instead, '-' streams it to stdout.", .option = OPTION_ARCHIVE_TO, .runtime = 0 },
+	{.gnuflag = "--pool", .desc = "Freed track buffers kept for reuse by later tracks, 0 for none.", .option = OPTION_POOL, .runtime = 0 },
+	{.gnuflag = "--hugepages", .desc = "Back large track buffers with huge pages, 'on' or 'off'.", .option = OPTION_HUGEPAGES, .runtime = 0 },
+	{.gnuflag = "--verbose", .desc = "Print memory and buffer pool statistics once done, 'on' or 'off'.", .option = OPTION_VERBOSE, .runtime = 0 }
+};
+
+const char *LINK_MODES[] = { "none", "hard", "reflink" }; /* BCDL_LINK_* */
+const char *IO_MODES[] = { "auto", "uring", "pwrite" }; /* BCDL_IO_* */
+const char *ARCHIVE_FORMATS[] = { "none", "tar", "zip" }; /* BCDL_ARCHIVE_* */
+const char *SWITCHES[] = { "off", "on" };
+
+struct _settings SETTINGS = {
+	.memory = MEMBUF_DEFAULT_BUDGET,
+	.spill = MEMBUF_DEFAULT_SPILL,
+	.manifest = NULL,
+	.link = BCDL_LINK_NONE,
+	.jobs = 0,
+	.rate = 0,
+	.album_rate = 0,
+	.lookahead = DEFAULT_LOOKAHEAD,
+	.split = BCDL_DEFAULT_SPLIT,
+	.io = BCDL_IO_AUTO,
+	.archive = BCDL_ARCHIVE_NONE,
+	.archive_to = NULL,
+	.pool = BUFPOOL_DEFAULT_IDLE,
+	.hugepages = 0,
+	.verbose = 0
+};
 
 /* COMMAND LINE ROUTINES DEFINED HERE */
 
@@ -51,6 +199,132 @@ enum _flag_mode get_mode(const char *str)
 	return MODE_NORMAL;
 }
 
+int parse_link_mode(const char *str, int *link)
+{
+	int i;
+	for (i = BCDL_LINK_NONE; i <= BCDL_LINK_REFLINK; i++)
+	{
+		if (!strcmp(str, LINK_MODES[i]))
+		{
+			*link = i;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+int parse_io_mode(const char *str, int *io)
+{
+	int i;
+	for (i = BCDL_IO_AUTO; i <= BCDL_IO_PWRITE; i++)
+	{
+		if (!strcmp(str, IO_MODES[i]))
+		{
+			*io = i;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+int parse_archive_format(const char *str, int *archive)
+{
+	int i;
+	for (i = BCDL_ARCHIVE_NONE; i <= BCDL_ARCHIVE_ZIP; i++)
+	{
+		if (!strcmp(str, ARCHIVE_FORMATS[i]))
+		{
+			*archive = i;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+int parse_switch(const char *str, int *on)
+{
+	int i;
+	for (i = 0; i <= 1; i++)
+	{
+		if (!strcmp(str, SWITCHES[i]))
+		{
+			*on = i;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+int parse_setting(const char *arg, int runtime)
+{
+	/* apply one --name=value setting, only ones marked runtime if set
+	 * string values are kept, not copied
+	 * returns 0 on success, nonzero on an unknown or malformed setting
+	 */
+	const char *value = strchr(arg, '=');
+	if (strncmp(arg, "--", 2) || !value)
+		return -1;
+	unsigned j;
+	for (j = 0; j < NUMBER_OF_OPTIONS; j++)
+	{
+		if (strlen(OPTIONS[j].gnuflag) == (size_t) (value - arg) &&
+		    !strncmp(arg, OPTIONS[j].gnuflag, value - arg))
+			break;
+	}
+	if (j == NUMBER_OF_OPTIONS || (runtime && !OPTIONS[j].runtime))
+		return -1;
+	value++;
+	int err = 0;
+	switch (OPTIONS[j].option)
+	{
+		case OPTION_MEMORY: err = parse_size(value, &SETTINGS.memory); break;
+		case OPTION_SPILL: err = parse_size(value, &SETTINGS.spill); break;
+		case OPTION_MANIFEST: SETTINGS.manifest = value; break;
+		case OPTION_LINK: err = parse_link_mode(value, &SETTINGS.link); break;
+		case OPTION_JOBS: err = parse_uint(value, &SETTINGS.jobs) || !SETTINGS.jobs; break;
+		case OPTION_RATE: err = parse_size(value, &SETTINGS.rate); break;
+		case OPTION_ALBUM_RATE: err = parse_size(value, &SETTINGS.album_rate); break;
+		case OPTION_SCHEDULE: err = bcdl_set_schedule(value); break;
+		case OPTION_LOOKAHEAD: err = parse_uint(value, &SETTINGS.lookahead) || SETTINGS.lookahead > MAX_LOOKAHEAD; break;
+		case OPTION_SPLIT: err = parse_size(value, &SETTINGS.split); break;
+		case OPTION_IO: err = parse_io_mode(value, &SETTINGS.io); break;
+		case OPTION_ARCHIVE: err = parse_archive_format(value, &SETTINGS.archive); break;
+		case OPTION_ARCHIVE_TO: SETTINGS.archive_to = value; break;
+		case OPTION_POOL: err = parse_size(value, &SETTINGS.pool); break;
+		case OPTION_HUGEPAGES: err = parse_switch(value, &SETTINGS.hugepages); break;
+		case OPTION_VERBOSE: err = parse_switch(value, &SETTINGS.verbose); break;
+	}
+	if (err)
+		return -1;
+	bcdl_set_memory_budget(SETTINGS.memory, SETTINGS.spill);
+	if (OPTIONS[j].option == OPTION_RATE || OPTIONS[j].option == OPTION_ALBUM_RATE)
+		bcdl_set_bandwidth(SETTINGS.rate, SETTINGS.album_rate); /* drops SIGUSR1/2 scaling */
+	return 0;
+}
+
+int parse_options(int *argc, char **argv)
+{
+	/* apply and remove --name=value settings from argv
+	 * returns 0 on success, nonzero on an unknown or malformed setting
+	 */
+	int i, kept = 1;
+	for (i = 1; i < *argc; i++)
+	{
+		if (strncmp(argv[i], "--", 2) || !strchr(argv[i], '='))
+		{
+			argv[kept++] = argv[i];
+			continue;
+		}
+		if (parse_setting(argv[i], 0))
+			return -1;
+	}
+	argv[kept] = NULL;
+	*argc = kept;
+	if (SETTINGS.link != BCDL_LINK_NONE && !SETTINGS.manifest)
+		SETTINGS.manifest = MANIFEST_FILENAME;
+	return 0;
+}
+
 void program_help(void)
 {
 	unsigned i;
@@ -60,6 +334,10 @@ void program_help(void)
 		       MODE_FLAGS[i].flag,
 		       MODE_FLAGS[i].gnuflag,
 		       MODE_FLAGS[i].desc);
+	for (i = 0; i < NUMBER_OF_OPTIONS; i++)
+		printf("\t%s=VALUE - %s\n",
+		       OPTIONS[i].gnuflag,
+		       OPTIONS[i].desc);
 }
 
 void program_identification(enum _verbose setting)
@@ -75,7 +353,7 @@ void program_identification(enum _verbose setting)
 
 void program_usage(enum _verbose setting)
 {
-	const char *flags = "[-h | -v | -i list.txt]";
+	const char *flags = "[--setting=value ...] [-h | -v | -i list.txt | -d socket | -r url | -j url]";
 	const char *example = "http://artist.bandcamp.com/album/example";
 	const char *more = "Run with -h or --help for all options.";
 	if (setting == VERBOSE)
@@ -85,5 +363,293 @@ void program_usage(enum _verbose setting)
 
 void progress_indicator(char *subject, unsigned current, unsigned total, char *comment)
 {
-	printf("%s %u of %u -- Downloading: '%s'\n", subject, current, total, comment);
+	/* total is 0 when it isn't known ahead of time */
+	if (total)
+		printf("%s %u of %u -- Downloading: '%s'\n", subject, current, total, comment);
+	else
+		printf("%s %u -- Downloading: '%s'\n", subject, current, comment);
+}
+
+/* JOB DRIVERS */
+/* albums are downloaded one at a time so output stays readable,
+ * everything underneath runs on libbcdl
+ */
+
+void cli_progress(bcdl_album_t *a, size_t bytes, void *userdata)
+{
+	static unsigned progress = 0;
+	if (progress++ == 5) /* flush stdout only sparingly */
+	{
+		animate_progress_bar(bytes); /* progress bar */
+		progress = 0;
+	}
+}
+
+void cli_track(bcdl_album_t *a, unsigned track, int skipped, void *userdata)
+{
+	const char *filename = bcdl_album_track_filename(a, track);
+	if (skipped)
+		printf("Skipped: '%s', file exists.\n", filename);
+	else
+		printf("Track %u of %u -- Written to: '%s'\n", track+1, bcdl_album_data(a)->track_count, filename);
+}
+
+void cli_retag_track(bcdl_album_t *a, unsigned track, int skipped, void *userdata)
+{
+	const char *filename = bcdl_album_track_filename(a, track);
+	if (skipped)
+		printf("Skipped: '%s', not downloaded.\n", filename);
+	else
+		printf("Track %u of %u -- Retagged: '%s'\n", track+1, bcdl_album_data(a)->track_count, filename);
+}
+
+const bcdl_callbacks_t CLI_CALLBACKS = {
+	.parsed = NULL,
+	.progress = cli_progress,
+	.track = cli_track,
+	.complete = NULL
+};
+
+const bcdl_callbacks_t CLI_RETAG_CALLBACKS = {
+	.parsed = NULL,
+	.progress = cli_progress,
+	.track = cli_retag_track,
+	.complete = NULL
+};
+
+void cli_job_failed(bcdl_album_t *a, ferror_t err, void *userdata)
+{
+	/* album page fetched ahead couldn't be loaded, say so now */
+	struct _cli_job *job = (struct _cli_job *) userdata;
+	if (err == EVERYTHING_IS_FINE)
+		return;
+	fprintf(stderr, "[!] Job %u will fail -- %s\n", job->number, error_string(err));
+	job->reported = 1;
+}
+
+const bcdl_callbacks_t CLI_LOOKAHEAD_CALLBACKS = {
+	.parsed = NULL,
+	.progress = NULL,
+	.track = NULL,
+	.complete = cli_job_failed
+};
+
+void run_until(bcdl_t *bcdl, bcdl_album_t *a, bcdl_state_t state)
+{
+	/* albums short of the target state always have a transfer in flight */
+	for (;;)
+	{
+		apply_signals();
+		bcdl_perform(bcdl);
+		if (bcdl_album_state(a) >= state)
+			break;
+		bcdl_wait(bcdl, 1000);
+	}
+}
+
+void display_plan(bcdl_t *bcdl, bcdl_album_t *a)
+{
+	/* bytes to be written and how long they should take, at the rate
+	 * measured so far or the rate limit, whichever is lower
+	 */
+	unsigned unknown;
+	size_t size = bcdl_album_size(a, &unknown);
+	size_t rate = bcdl_throughput(bcdl);
+	size_t limit = bcdl_bandwidth();
+	if (SETTINGS.album_rate && (!limit || SETTINGS.album_rate < limit))
+		limit = SETTINGS.album_rate;
+	if (limit && (!rate || limit < rate))
+		rate = limit;
+	if (!size)
+	{
+		if (unknown)
+			printf("Plan: sizes unknown, tracks in album order.\n");
+		else
+			printf("Plan: nothing left to write.\n");
+		return;
+	}
+	printf("Plan: ");
+	human_readable_filesize(size);
+	printf("to write, largest tracks first");
+	if (unknown)
+		printf(", %u of unknown size", unknown);
+	if (rate)
+	{
+		unsigned long eta = (unsigned long) ((size + rate - 1) / rate);
+		printf(", about %lu:%02lu:%02lu", eta / 3600, eta / 60 % 60, eta % 60);
+	}
+	else
+		printf(", time unknown until a download is measured");
+	printf(".\n");
+}
+
+ferror_t download_album(bcdl_t *bcdl, bcdl_album_t *a, checkpoint_t *cp)
+{
+	/* album is expected to be opened with BCDL_DEFER
+	 * progress is logged to checkpoint if one is provided
+	 */
+	run_until(bcdl, a, BCDL_PARSED);
+	if (bcdl_album_state(a) == BCDL_FAILED)
+		return bcdl_album_error(a);
+	display_plan(bcdl, a);
+	bcdl_album_start(a);
+	if (bcdl_album_state(a) == BCDL_FAILED)
+		return bcdl_album_error(a);
+	if (SETTINGS.archive != BCDL_ARCHIVE_NONE)
+		printf("Folder '%s' goes into an archive.\n", bcdl_album_folder(a));
+	else
+		printf("Folder '%s' created.\n", bcdl_album_folder(a));
+	if (cp)
+		checkpoint_record(cp, CHECKPOINT_STARTED, bcdl_album_url(a), bcdl_album_folder(a));
+	display_album_data(bcdl_album_data(a));
+	run_until(bcdl, a, BCDL_DONE);
+	if (bcdl_album_state(a) == BCDL_FAILED)
+		return bcdl_album_error(a);
+	if (cp)
+		checkpoint_record(cp, CHECKPOINT_DONE, bcdl_album_url(a), bcdl_album_folder(a));
+	printf("Completed.\n");
+	return EVERYTHING_IS_FINE;
+}
+
+ferror_t download_album_at_URL(bcdl_t *bcdl, const char *url, checkpoint_t *cp)
+{
+	bcdl_album_t *a = bcdl_album_open(bcdl, url, BCDL_DEFER, &CLI_CALLBACKS, NULL);
+	ferror_t err = download_album(bcdl, a, cp);
+	bcdl_album_close(a);
+	return err;
+}
+
+ferror_t download_discography_at_URL(bcdl_t *bcdl, const char *url, checkpoint_t *cp)
+{
+	/* expand artist page into album jobs
+	 * album pages are fetched concurrently, one window of
+	 * DISCOGRAPHY_WINDOW at a time, then downloaded in order
+	 */
+	ferror_t err;
+	membuf_t *html = bcdl_fetch_page(bcdl, url, &err);
+	if (!html)
+		return err;
+	if (page_is_album(html)) /* artist has a single release */
+	{
+		membuf_free(html);
+		return download_album_at_URL(bcdl, url, cp);
+	}
+	unsigned count;
+	char **releases = parse_discography(html, url, &count);
+	membuf_free(html);
+	printf("Found %u releases.\n", count);
+
+	bcdl_album_t *window[DISCOGRAPHY_WINDOW];
+	unsigned release[DISCOGRAPHY_WINDOW];
+	unsigned i = 0;
+	while (i < count)
+	{
+		unsigned n = 0;
+		unsigned j;
+		for (; i < count && n < DISCOGRAPHY_WINDOW; i++)
+		{
+			const char *folder = cp ? checkpoint_completed(cp, releases[i]) : NULL;
+			if (folder)
+			{
+				printf("Release %u of %u -- Skipped: '%s', completed in '%s'.\n", i+1, count, releases[i], folder);
+				continue;
+			}
+			release[n] = i;
+			window[n++] = bcdl_album_open(bcdl, releases[i], BCDL_DEFER, &CLI_CALLBACKS, NULL);
+		}
+		for (j = 0; j < n; j++)
+		{
+			progress_indicator("Release", release[j]+1, count, releases[release[j]]);
+			err = download_album(bcdl, window[j], cp);
+			if (err != EVERYTHING_IS_FINE)
+				program_error(err);
+			bcdl_album_close(window[j]);
+		}
+	}
+	free_discography(releases, count);
+	return EVERYTHING_IS_FINE;
+}
+
+ferror_t retag_URL(bcdl_t *bcdl, const char *url)
+{
+	/* refresh tags of an album already on disk from its current page
+	 * audio is left alone, only the tag at the front of each track is rewritten
+	 */
+	if (URL_type(url) != URL_ALBUM)
+		return ERROR_INVALID_URL;
+	bcdl_album_t *a = bcdl_album_open(bcdl, url, BCDL_DEFER | BCDL_RETAG, &CLI_RETAG_CALLBACKS, NULL);
+	run_until(bcdl, a, BCDL_PARSED);
+	if (bcdl_album_state(a) != BCDL_FAILED)
+	{
+		printf("Folder '%s'.\n", bcdl_album_folder(a));
+		bcdl_album_start(a);
+		run_until(bcdl, a, BCDL_DONE);
+	}
+	ferror_t err = bcdl_album_error(a);
+	bcdl_album_close(a);
+	if (err == EVERYTHING_IS_FINE)
+		printf("Completed.\n");
+	return err;
+}
+
+void download_list(bcdl_t *bcdl, url_reader_t *reader, checkpoint_t *cp)
+{
+	/* -i jobs, run one at a time in order
+	 * album pages of the next SETTINGS.lookahead jobs are fetched and
+	 * parsed while the current one downloads, so the next album's
+	 * tracks start as soon as the current one is done
+	 */
+	unsigned size = SETTINGS.lookahead + 1;
+	struct _cli_job *jobs = (struct _cli_job *) calloc(size, sizeof(struct _cli_job));
+	unsigned head = 0, count = 0;
+	for (;;)
+	{
+		char *url;
+		while (count < size && (url = url_reader_next(reader)))
+		{
+			struct _cli_job *job = &jobs[(head + count++) % size];
+			job->number = reader->count;
+			job->url = create_string(url);
+			job->album = NULL;
+			job->reported = 0;
+			if (URL_type(url) == URL_ALBUM && !(cp && checkpoint_completed(cp, url)))
+				job->album = bcdl_album_open(bcdl, url, BCDL_DEFER, &CLI_LOOKAHEAD_CALLBACKS, job);
+		}
+		if (!count)
+			break;
+		struct _cli_job *job = &jobs[head];
+		head = (head + 1) % size;
+		count--;
+		const char *folder = cp ? checkpoint_completed(cp, job->url) : NULL;
+		if (folder) /* maybe by a job earlier in this list */
+			printf("Job %u -- Skipped: '%s', completed in '%s'.\n", job->number, job->url, folder);
+		else
+		{
+			progress_indicator("Job", job->number, 0, job->url);
+			ferror_t err;
+			if (job->album)
+			{
+				bcdl_album_set_callbacks(job->album, &CLI_CALLBACKS, NULL);
+				err = download_album(bcdl, job->album, cp);
+			}
+			else
+				err = download_URL(bcdl, job->url, cp);
+			if (err != EVERYTHING_IS_FINE && !job->reported) /* carry on with next job */
+				program_error(err);
+		}
+		if (job->album)
+			bcdl_album_close(job->album);
+		free(job->url);
+	}
+	free(jobs);
+}
+
+ferror_t download_URL(bcdl_t *bcdl, const char *url, checkpoint_t *cp)
+{
+	switch (URL_type(url))
+	{
+		case URL_ALBUM: return download_album_at_URL(bcdl, url, cp);
+		case URL_DISCOGRAPHY: return download_discography_at_URL(bcdl, url, cp);
+		default: return ERROR_INVALID_URL;
+	}
 }
@@ -0,0 +1,492 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/un.h> /* unix domain sockets */
+
+#include "error.h"
+#include "bcdl.h"
+#include "membuf.h"
+#include "parse.h"
+#include "utilities.h"
+#include "checkpoint.h"
+#include "cli.h"
+#include "daemon.h"
+
+/*
+ *	daemon.c
+ *	This file is part of bc-dl.
+ *	See bc-dl.c for copyright or LICENSE for license information.
+ */
+
+/* DAEMON PROTOCOL
+ * clients connect to the socket and send one job per line
+ *     URL [PRIORITY]
+ * status lines for that client's jobs are streamed back as they happen
+ *     QUEUED <id> <url>
+ *     SKIPPED <id> <folder>       completed by an earlier run
+ *     DUPLICATE <id> <other id>   same URL already queued or running
+ *     STARTED <id> <folder>
+ *     TRACK <id> <n>/<total> <filename>
+ *     DONE <id> <folder>
+ *     FAILED <id> <reason>
+ * jobs keep running if their client hangs up
+ *
+ * a line starting with -- changes a setting instead, eg. --rate=512K
+ *     SET <id> <setting>
+ *     FAILED <id> <reason>
+ * only settings that make sense while running are accepted
+ *
+ * SCHEDULING
+ * queued job with the highest priority starts first, a job gains one
+ * priority level for every DAEMON_AGING seconds it waits
+ * ties go to the client with fewest jobs running, then to the oldest job
+ */
+
+volatile sig_atomic_t daemon_stop = 0;
+
+void daemon_signal(int sig)
+{
+	daemon_stop = 1;
+}
+
+void client_queue(client_t *c, const char *data, size_t len)
+{
+	/* append to output, client is dropped if it can't be held */
+	if (c->out_len + len > c->out_size)
+	{
+		size_t size = c->out_size ? c->out_size : DAEMON_MAX_LINE;
+		while (size < c->out_len + len)
+			size *= 2;
+		char *out = (char *) realloc(c->out, size);
+		if (!out)
+		{
+			c->closed = 1;
+			return;
+		}
+		c->out = out;
+		c->out_size = size;
+	}
+	memcpy(c->out + c->out_len, data, len);
+	c->out_len += len;
+}
+
+void client_status(client_t *c, const char *status, unsigned id, const char *text)
+{
+	/* queue one status line, sent once socket is writable */
+	if (!c || c->closed)
+		return;
+	char num[16];
+	sprintf(num, " %u ", id);
+	client_queue(c, status, strlen(status));
+	client_queue(c, num, strlen(num));
+	client_queue(c, text, strlen(text));
+	client_queue(c, "\n", 1);
+}
+
+void client_flush(client_t *c)
+{
+	ssize_t sent = send(c->fd, c->out, c->out_len, 0);
+	if (sent < 0)
+	{
+		if (errno != EAGAIN && errno != EWOULDBLOCK)
+			c->closed = 1;
+		return;
+	}
+	c->out_len -= sent;
+	memmove(c->out, c->out + sent, c->out_len);
+}
+
+/* JOB CALLBACKS */
+
+void job_track(bcdl_album_t *a, unsigned track, int skipped, void *userdata)
+{
+	job_t *job = (job_t *) userdata;
+	const char *filename = bcdl_album_track_filename(a, track);
+	char *text = (char *) malloc(sizeof(char) * (strlen(filename) + 32));
+	sprintf(text, "%u/%u %s", track+1, bcdl_album_data(a)->track_count, filename);
+	client_status(job->client, "TRACK", job->id, text);
+	free(text);
+}
+
+void job_complete(bcdl_album_t *a, ferror_t err, void *userdata)
+{
+	/* album is closed by daemon_reap(), outside of bcdl_perform() */
+	job_t *job = (job_t *) userdata;
+	job->finished = 1;
+	if (err == EVERYTHING_IS_FINE)
+		client_status(job->client, "DONE", job->id, bcdl_album_folder(a));
+	else
+		client_status(job->client, "FAILED", job->id, error_string(err));
+}
+
+const bcdl_callbacks_t DAEMON_CALLBACKS = {
+	.parsed = NULL,
+	.progress = NULL,
+	.track = job_track,
+	.complete = job_complete
+};
+
+/* QUEUE */
+
+void job_free(job_t *job)
+{
+	if (job->album)
+		bcdl_album_close(job->album);
+	free(job->url);
+	free(job);
+}
+
+job_t *daemon_find(daemon_t *d, const char *url)
+{
+	job_t *lists[2];
+	lists[0] = d->queue;
+	lists[1] = d->running;
+	unsigned i;
+	for (i = 0; i < 2; i++)
+	{
+		job_t *job;
+		for (job = lists[i]; job; job = job->next)
+		{
+			if (!strcmp(job->url, url))
+				return job;
+		}
+	}
+	return NULL;
+}
+
+void daemon_submit(daemon_t *d, client_t *c, char *line)
+{
+	/* URL [PRIORITY] or --setting=value */
+	char *url = strtok(line, " \t\r");
+	char *priority = strtok(NULL, " \t\r");
+	if (!url)
+		return;
+	unsigned id = d->next_id++;
+	if (!strncmp(url, "--", 2))
+	{
+		if (parse_setting(url, 1))
+			client_status(c, "FAILED", id, "Unknown or malformed setting, or one that can't be changed while running.");
+		else
+			client_status(c, "SET", id, url);
+		return;
+	}
+	if (URL_type(url) != URL_ALBUM)
+	{
+		client_status(c, "FAILED", id, error_string(ERROR_INVALID_URL));
+		return;
+	}
+	const char *folder = checkpoint_completed(d->cp, url);
+	if (folder)
+	{
+		client_status(c, "SKIPPED", id, folder);
+		return;
+	}
+	job_t *other = daemon_find(d, url);
+	if (other)
+	{
+		char num[16];
+		sprintf(num, "%u", other->id);
+		client_status(c, "DUPLICATE", id, num);
+		return;
+	}
+	job_t *job = (job_t *) calloc(1, sizeof(job_t));
+	job->id = id;
+	job->url = (char *) malloc(sizeof(char) * (strlen(url) + 1));
+	strcpy(job->url, url);
+	job->priority = priority ? atoi(priority) : DAEMON_DEFAULT_PRIORITY;
+	job->queued = time(NULL);
+	job->client = c;
+	job_t **tail = &d->queue; /* FIFO among equals */
+	while (*tail)
+		tail = &(*tail)->next;
+	*tail = job;
+	client_status(c, "QUEUED", id, url);
+}
+
+job_t **daemon_pick(daemon_t *d)
+{
+	/* returns link to the queued job that should run next */
+	time_t now = time(NULL);
+	job_t **best = NULL;
+	long best_priority = 0;
+	unsigned best_running = 0;
+	job_t **link;
+	for (link = &d->queue; *link; link = &(*link)->next)
+	{
+		job_t *job = *link;
+		long priority = job->priority + (long) (now - job->queued) / DAEMON_AGING;
+		unsigned running = job->client ? job->client->running : 0;
+		if (!best || priority > best_priority ||
+		    (priority == best_priority && running < best_running))
+		{
+			best = link;
+			best_priority = priority;
+			best_running = running;
+		}
+	}
+	return best;
+}
+
+void daemon_schedule(daemon_t *d)
+{
+	while (d->queue && d->running_count < DAEMON_MAX_ALBUMS)
+	{
+		if (d->running_count && !membuf_budget_headroom(MEMBUF_BUDGET.spill_threshold))
+			break; /* out of memory budget */
+		job_t **link = daemon_pick(d);
+		job_t *job = *link;
+		*link = job->next;
+		job->next = d->running;
+		d->running = job;
+		d->running_count++;
+		if (job->client)
+			job->client->running++;
+		job->album = bcdl_album_open(d->bcdl, job->url, BCDL_DEFER, &DAEMON_CALLBACKS, job);
+	}
+}
+
+void daemon_advance(daemon_t *d)
+{
+	/* start parsed albums, log them to checkpoint once they're past
+	 * waiting for disk space
+	 */
+	job_t *job;
+	for (job = d->running; job; job = job->next)
+	{
+		if (bcdl_album_state(job->album) == BCDL_PARSED)
+			bcdl_album_start(job->album);
+		if (job->started || bcdl_album_state(job->album) < BCDL_FETCH_ART ||
+		    bcdl_album_state(job->album) == BCDL_FAILED)
+			continue;
+		job->started = 1;
+		checkpoint_record(d->cp, CHECKPOINT_STARTED, job->url, bcdl_album_folder(job->album));
+		client_status(job->client, "STARTED", job->id, bcdl_album_folder(job->album));
+	}
+}
+
+void daemon_reap(daemon_t *d)
+{
+	/* retire finished jobs */
+	job_t **link = &d->running;
+	while (*link)
+	{
+		job_t *job = *link;
+		if (!job->finished)
+		{
+			link = &job->next;
+			continue;
+		}
+		if (bcdl_album_state(job->album) == BCDL_DONE)
+			checkpoint_record(d->cp, CHECKPOINT_DONE, job->url, bcdl_album_folder(job->album));
+		if (job->client)
+			job->client->running--;
+		d->running_count--;
+		*link = job->next;
+		job_free(job);
+	}
+}
+
+/* CLIENTS */
+
+void daemon_accept(daemon_t *d)
+{
+	int fd = accept(d->listen_fd, NULL, NULL);
+	if (fd < 0)
+		return;
+	if (fd >= FD_SETSIZE) /* can't be watched with select() */
+	{
+		close(fd);
+		return;
+	}
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	client_t *c = (client_t *) calloc(1, sizeof(client_t));
+	c->fd = fd;
+	c->next = d->clients;
+	d->clients = c;
+}
+
+void daemon_read(daemon_t *d, client_t *c)
+{
+	/* split input into lines, submit each as a job */
+	ssize_t len = recv(c->fd, c->in + c->in_len, DAEMON_MAX_LINE - c->in_len, 0);
+	if (len <= 0)
+	{
+		if (len == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+			c->closed = 1;
+		return;
+	}
+	c->in_len += len;
+	c->in[c->in_len] = '\0';
+	char *line = c->in;
+	char *end;
+	while ((end = memchr(line, '\n', c->in_len - (line - c->in))))
+	{
+		*end = '\0';
+		daemon_submit(d, c, line);
+		line = end + 1;
+	}
+	c->in_len -= line - c->in;
+	memmove(c->in, line, c->in_len);
+	c->in[c->in_len] = '\0';
+	if (c->in_len == DAEMON_MAX_LINE) /* not a URL */
+		c->closed = 1;
+}
+
+void daemon_drop_clients(daemon_t *d)
+{
+	/* jobs of a departed client carry on without it */
+	client_t **link = &d->clients;
+	while (*link)
+	{
+		client_t *c = *link;
+		if (!c->closed)
+		{
+			link = &c->next;
+			continue;
+		}
+		job_t *lists[2];
+		lists[0] = d->queue;
+		lists[1] = d->running;
+		unsigned i;
+		for (i = 0; i < 2; i++)
+		{
+			job_t *job;
+			for (job = lists[i]; job; job = job->next)
+			{
+				if (job->client == c)
+					job->client = NULL;
+			}
+		}
+		close(c->fd);
+		free(c->out);
+		*link = c->next;
+		free(c);
+	}
+}
+
+/* MAIN LOOP */
+
+int daemon_listen(const char *path)
+{
+	struct sockaddr_un addr;
+	if (strlen(path) >= sizeof(addr.sun_path))
+		return -1;
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		return -1;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	unlink(path); /* stale socket from an earlier run */
+	if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) || listen(fd, 16))
+	{
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+int daemon_run(const char *path)
+{
+	daemon_t d;
+	memset(&d, 0, sizeof(d));
+	d.next_id = 1;
+	d.listen_fd = daemon_listen(path);
+	if (d.listen_fd < 0)
+	{
+		perror("[!] Could not open socket");
+		return 1;
+	}
+	d.cp = checkpoint_open(CHECKPOINT_FILENAME);
+	if (!d.cp)
+	{
+		program_error(ERROR_FILE_IO);
+		close(d.listen_fd);
+		unlink(path);
+		return 1;
+	}
+	d.bcdl = cli_init();
+	signal(SIGPIPE, SIG_IGN);
+	signal(SIGINT, daemon_signal);
+	signal(SIGTERM, daemon_signal);
+	printf("Listening on '%s'.\n", path);
+	fflush(stdout);
+
+	while (!daemon_stop)
+	{
+		apply_signals();
+		daemon_schedule(&d);
+		fd_set read_fds, write_fds, exc_fds;
+		int max_fd = d.listen_fd;
+		FD_ZERO(&read_fds);
+		FD_ZERO(&write_fds);
+		FD_ZERO(&exc_fds);
+		FD_SET(d.listen_fd, &read_fds);
+		client_t *c;
+		for (c = d.clients; c; c = c->next)
+		{
+			FD_SET(c->fd, &read_fds);
+			if (c->out_len)
+				FD_SET(c->fd, &write_fds);
+			if (c->fd > max_fd)
+				max_fd = c->fd;
+		}
+		bcdl_fdset(d.bcdl, &read_fds, &write_fds, &exc_fds, &max_fd);
+		long timeout = bcdl_timeout(d.bcdl);
+		if (timeout < 0 || timeout > 1000)
+			timeout = 1000;
+		struct timeval tv;
+		tv.tv_sec = timeout / 1000;
+		tv.tv_usec = (timeout % 1000) * 1000;
+		if (select(max_fd + 1, &read_fds, &write_fds, &exc_fds, &tv) < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		if (FD_ISSET(d.listen_fd, &read_fds))
+			daemon_accept(&d);
+		for (c = d.clients; c; c = c->next)
+		{
+			if (!c->closed && FD_ISSET(c->fd, &read_fds))
+				daemon_read(&d, c);
+			if (!c->closed && FD_ISSET(c->fd, &write_fds))
+				client_flush(c);
+		}
+		bcdl_perform(d.bcdl);
+		daemon_advance(&d);
+		daemon_reap(&d);
+		daemon_drop_clients(&d);
+	}
+
+	/* albums still in flight are cancelled, checkpoint lets them resume */
+	printf("Shutting down.\n");
+	while (d.queue)
+	{
+		job_t *job = d.queue;
+		d.queue = job->next;
+		job_free(job);
+	}
+	while (d.running)
+	{
+		job_t *job = d.running;
+		d.running = job->next;
+		job_free(job);
+	}
+	client_t *c;
+	for (c = d.clients; c; c = c->next)
+		c->closed = 1;
+	daemon_drop_clients(&d);
+	cli_cleanup(d.bcdl);
+	checkpoint_close(d.cp);
+	close(d.listen_fd);
+	unlink(path);
+	return 0;
+}
@@ -0,0 +1,400 @@
+#define _DEFAULT_SOURCE /* syscall, MAP_POPULATE */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <stdio.h> /* rename */
+#include <pthread.h>
+#include <sys/statvfs.h>
+#ifdef __linux__
+	#include <linux/version.h>
+	#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 11, 0) /* renameat */
+		#include <sys/mman.h>
+		#include <sys/syscall.h>
+		#include <linux/io_uring.h>
+		#define DISK_HAVE_URING
+	#endif
+#endif
+
+#include "disk.h"
+
+/*
+ *	disk.c
+ *	This file is part of bc-dl.
+ *	See bc-dl.c for copyright or LICENSE for license information.
+ */
+
+/* WRITING FILES OUT
+ * a file is written next to its final name, synced, then renamed over it,
+ * so a crash or full disk never leaves a truncated file under the real name
+ * with io_uring, opening is one submission, and the writes, fsync, close
+ * and rename follow as one linked batch, so each file costs two trips into
+ * the kernel however large it is, and the writer thread sleeps once per
+ * trip rather than once per call
+ * every writer thread has a ring of its own, made the first time it
+ * writes, so nothing is shared between them
+ * kernels without io_uring, or that refuse it (seccomp, containers),
+ * get the same steps as plain pwrite(), fsync() and rename() calls
+ * either way this runs on the writer pool, not on the download thread
+ */
+
+disk_backend_t DISK_BACKEND = DISK_AUTO;
+
+/* whether this process may use io_uring, found once */
+pthread_once_t DISK_PROBE_ONCE = PTHREAD_ONCE_INIT;
+int DISK_URING_USABLE = 0;
+
+#ifdef DISK_HAVE_URING
+
+#define DISK_RING_BROKEN 2
+
+/* each thread's ring, or DISK_NO_RING once making one failed */
+pthread_key_t DISK_RING_KEY;
+char DISK_NO_RING;
+
+void disk_ring_free(void *arg)
+{
+	disk_ring_t *ring = (disk_ring_t *) arg;
+	if (!ring || ring == (disk_ring_t *) &DISK_NO_RING)
+		return;
+	if (ring->sqes)
+		munmap(ring->sqes, ring->sqes_len);
+	if (ring->cq_map && ring->cq_map != ring->sq_map)
+		munmap(ring->cq_map, ring->cq_map_len);
+	if (ring->sq_map)
+		munmap(ring->sq_map, ring->sq_map_len);
+	close(ring->fd);
+	free(ring);
+}
+
+int disk_ring_probe(int fd)
+{
+	/* nonzero if the kernel knows every operation a file needs */
+	static const int needed[] = {
+		IORING_OP_OPENAT, IORING_OP_WRITE, IORING_OP_FSYNC,
+		IORING_OP_CLOSE, IORING_OP_RENAMEAT
+	};
+	size_t size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+	struct io_uring_probe *probe = (struct io_uring_probe *) calloc(1, size);
+	int ok = !syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, 256);
+	unsigned i;
+	for (i = 0; ok && i < sizeof(needed) / sizeof(needed[0]); i++)
+		ok = needed[i] <= probe->last_op && (probe->ops[needed[i]].flags & IO_URING_OP_SUPPORTED);
+	free(probe);
+	return ok;
+}
+
+disk_ring_t *disk_ring_init(void)
+{
+	/* returns NULL if io_uring can't be used */
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	int fd = (int) syscall(__NR_io_uring_setup, DISK_RING_ENTRIES, &params);
+	if (fd < 0)
+		return NULL;
+	disk_ring_t *ring = (disk_ring_t *) calloc(1, sizeof(disk_ring_t));
+	ring->fd = fd;
+	if (!disk_ring_probe(fd))
+	{
+		disk_ring_free(ring);
+		return NULL;
+	}
+	ring->sq_map_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	ring->cq_map_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	ring->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+	int single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+	if (single && ring->cq_map_len > ring->sq_map_len)
+		ring->sq_map_len = ring->cq_map_len;
+	ring->sq_map = mmap(NULL, ring->sq_map_len, PROT_READ | PROT_WRITE,
+	                    MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if (ring->sq_map == MAP_FAILED)
+	{
+		ring->sq_map = NULL;
+		disk_ring_free(ring);
+		return NULL;
+	}
+	ring->cq_map = single ? ring->sq_map :
+	               mmap(NULL, ring->cq_map_len, PROT_READ | PROT_WRITE,
+	                    MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+	void *sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE,
+	                  MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	ring->sqes = (sqes == MAP_FAILED) ? NULL : (struct io_uring_sqe *) sqes;
+	if (ring->cq_map == MAP_FAILED || !ring->sqes)
+	{
+		if (ring->cq_map == MAP_FAILED)
+			ring->cq_map = NULL;
+		disk_ring_free(ring);
+		return NULL;
+	}
+	char *sq = (char *) ring->sq_map, *cq = (char *) ring->cq_map;
+	ring->sq_head = (unsigned *) (sq + params.sq_off.head);
+	ring->sq_tail = (unsigned *) (sq + params.sq_off.tail);
+	ring->sq_mask = (unsigned *) (sq + params.sq_off.ring_mask);
+	ring->sq_array = (unsigned *) (sq + params.sq_off.array);
+	ring->cq_head = (unsigned *) (cq + params.cq_off.head);
+	ring->cq_tail = (unsigned *) (cq + params.cq_off.tail);
+	ring->cq_mask = (unsigned *) (cq + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+	ring->tail = *ring->sq_tail;
+	return ring;
+}
+
+void disk_probe(void)
+{
+	pthread_key_create(&DISK_RING_KEY, disk_ring_free);
+	disk_ring_t *ring = disk_ring_init();
+	DISK_URING_USABLE = (ring != NULL);
+	disk_ring_free(ring);
+}
+
+disk_ring_t *disk_thread_ring(void)
+{
+	/* calling thread's ring, NULL if it has none */
+	disk_ring_t *ring = (disk_ring_t *) pthread_getspecific(DISK_RING_KEY);
+	if (ring == (disk_ring_t *) &DISK_NO_RING)
+		return NULL;
+	if (!ring)
+	{
+		ring = disk_ring_init();
+		pthread_setspecific(DISK_RING_KEY, ring ? (void *) ring : (void *) &DISK_NO_RING);
+	}
+	return ring;
+}
+
+struct io_uring_sqe *disk_ring_get(disk_ring_t *ring, unsigned char opcode, int fd, uint64_t user_data)
+{
+	/* next free submission entry, cleared */
+	struct io_uring_sqe *sqe = &ring->sqes[ring->tail & *ring->sq_mask];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = opcode;
+	sqe->fd = fd;
+	sqe->user_data = user_data;
+	ring->sq_array[ring->tail & *ring->sq_mask] = ring->tail & *ring->sq_mask;
+	ring->tail++;
+	ring->queued++;
+	return sqe;
+}
+
+int disk_ring_submit(disk_ring_t *ring, int *results)
+{
+	/* submit everything queued and wait for all of it
+	 * results[user_data] gets each entry's result
+	 * returns nonzero if the ring itself failed
+	 */
+	unsigned count = ring->queued, seen = 0, submitted = 0;
+	ring->queued = 0;
+	__atomic_store_n(ring->sq_tail, ring->tail, __ATOMIC_RELEASE);
+	while (seen < count)
+	{
+		unsigned head = *ring->cq_head;
+		unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+		for (; head != tail; head++)
+		{
+			struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+			results[cqe->user_data] = cqe->res;
+			seen++;
+		}
+		__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+		if (seen >= count)
+			break;
+		long entered = syscall(__NR_io_uring_enter, ring->fd, count - submitted,
+		                       count - seen, IORING_ENTER_GETEVENTS, NULL, 0);
+		if (entered < 0 && errno != EINTR)
+			return -1;
+		if (entered > 0)
+			submitted += (unsigned) entered;
+	}
+	return 0;
+}
+
+int disk_write_uring(disk_ring_t *ring, const char *filename, const char *part,
+                     const char *head, size_t head_len, const char *body, size_t body_len)
+{
+	/* returns 0 on success, nonzero if any step failed, with nothing
+	 * left behind, DISK_RING_BROKEN if the ring can't be used again
+	 */
+	int results[DISK_RING_ENTRIES];
+	struct io_uring_sqe *sqe = disk_ring_get(ring, IORING_OP_OPENAT, AT_FDCWD, 0);
+	sqe->addr = (uint64_t) (uintptr_t) part;
+	sqe->open_flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+	sqe->len = 0666;
+	if (disk_ring_submit(ring, results))
+		return DISK_RING_BROKEN;
+	if (results[0] < 0)
+		return -1;
+	int fd = results[0];
+
+	/* writes, each at most DISK_MAX_WRITE, fsync, close and rename, linked
+	 * so a short or failed write cancels the rest
+	 */
+	const char *parts[2];
+	size_t lengths[2];
+	parts[0] = head;
+	lengths[0] = head_len;
+	parts[1] = body;
+	lengths[1] = body_len;
+	size_t expected[DISK_RING_ENTRIES];
+	size_t offset = 0;
+	unsigned n = 0, i;
+	for (i = 0; i < 2; i++)
+	{
+		size_t done;
+		for (done = 0; done < lengths[i];)
+		{
+			size_t len = lengths[i] - done;
+			if (len > DISK_MAX_WRITE)
+				len = DISK_MAX_WRITE;
+			sqe = disk_ring_get(ring, IORING_OP_WRITE, fd, n);
+			sqe->addr = (uint64_t) (uintptr_t) (parts[i] + done);
+			sqe->len = (unsigned) len;
+			sqe->off = offset;
+			sqe->flags = IOSQE_IO_LINK;
+			expected[n++] = len;
+			done += len;
+			offset += len;
+		}
+	}
+	unsigned sync = n++, shut = n++, moved = n++;
+	sqe = disk_ring_get(ring, IORING_OP_FSYNC, fd, sync);
+	sqe->flags = IOSQE_IO_LINK;
+	sqe = disk_ring_get(ring, IORING_OP_CLOSE, fd, shut);
+	sqe->flags = IOSQE_IO_LINK;
+	sqe = disk_ring_get(ring, IORING_OP_RENAMEAT, AT_FDCWD, moved);
+	sqe->addr = (uint64_t) (uintptr_t) part;
+	sqe->len = (unsigned) AT_FDCWD;
+	sqe->addr2 = (uint64_t) (uintptr_t) filename;
+	if (disk_ring_submit(ring, results))
+	{
+		close(fd);
+		unlink(part);
+		return DISK_RING_BROKEN;
+	}
+	int err = 0;
+	for (i = 0; i < sync; i++)
+		err |= results[i] < 0 || (size_t) results[i] != expected[i];
+	err |= results[sync] != 0;
+	if (results[shut] != 0)
+		err |= close(fd) != 0; /* cancelled, still open */
+	if (results[moved] != 0)
+	{
+		unlink(part);
+		err = 1;
+	}
+	return err;
+}
+
+#else
+
+void disk_probe(void)
+{
+	DISK_URING_USABLE = 0;
+}
+
+#endif
+
+int disk_pwrite_all(int fd, const char *data, size_t len, size_t offset)
+{
+	/* returns 0 once everything is written */
+	while (len)
+	{
+		ssize_t written = pwrite(fd, data, len, (off_t) offset);
+		if (written < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		data += written;
+		offset += written;
+		len -= written;
+	}
+	return 0;
+}
+
+int disk_write_pwrite(const char *filename, const char *part,
+                      const char *head, size_t head_len, const char *body, size_t body_len)
+{
+	int fd = open(part, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+	if (fd < 0)
+		return -1;
+	int err = disk_pwrite_all(fd, head, head_len, 0) ||
+	          disk_pwrite_all(fd, body, body_len, head_len) ||
+	          fsync(fd);
+	err |= close(fd) != 0;
+	if (!err && rename(part, filename))
+		err = 1;
+	if (err)
+		unlink(part);
+	return err;
+}
+
+int disk_set_backend(disk_backend_t backend)
+{
+	/* applies to every thread in the process, set it before writing
+	 * returns nonzero if io_uring was asked for but can't be used,
+	 * pwrite() is used instead
+	 */
+	pthread_once(&DISK_PROBE_ONCE, disk_probe);
+	DISK_BACKEND = backend;
+	if (backend == DISK_URING && !DISK_URING_USABLE)
+	{
+		DISK_BACKEND = DISK_PWRITE;
+		return -1;
+	}
+	return 0;
+}
+
+int disk_free(const char *path, unsigned long long *bytes)
+{
+	/* space an unprivileged user may still fill on path's filesystem
+	 * returns nonzero if it can't be told
+	 */
+	struct statvfs fs;
+	if (statvfs(path, &fs))
+		return -1;
+	*bytes = (unsigned long long) fs.f_bavail * fs.f_frsize;
+	return 0;
+}
+
+disk_backend_t disk_backend(void)
+{
+	/* the backend actually used, never DISK_AUTO */
+	pthread_once(&DISK_PROBE_ONCE, disk_probe);
+	if (DISK_BACKEND == DISK_PWRITE || !DISK_URING_USABLE)
+		return DISK_PWRITE;
+	return DISK_URING;
+}
+
+int disk_write(const char *filename, const char *head, size_t head_len,
+               const char *body, size_t body_len)
+{
+	/* write head then body out as filename, replacing any file there
+	 * returns 0 on success
+	 */
+	char *part = (char *) malloc(strlen(filename) + strlen(DISK_PART_SUFFIX) + 1);
+	strcpy(part, filename);
+	strcat(part, DISK_PART_SUFFIX);
+	int err = 1;
+	#ifdef DISK_HAVE_URING
+	{
+		disk_ring_t *ring = (disk_backend() == DISK_URING) ? disk_thread_ring() : NULL;
+		/* a file too large for one batch, or one the ring failed on,
+		 * gets another go without it
+		 */
+		if (ring && head_len / DISK_MAX_WRITE + body_len / DISK_MAX_WRITE + 6 <= DISK_RING_ENTRIES)
+			err = disk_write_uring(ring, filename, part, head, head_len, body, body_len);
+		if (err == DISK_RING_BROKEN) /* this thread carries on without one */
+		{
+			pthread_setspecific(DISK_RING_KEY, (void *) &DISK_NO_RING);
+			disk_ring_free(ring);
+		}
+	}
+	#endif
+	if (err)
+		err = disk_write_pwrite(filename, part, head, head_len, body, body_len);
+	free(part);
+	return err;
+}
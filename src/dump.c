@@ -0,0 +1,222 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "error.h"
+#include "bcdl.h"
+#include "membuf.h"
+#include "parse.h"
+#include "utilities.h"
+#include "checkpoint.h"
+#include "interface.h"
+#include "cli.h"
+#include "dump.h"
+
+/*
+ *	dump.c
+ *	This file is part of bc-dl.
+ *	See bc-dl.c for copyright or LICENSE for license information.
+ */
+
+/* DUMP FORMAT
+ * one JSON object per album on stdout, in the order pages arrive
+ *     {"url":..., "artist":..., "album_artist":..., "title":...,
+ *      "release_date":..., "filetype":..., "art":...,
+ *      "tracks":[{"title":..., "stream":...}, ...]}
+ * or, if the album couldn't be fetched or parsed
+ *     {"url":..., "error":...}
+ * nothing is downloaded past the album page and nothing is written to disk
+ * up to DUMP_WINDOW pages are in flight at once, artist pages are
+ * expanded into their releases as they come up
+ */
+
+void dump_string(const char *str)
+{
+	/* JSON string, strings are UTF-8 already */
+	if (!str)
+	{
+		fputs("null", stdout);
+		return;
+	}
+	putchar('"');
+	for (; *str; str++)
+	{
+		unsigned char c = (unsigned char) *str;
+		if (c == '"' || c == '\\')
+		{
+			putchar('\\');
+			putchar(c);
+		}
+		else if (c < 0x20)
+			printf("\\u%04x", c);
+		else
+			putchar(c);
+	}
+	putchar('"');
+}
+
+void dump_field(const char *name, const char *value)
+{
+	printf(",\"%s\":", name);
+	dump_string(value);
+}
+
+void dump_album(bcdl_album_t *a)
+{
+	album_t *album = bcdl_album_data(a);
+	fputs("{\"url\":", stdout);
+	dump_string(bcdl_album_url(a));
+	dump_field("artist", album->artist);
+	dump_field("album_artist", album->album_artist);
+	dump_field("title", album->album_title);
+	dump_field("release_date", album->release_date);
+	dump_field("filetype", album->filetype);
+	dump_field("art", album->url_album_art);
+	fputs(",\"tracks\":[", stdout);
+	unsigned i;
+	for (i = 0; i < album->track_count; i++)
+	{
+		fputs(i ? ",{\"title\":" : "{\"title\":", stdout);
+		dump_string(album->song_titles[i]);
+		dump_field("stream", album->stream_urls[i]);
+		putchar('}');
+	}
+	fputs("]}\n", stdout);
+}
+
+void dump_error(const char *url, ferror_t err)
+{
+	fputs("{\"url\":", stdout);
+	dump_string(url);
+	dump_field("error", error_string(err));
+	fputs("}\n", stdout);
+}
+
+const char *dump_next_url(dump_t *d, int *release)
+{
+	/* releases of the last artist page come before the rest of the list
+	 * release is set for those, they're albums whatever their URL looks like
+	 */
+	const char *url = d->single;
+	*release = 0;
+	if (url)
+	{
+		d->single = NULL;
+		return url;
+	}
+	if (d->next_pending < d->pending_count)
+	{
+		*release = 1;
+		return d->pending[d->next_pending++];
+	}
+	if (d->pending)
+	{
+		free_discography(d->pending, d->pending_count);
+		d->pending = NULL;
+		d->pending_count = d->next_pending = 0;
+	}
+	return d->reader ? url_reader_next(d->reader) : NULL;
+}
+
+void dump_expand(dump_t *d, const char *url)
+{
+	/* artist page is fetched on its own, releases are queued as pending */
+	ferror_t err;
+	membuf_t *html = bcdl_fetch_page(d->bcdl, url, &err);
+	if (!html)
+	{
+		dump_error(url, err);
+		d->failed++;
+		return;
+	}
+	if (page_is_album(html)) /* artist has a single release */
+	{
+		d->pending = (char **) malloc(sizeof(char *));
+		d->pending[0] = create_string(url);
+		d->pending_count = 1;
+	}
+	else
+		d->pending = parse_discography(html, url, &d->pending_count);
+	d->next_pending = 0;
+	membuf_free(html);
+}
+
+void dump_fill(dump_t *d)
+{
+	/* keep window full of album pages in flight */
+	const char *url;
+	int release;
+	while (d->open < DUMP_WINDOW && (url = dump_next_url(d, &release)))
+	{
+		/* a single release is pending under its artist's root URL */
+		switch (release ? URL_ALBUM : URL_type(url))
+		{
+			case URL_ALBUM:
+				d->window[d->open++] = bcdl_album_open(d->bcdl, url, BCDL_DEFER | BCDL_NO_PLAN, NULL, NULL);
+				break;
+			case URL_DISCOGRAPHY:
+				dump_expand(d, url);
+				break;
+			default:
+				dump_error(url, ERROR_INVALID_URL);
+				d->failed++;
+		}
+	}
+}
+
+void dump_reap(dump_t *d)
+{
+	/* print and close albums that are parsed or failed */
+	unsigned i = 0;
+	while (i < d->open)
+	{
+		bcdl_album_t *a = d->window[i];
+		bcdl_state_t state = bcdl_album_state(a);
+		if (state == BCDL_FETCH_PAGE)
+		{
+			i++;
+			continue;
+		}
+		if (state == BCDL_FAILED)
+		{
+			dump_error(bcdl_album_url(a), bcdl_album_error(a));
+			d->failed++;
+		}
+		else
+			dump_album(a);
+		bcdl_album_close(a);
+		d->window[i] = d->window[--d->open];
+	}
+}
+
+int dump_run(const char *source)
+{
+	/* source is an album or artist URL, or a list of them
+	 * returns nonzero if any album couldn't be dumped
+	 */
+	dump_t d;
+	memset(&d, 0, sizeof(d));
+	if (URL_is_valid(source))
+		d.single = source;
+	else if (!(d.reader = url_reader_open(source)))
+	{
+		perror("[!] Could not open file");
+		return 1;
+	}
+	d.bcdl = cli_init();
+	for (;;)
+	{
+		apply_signals();
+		dump_fill(&d);
+		if (!d.open)
+			break;
+		bcdl_perform(d.bcdl);
+		dump_reap(&d);
+		if (d.open)
+			bcdl_wait(d.bcdl, 1000);
+	}
+	bcdl_cleanup(d.bcdl);
+	if (d.reader)
+		url_reader_close(d.reader);
+	return d.failed ? 1 : 0;
+}
@@ -0,0 +1,28 @@
+#include "error.h"
+
+/*
+ *	error.c
+ *	This file is part of bc-dl.
+ *	See bc-dl.c for copyright or LICENSE for license information.
+ */
+
+/* struct initializer order must match enum definition order by design */
+
+/* PROGRAM ERROR DESCRIPTIONS */
+
+const struct _error ERROR_INDEX[NUMBER_OF_ERRORS] = {
+	{.err = ERROR_INVALID_URL, .desc = "URL is invalid." },
+	{.err = ERROR_CONNECTION, .desc = "Connection error." },
+	{.err = ERROR_JSON, .desc = "JSON inconsistency error. Webpage layout might have changed. If this persists, contact maintainer." },
+	{.err = ERROR_FILE_IO, .desc = "Cannot write to disk." },
+	{.err = ERROR_MEM_IO, .desc = "Cannot expand memory buffer. Out of memory." },
+	{.err = ERROR_STREAM, .desc = "Downloaded track is not a complete MP3 stream." },
+	{.err = ERROR_DISK_SPACE, .desc = "Not enough free disk space for this album." }
+};
+
+const char *error_string(ferror_t err)
+{
+	if (err == EVERYTHING_IS_FINE)
+		return "No error.";
+	return ERROR_INDEX[err].desc;
+}
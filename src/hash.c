@@ -0,0 +1,155 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "hash.h"
+
+/*
+ *	hash.c
+ *	This file is part of bc-dl.
+ *	See bc-dl.c for copyright or LICENSE for license information.
+ */
+
+/* XXH64
+ * non-cryptographic, fast enough to keep up with any download,
+ * used to recognize identical audio, not to authenticate it
+ * see https://github.com/Cyan4973/xxHash/blob/dev/doc/xxhash_spec.md
+ */
+
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PRIME64_5 0x27D4EB2F165667C5ULL
+
+hash64_t hash_rotl(hash64_t x, unsigned r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+hash64_t hash_read64(const unsigned char *p)
+{
+	/* little endian, regardless of host */
+	hash64_t x = 0;
+	int i;
+	for (i = 7; i >= 0; i--)
+		x = (x << 8) | p[i];
+	return x;
+}
+
+hash64_t hash_read32(const unsigned char *p)
+{
+	return (hash64_t) p[0] | ((hash64_t) p[1] << 8) | ((hash64_t) p[2] << 16) | ((hash64_t) p[3] << 24);
+}
+
+hash64_t hash_round(hash64_t acc, hash64_t input)
+{
+	acc += input * PRIME64_2;
+	acc = hash_rotl(acc, 31);
+	return acc * PRIME64_1;
+}
+
+hash64_t hash_merge(hash64_t acc, hash64_t val)
+{
+	acc ^= hash_round(0, val);
+	return acc * PRIME64_1 + PRIME64_4;
+}
+
+void hash_stripe(hash_t *h, const unsigned char *p)
+{
+	/* consume 32 bytes */
+	unsigned i;
+	for (i = 0; i < 4; i++)
+		h->v[i] = hash_round(h->v[i], hash_read64(p + i * 8));
+}
+
+void hash_init(hash_t *h)
+{
+	/* seed is always 0 */
+	h->v[0] = PRIME64_1 + PRIME64_2;
+	h->v[1] = PRIME64_2;
+	h->v[2] = 0;
+	h->v[3] = -PRIME64_1;
+	h->buffered = 0;
+	h->total = 0;
+}
+
+void hash_update(hash_t *h, const void *data, size_t len)
+{
+	const unsigned char *p = (const unsigned char *) data;
+	h->total += len;
+	if (h->buffered) /* top up stripe left over from last call */
+	{
+		size_t n = 32 - h->buffered;
+		if (n > len)
+			n = len;
+		memcpy(h->buffer + h->buffered, p, n);
+		h->buffered += n;
+		p += n;
+		len -= n;
+		if (h->buffered < 32)
+			return;
+		hash_stripe(h, h->buffer);
+		h->buffered = 0;
+	}
+	for (; len >= 32; p += 32, len -= 32)
+		hash_stripe(h, p);
+	memcpy(h->buffer, p, len);
+	h->buffered = len;
+}
+
+hash64_t hash_digest(const hash_t *h)
+{
+	/* state is left as is, more input may follow */
+	hash64_t acc;
+	unsigned i;
+	if (h->total >= 32)
+	{
+		acc = hash_rotl(h->v[0], 1) + hash_rotl(h->v[1], 7) +
+		      hash_rotl(h->v[2], 12) + hash_rotl(h->v[3], 18);
+		for (i = 0; i < 4; i++)
+			acc = hash_merge(acc, h->v[i]);
+	}
+	else
+		acc = PRIME64_5;
+	acc += h->total;
+
+	const unsigned char *p = h->buffer;
+	const unsigned char *end = h->buffer + h->buffered;
+	for (; p + 8 <= end; p += 8)
+	{
+		acc ^= hash_round(0, hash_read64(p));
+		acc = hash_rotl(acc, 27) * PRIME64_1 + PRIME64_4;
+	}
+	if (p + 4 <= end)
+	{
+		acc ^= hash_read32(p) * PRIME64_1;
+		acc = hash_rotl(acc, 23) * PRIME64_2 + PRIME64_3;
+		p += 4;
+	}
+	for (; p < end; p++)
+	{
+		acc ^= *p * PRIME64_5;
+		acc = hash_rotl(acc, 11) * PRIME64_1;
+	}
+
+	/* avalanche */
+	acc ^= acc >> 33;
+	acc *= PRIME64_2;
+	acc ^= acc >> 29;
+	acc *= PRIME64_3;
+	acc ^= acc >> 32;
+	return acc;
+}
+
+void hash_hex(hash64_t digest, char *out)
+{
+	/* out must hold HASH_HEX_LENGTH + 1 bytes */
+	const char *digits = "0123456789abcdef";
+	int i;
+	for (i = HASH_HEX_LENGTH - 1; i >= 0; i--)
+	{
+		out[i] = digits[digest & 0xF];
+		digest >>= 4;
+	}
+	out[HASH_HEX_LENGTH] = '\0';
+}
@@ -0,0 +1,163 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "error.h"
+#include "membuf.h"
+#include "id3.h"
+
+/*
+ *	id3.c
+ *	This file is part of bc-dl.
+ *	See bc-dl.c for copyright or LICENSE for license information.
+ */
+
+/* ID3v2.4 SERIALIZER
+ * frame sizes are known before anything is written,
+ * so every tag is allocated exactly once, at its final size
+ *
+ * ID3v2/file identifier   "ID3"
+ * ID3v2 version           $04 00
+ * ID3v2 flags             %abcd0000
+ * ID3v2 size              4 * %0xxxxxxx
+ *
+ * Frame ID                $xx xx xx xx (four characters)
+ * Size                    4 * %0xxxxxxx
+ * Flags                   $xx xx
+ */
+
+/* SYNCSAFE INTEGERS
+ * 28-bit value across 4 bytes, 7 bits per byte, MSB of each byte is 0
+ * ID3v2.4 uses these for tag and frame sizes, ID3v2.3 for tag size only
+ */
+
+const unsigned SYNCSAFE_SHIFT[4] = { 21, 14, 7, 0 };
+
+unsigned long id3_syncsafe_decode(const void *start)
+{
+	const unsigned char *bytes = (const unsigned char *) start;
+	unsigned long value = 0;
+	unsigned i;
+	for (i = 0; i < 4; i++)
+		value |= (unsigned long) (bytes[i] & 0x7F) << SYNCSAFE_SHIFT[i];
+	return value;
+}
+
+void id3_syncsafe_encode(unsigned long value, void *start)
+{
+	/* overwrites all 4 bytes, values past 28 bits are truncated */
+	unsigned char *bytes = (unsigned char *) start;
+	unsigned i;
+	for (i = 0; i < 4; i++)
+		bytes[i] = (value >> SYNCSAFE_SHIFT[i]) & 0x7F;
+}
+
+size_t id3_tag_length(const char *data, size_t len)
+{
+	/* total length of the ID3v2.3 or ID3v2.4 tag at the start of data,
+	 * including header and footer, 0 if there is no tag
+	 */
+	const unsigned char *h = (const unsigned char *) data;
+	if (len < ID3_HEADER_LENGTH || memcmp(data, "ID3", 3))
+		return 0;
+	if (h[3] != 0x03 && h[3] != 0x04)
+		return 0;
+	if ((h[6] | h[7] | h[8] | h[9]) & 0x80) /* not a syncsafe size */
+		return 0;
+	size_t length = ID3_HEADER_LENGTH + id3_syncsafe_decode(data + ID3_HEADER_LEN_OFFSET);
+	if (h[3] == 0x04 && (h[5] & 0x10)) /* footer present */
+		length += ID3_HEADER_LENGTH;
+	return length;
+}
+
+unsigned long id3_be32(const void *start)
+{
+	const unsigned char *bytes = (const unsigned char *) start;
+	return ((unsigned long) bytes[0] << 24) | ((unsigned long) bytes[1] << 16) |
+	       ((unsigned long) bytes[2] << 8) | bytes[3];
+}
+
+const char *id3_find_frame(const char *tag, size_t len, const char *id, size_t *size)
+{
+	/* body of the first frame with this id in an ID3v2.3 or ID3v2.4 tag
+	 * NULL if there is no such frame
+	 * ID3v2.3 frame sizes are plain 32-bit integers, not syncsafe
+	 */
+	size_t end = id3_tag_length(tag, len);
+	if (end > len)
+		end = len;
+	if (!end)
+		return NULL;
+	int v4 = (tag[3] == 0x04);
+	size_t pos = ID3_HEADER_LENGTH;
+	if ((tag[5] & 0x40) && pos + 4 <= end) /* extended header */
+		pos += v4 ? id3_syncsafe_decode(tag + pos) : 4 + id3_be32(tag + pos);
+	while (pos + ID3_HEADER_LENGTH <= end && tag[pos]) /* stop at padding */
+	{
+		const char *frame = tag + pos;
+		size_t body = v4 ? id3_syncsafe_decode(frame + ID3_FRAME_LEN_OFFSET)
+		                 : id3_be32(frame + ID3_FRAME_LEN_OFFSET);
+		if (body > end - pos - ID3_HEADER_LENGTH)
+			return NULL;
+		if (!memcmp(frame, id, 4))
+		{
+			*size = body;
+			return frame + ID3_HEADER_LENGTH;
+		}
+		pos += ID3_HEADER_LENGTH + body;
+	}
+	return NULL;
+}
+
+void id3_add_field(payload_t *frame, const char *data, size_t len)
+{
+	frame->field[frame->fields].data = data;
+	frame->field[frame->fields].len = len;
+	frame->fields++;
+}
+
+size_t id3_frame_length(const payload_t *frame)
+{
+	/* includes frame header */
+	size_t len = ID3_HEADER_LENGTH;
+	unsigned i;
+	for (i = 0; i < frame->fields; i++)
+		len += frame->field[i].len;
+	return len;
+}
+
+membuf_t *id3_serialize(const payload_t *frames, unsigned count, size_t fit)
+{
+	/* serialize frames into one ID3v2.4 tag
+	 * padded out to exactly fit bytes if that's large enough to hold the tag,
+	 * otherwise padded by ID3_PADDING
+	 * returns NULL if tag can't be allocated
+	 */
+	size_t length = ID3_HEADER_LENGTH;
+	unsigned i, j;
+	for (i = 0; i < count; i++)
+		length += id3_frame_length(&frames[i]);
+	length = (fit >= length) ? fit : length + ID3_PADDING;
+
+	membuf_t *tag = membuf_alloc(length);
+	if (!tag)
+		return NULL;
+	char *pos = tag->memory;
+	memcpy(pos, "ID3\x04\x00\x00", 6);
+	id3_syncsafe_encode(length - ID3_HEADER_LENGTH, pos + ID3_HEADER_LEN_OFFSET);
+	pos += ID3_HEADER_LENGTH;
+	for (i = 0; i < count; i++)
+	{
+		memcpy(pos, frames[i].id, 4);
+		id3_syncsafe_encode(id3_frame_length(&frames[i]) - ID3_HEADER_LENGTH, pos + ID3_FRAME_LEN_OFFSET);
+		pos[8] = pos[9] = 0x00; /* flags */
+		pos += ID3_HEADER_LENGTH;
+		for (j = 0; j < frames[i].fields; j++)
+		{
+			memcpy(pos, frames[i].field[j].data, frames[i].field[j].len);
+			pos += frames[i].field[j].len;
+		}
+	}
+	memset(pos, 0x00, tag->memory + length - pos); /* padding */
+	return tag;
+}
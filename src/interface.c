@@ -1,13 +1,21 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h> /* mkdir */
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef __linux__
+	#include <sys/ioctl.h>
+	#include <linux/fs.h> /* FICLONE */
+#endif
 
-#include "interface.h"
-#include "cli.h"
 #include "utilities.h"
+#include "error.h"
 #include "membuf.h"
 #include "parse.h"
-#include "tag.h"
+#include "interface.h"
 
 /*
  *	interface.c
@@ -36,155 +44,215 @@ int unsafe_character(char c)
 	return ret;
 }
 
-void sanitize_filename(char *filename, enum _filename_mode mode)
+void sanitize_range(char *str, size_t len)
 {
 	/* replace all invalid filename chars with space */
-	/* if FOLDER_MODE, check all but the last char
-	   folders don't work when you take the / out */
-	unsigned len = strlen(filename);
-	unsigned i;
-	if (mode == FOLDER_MODE)
-		len -= 1;
-	for (i = 0; i < len - 1; i++)
+	size_t i;
+	for (i = 0; i < len; i++)
 	{
-		if (unsafe_character(filename[i]))
-			filename[i] = ' ';
+		if (unsafe_character(str[i]))
+			str[i] = ' ';
 	}
 }
 
-char *create_folder_name(album_t *ptr)
+void sanitize_filename(char *filename, enum _filename_mode mode)
 {
- 	#ifdef _WIN32
-		char dir = '\\';
-	#else
-		char dir = '/';
-	#endif
-
-	/* malloc string large enough for 'Artist - Album (20XX)/'
-	 * 8 bytes for formatting + null terminator
-	 */
-	char *str = (char *) malloc(sizeof(char) *
-	                            strlen(ptr->artist) +
-	                            strlen(ptr->album_title) +
-	                            strlen(ptr->release_date) + 8);
-	sprintf(str, "%s - %s (%s)%c", ptr->artist, ptr->album_title, ptr->release_date, dir);
-	return str;
+	/* if FOLDER_MODE, check all but the last char
+	   folders don't work when you take the / out */
+	unsigned len = strlen(filename);
+	if (mode == FOLDER_MODE)
+		len -= 1;
+	sanitize_range(filename, len - 1);
 }
 
 char *create_string(const char *str)
 {
 	/* create mutable string out of immutable string literal */
-	char *out = (char *) malloc(sizeof(char) * strlen(str) + 1);
-	sprintf(out, "%s", str);
+	size_t len = strlen(str) + 1;
+	char *out = (char *) malloc(len);
+	memcpy(out, str, len);
 	return out;
 }
 
 char *concat_strings(const char *str1, const char *str2)
 {
 	/* return concatenated string */
-	char *concat = (char *) malloc(sizeof(char) * strlen(str1) + strlen(str2) + 1);
-	sprintf(concat, "%s%s", str1, str2);
+	size_t len1 = strlen(str1), len2 = strlen(str2) + 1;
+	char *concat = (char *) malloc(len1 + len2);
+	memcpy(concat, str1, len1);
+	memcpy(concat + len1, str2, len2);
 	return concat;
 }
 
-char *enquote_string(const char *str)
+int create_folder(const char *folder)
 {
-	/* surround string with "quotation marks" */
-	char *enquote = (char *) malloc(sizeof(char) * strlen(str) + 3);
-	sprintf(enquote, "\"%s\"", str);
-	return enquote;
+	/* returns 0 if folder was created or already exists */
+	if (mkdir(folder, 0755) && errno != EEXIST)
+		return -1;
+	return 0;
 }
 
-int create_folder(const char *folder)
+/* PATH BUILDER
+ * paths are composed in one fixed buffer, each append checked against
+ * its size, then copied wherever they're kept, eg. an album's arena
+ * a path that doesn't fit couldn't be opened anyway
+ */
+
+void path_reset(path_t *path)
 {
-	/* folder string needs to be quoted */
-	char *quoted = enquote_string(folder);
-	char *cmd = concat_strings("mkdir ", quoted);
-	int err = system(cmd);
-	free(cmd); free(quoted);
-	if (!err)
-		printf("Folder '%s' created.\n", folder);
-	return err;
+	path->len = 0;
+	path->buf[0] = '\0';
 }
 
-char *create_track_filename(album_t *album, unsigned track)
+void path_truncate(path_t *path, size_t len)
 {
-	/* calloc string large enough for '01. Song Title.mp3'
-	 * 1 byte for leading zero if (track+1 > 10)
-	 * 4 more for formatting + null terminator
-	 */
-	char *filename = (char *) calloc(uintlen(track+1) +
-	                                 strlen(album->song_titles[track]) +
-	                                 strlen(album->filetype) + 5,
-	                                 sizeof(char));
-	if (track+1 < 10)
-		sprintf(filename, "0%u. %s.%s", track+1, album->song_titles[track], album->filetype);
-	else
-		sprintf(filename, "%u. %s.%s", track+1, album->song_titles[track], album->filetype);
-	return filename;
+	/* back to an earlier length, eg. just the folder */
+	if (len < path->len)
+	{
+		path->len = len;
+		path->buf[len] = '\0';
+	}
 }
 
-int file_exists(const char *filename)
+int path_add_n(path_t *path, const char *str, size_t len)
 {
-	FILE *file = fopen(filename, "r");
-	if (file)
+	/* returns nonzero and leaves path as it was if str doesn't fit */
+	if (len >= PATH_BUILDER_MAX - path->len)
+		return -1;
+	memcpy(path->buf + path->len, str, len);
+	path->len += len;
+	path->buf[path->len] = '\0';
+	return 0;
+}
+
+int path_add(path_t *path, const char *str)
+{
+	return path_add_n(path, str, strlen(str));
+}
+
+int path_add_uint(path_t *path, unsigned n, unsigned width)
+{
+	/* zero padded to width digits */
+	char digits[24];
+	unsigned len = 0, i;
+	do
 	{
-		fseek(file, 0, SEEK_END);
-		long len = ftell(file);
-		fclose(file);
-		if (len > 0) /* if non-empty */
-		{
-			printf("Skipped: '%s', file exists.\n", filename);
-			return len;
-		}
+		digits[len++] = (char) ('0' + n % 10);
+		n /= 10;
+	} while (n);
+	while (len < width && len < sizeof(digits))
+		digits[len++] = '0';
+	for (i = 0; i < len / 2; i++)
+	{
+		char c = digits[i];
+		digits[i] = digits[len - 1 - i];
+		digits[len - 1 - i] = c;
+	}
+	return path_add_n(path, digits, len);
+}
+
+int path_add_folder(path_t *path, album_t *ptr)
+{
+	/* 'Artist - Album (20XX)/', sanitized like sanitize_filename() in
+	 * FOLDER_MODE, returns nonzero if it doesn't fit
+	 */
+ 	#ifdef _WIN32
+		const char *dir = "\\";
+	#else
+		const char *dir = "/";
+	#endif
+	size_t start = path->len;
+	if (path_add(path, ptr->artist) || path_add(path, " - ") ||
+	    path_add(path, ptr->album_title) || path_add(path, " (") ||
+	    path_add(path, ptr->release_date) || path_add(path, ")") ||
+	    path_add(path, dir))
+	{
+		path_truncate(path, start);
+		return -1;
 	}
+	if (path->len - start >= 2)
+		sanitize_range(path->buf + start, path->len - start - 2);
 	return 0;
 }
 
-void download_album_at_URL(const char *url)
+int path_add_track(path_t *path, album_t *album, unsigned track)
 {
-	/* files are cached in membuf before being written to disk
-	 * filenames are stored with the membuf struct by design
+	/* '01. Song Title.mp3', sanitized like sanitize_filename() in
+	 * FILE_MODE, returns nonzero if it doesn't fit
 	 */
+	size_t start = path->len;
+	if (path_add_uint(path, track+1, 2) || path_add(path, ". ") ||
+	    path_add(path, album->song_titles[track]) || path_add(path, ".") ||
+	    path_add(path, album->filetype))
+	{
+		path_truncate(path, start);
+		return -1;
+	}
+	sanitize_range(path->buf + start, path->len - start - 1);
+	return 0;
+}
 
-	/* get album details */
-	char *html_obj_name = create_string("album.html");
-	membuf_t *html = membuf_download(url, html_obj_name);
-	album_t *album = parse_album_data(html);
- 	membuf_free(html);
-
-	/* create folder */
-	char *folder_name = create_folder_name(album);
-	sanitize_filename(folder_name, FOLDER_MODE);
-	create_folder(folder_name); /* collisions handled by shell */
-
-	/* get cover art */
-	char *art_filename = concat_strings(folder_name, "album.jpg");
-	membuf_t *art = membuf_download(album->url_album_art, art_filename);
-	if (!file_exists(art->filename))
-		membuf_commit_to_disk(art);
-	display_album_data(album);
-
-	unsigned i;
-	for (i = 0; i < album->track_count; i++)
+int link_file(const char *from, const char *to, int reflink)
+{
+	/* make to share storage with from, to must not exist yet
+	 * hard link, or reflink cloning extents copy-on-write where supported
+	 * returns 0 on success
+	 */
+	if (!reflink)
+		return link(from, to);
+	#ifdef FICLONE
 	{
-		char *filename = create_track_filename(album, i);
-		sanitize_filename(filename, FILE_MODE);
-		char *output_filename = concat_strings(folder_name, filename);
-		progress_indicator("Track", i+1, album->track_count, filename);
-		free(filename);
-		if (!file_exists(output_filename))
+		int src = open(from, O_RDONLY);
+		if (src < 0)
+			return -1;
+		int dst = open(to, O_WRONLY | O_CREAT | O_EXCL, 0644);
+		if (dst < 0)
 		{
-			membuf_t *track = membuf_download(album->stream_urls[i], output_filename);
-			track = write_id3_tags(track, art, album, i);
-			membuf_commit_to_disk(track);
-			membuf_free(track);
+			close(src);
+			return -1;
 		}
-		else
-			free(output_filename);
+		int err = ioctl(dst, FICLONE, src);
+		close(src);
+		if (close(dst))
+			err = -1;
+		if (err)
+			remove(to);
+		return err ? -1 : 0;
 	}
-	membuf_free(art);
-	free(folder_name);
-	free_album_data(album);
-	printf("Completed.\n");
+	#endif
+	return -1;
+}
+
+int file_begins_with(const char *filename, const char *data, size_t len, size_t size)
+{
+	/* nonzero if file is size bytes long and its first len are data */
+	FILE *file = fopen(filename, "rb");
+	if (!file)
+		return 0;
+	int same = !fseek(file, 0, SEEK_END) && ftell(file) == (long) size && !fseek(file, 0, SEEK_SET);
+	char buf[4096];
+	while (same && len)
+	{
+		size_t n = (len < sizeof(buf)) ? len : sizeof(buf);
+		same = fread(buf, 1, n, file) == n && !memcmp(buf, data, n);
+		data += n;
+		len -= n;
+	}
+	fclose(file);
+	return same;
+}
+
+long file_exists(const char *filename)
+{
+	/* returns length of file if it exists and is non-empty */
+	FILE *file = fopen(filename, "r");
+	if (file)
+	{
+		fseek(file, 0, SEEK_END);
+		long len = ftell(file);
+		fclose(file);
+		if (len > 0) /* if non-empty */
+			return len;
+	}
+	return 0;
 }
@@ -0,0 +1,208 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hash.h"
+#include "manifest.h"
+
+/*
+ *	manifest.c
+ *	This file is part of bc-dl.
+ *	See bc-dl.c for copyright or LICENSE for license information.
+ */
+
+/* MANIFEST FORMAT
+ * one record per track written, appended as tracks are committed
+ * HASH <tab> PATH <newline>
+ *
+ * HASH is the XXH64 of the track's audio frames in hex, tags left out,
+ * so copies of the same audio share a hash however they're tagged
+ * when a hash is listed more than once, the last record wins
+ * a record cut short by a crash has no newline and is ignored on reload
+ */
+
+char *manifest_strdup(const char *str)
+{
+	char *out = (char *) malloc(sizeof(char) * (strlen(str) + 1));
+	strcpy(out, str);
+	return out;
+}
+
+struct _manifest_entry *manifest_find(manifest_t *m, hash64_t hash)
+{
+	struct _manifest_entry *entry = m->buckets[hash % m->bucket_count];
+	while (entry && entry->hash != hash)
+		entry = entry->next;
+	return entry;
+}
+
+void manifest_grow(manifest_t *m)
+{
+	/* double bucket count, rehash every entry */
+	unsigned new_count = m->bucket_count * 2;
+	struct _manifest_entry **new_buckets =
+		(struct _manifest_entry **) calloc(new_count, sizeof(struct _manifest_entry *));
+	unsigned i;
+	for (i = 0; i < m->bucket_count; i++)
+	{
+		struct _manifest_entry *entry = m->buckets[i];
+		while (entry)
+		{
+			struct _manifest_entry *next = entry->next;
+			unsigned long slot = entry->hash % new_count;
+			entry->next = new_buckets[slot];
+			new_buckets[slot] = entry;
+			entry = next;
+		}
+	}
+	free(m->buckets);
+	m->buckets = new_buckets;
+	m->bucket_count = new_count;
+}
+
+void manifest_update(manifest_t *m, hash64_t hash, const char *path)
+{
+	/* update in-memory state only */
+	struct _manifest_entry *entry = manifest_find(m, hash);
+	if (!entry)
+	{
+		if (m->entries >= m->bucket_count * 2)
+			manifest_grow(m);
+		unsigned long slot = hash % m->bucket_count;
+		entry = (struct _manifest_entry *) malloc(sizeof(struct _manifest_entry));
+		entry->hash = hash;
+		entry->path = NULL;
+		entry->next = m->buckets[slot];
+		m->buckets[slot] = entry;
+		m->entries++;
+	}
+	free(entry->path);
+	entry->path = manifest_strdup(path);
+}
+
+int manifest_parse_hash(const char *str, hash64_t *hash)
+{
+	/* returns 0 if str is exactly HASH_HEX_LENGTH hex digits */
+	hash64_t out = 0;
+	unsigned i;
+	for (i = 0; i < HASH_HEX_LENGTH; i++)
+	{
+		const char *digit = strchr("0123456789abcdef", str[i]);
+		if (!str[i] || !digit)
+			return -1;
+		out = (out << 4) | (hash64_t) (digit - "0123456789abcdef");
+	}
+	if (str[i])
+		return -1;
+	*hash = out;
+	return 0;
+}
+
+char *manifest_read_line(FILE *fp, char **line, size_t *capacity)
+{
+	/* read one complete line, growing buffer as needed
+	 * returns NULL at EOF or on a truncated final line
+	 */
+	size_t len = 0;
+	while (fgets(*line + len, *capacity - len, fp))
+	{
+		len += strlen(*line + len);
+		if ((*line)[len - 1] == '\n')
+		{
+			(*line)[len - 1] = '\0';
+			return *line;
+		}
+		*capacity *= 2;
+		*line = (char *) realloc(*line, *capacity);
+	}
+	return NULL;
+}
+
+void manifest_load(manifest_t *m, FILE *fp)
+{
+	size_t capacity = 512;
+	char *line = (char *) malloc(sizeof(char) * capacity);
+	while (manifest_read_line(fp, &line, &capacity))
+	{
+		char *path = strchr(line, '\t');
+		hash64_t hash;
+		if (!path) /* malformed */
+			continue;
+		*path++ = '\0';
+		if (!manifest_parse_hash(line, &hash))
+			manifest_update(m, hash, path);
+	}
+	free(line);
+}
+
+void manifest_free_entries(manifest_t *m)
+{
+	unsigned i;
+	for (i = 0; i < m->bucket_count; i++)
+	{
+		struct _manifest_entry *entry = m->buckets[i];
+		while (entry)
+		{
+			struct _manifest_entry *next = entry->next;
+			free(entry->path);
+			free(entry);
+			entry = next;
+		}
+	}
+	free(m->buckets);
+}
+
+manifest_t *manifest_open(const char *filename)
+{
+	/* load previous runs, then reopen manifest for appending
+	 * returns NULL if manifest can't be opened
+	 */
+	manifest_t *m = (manifest_t *) malloc(sizeof(manifest_t));
+	m->bucket_count = MANIFEST_BUCKETS;
+	m->buckets = (struct _manifest_entry **) calloc(m->bucket_count, sizeof(struct _manifest_entry *));
+	m->entries = 0;
+	int torn = 0;
+	FILE *prev = fopen(filename, "r");
+	if (prev)
+	{
+		manifest_load(m, prev);
+		if (!fseek(prev, -1, SEEK_END)) /* non-empty */
+			torn = (getc(prev) != '\n');
+		fclose(prev);
+	}
+	m->log = fopen(filename, "a");
+	if (!m->log)
+	{
+		manifest_free_entries(m);
+		free(m);
+		return NULL;
+	}
+	if (torn) /* keep new records off the end of a truncated one */
+		fputc('\n', m->log);
+	return m;
+}
+
+const char *manifest_lookup(manifest_t *m, hash64_t hash)
+{
+	/* path of a track with this audio, NULL if none is known
+	 * file may have been moved or deleted since
+	 */
+	struct _manifest_entry *entry = manifest_find(m, hash);
+	return entry ? entry->path : NULL;
+}
+
+void manifest_record(manifest_t *m, hash64_t hash, const char *path)
+{
+	char hex[HASH_HEX_LENGTH + 1];
+	hash_hex(hash, hex);
+	manifest_update(m, hash, path);
+	fprintf(m->log, "%s\t%s\n", hex, path);
+	fflush(m->log);
+}
+
+void manifest_close(manifest_t *m)
+{
+	manifest_free_entries(m);
+	fclose(m->log);
+	free(m);
+}
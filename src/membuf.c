@@ -1,11 +1,18 @@
+#define _POSIX_C_SOURCE 200809L /* mkstemp, pwrite, posix_fallocate, pthreads */
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <pthread.h>
 #include <curl/curl.h> /* libcurl */
 
+#include "error.h"
 #include "membuf.h"
-#include "cli.h"
-#include "utilities.h"
+#include "disk.h"
+#include "bufpool.h"
 
 /*
  *	membuf.c
@@ -13,86 +20,352 @@
  *	See bc-dl.c for copyright or LICENSE for license information.
  */
 
+/* MEMORY BUDGET
+ * every byte held by a membuf is charged to one process-wide budget
+ * spillable buffers move to an unlinked temp file once they grow past
+ * the spill threshold, or once the budget runs out, and are mapped
+ * back into memory read-only-ish (private) when their transfer is done
+ * buffers may be tagged, written out and freed on worker threads, so
+ * charges to the budget are made under a lock
+ * buffers from the buffer pool are charged in full, whatever they hold
+ */
+
+pthread_mutex_t MEMBUF_BUDGET_LOCK = PTHREAD_MUTEX_INITIALIZER;
+
+struct _membuf_budget MEMBUF_BUDGET = {
+	.limit = MEMBUF_DEFAULT_BUDGET,
+	.spill_threshold = MEMBUF_DEFAULT_SPILL,
+	.used = 0,
+	.peak = 0,
+	.spills = 0
+};
+
+void membuf_set_budget(size_t limit, size_t spill_threshold)
+{
+	MEMBUF_BUDGET.limit = limit;
+	MEMBUF_BUDGET.spill_threshold = spill_threshold;
+}
+
+int membuf_budget_headroom(size_t size)
+{
+	/* nonzero if size more bytes fit in the budget */
+	pthread_mutex_lock(&MEMBUF_BUDGET_LOCK);
+	int fits = !MEMBUF_BUDGET.limit || MEMBUF_BUDGET.used + size <= MEMBUF_BUDGET.limit;
+	pthread_mutex_unlock(&MEMBUF_BUDGET_LOCK);
+	return fits;
+}
+
+void membuf_budget_stats(struct _membuf_budget *out)
+{
+	/* consistent copy of the budget and its counters */
+	pthread_mutex_lock(&MEMBUF_BUDGET_LOCK);
+	*out = MEMBUF_BUDGET;
+	pthread_mutex_unlock(&MEMBUF_BUDGET_LOCK);
+}
+
+size_t membuf_held(membuf_t *mem, size_t size)
+{
+	/* bytes charged for a buffer holding size bytes */
+	return mem->capacity ? mem->capacity : size;
+}
+
+void membuf_charge(membuf_t *mem)
+{
+	/* charge what the buffer holds now, see membuf_held() */
+	size_t held = membuf_held(mem, mem->size);
+	pthread_mutex_lock(&MEMBUF_BUDGET_LOCK);
+	MEMBUF_BUDGET.used -= mem->reserved;
+	MEMBUF_BUDGET.used += held;
+	if (MEMBUF_BUDGET.used > MEMBUF_BUDGET.peak)
+		MEMBUF_BUDGET.peak = MEMBUF_BUDGET.used;
+	pthread_mutex_unlock(&MEMBUF_BUDGET_LOCK);
+	mem->reserved = held;
+}
+
+void membuf_release(membuf_t *mem)
+{
+	pthread_mutex_lock(&MEMBUF_BUDGET_LOCK);
+	MEMBUF_BUDGET.used -= mem->reserved;
+	pthread_mutex_unlock(&MEMBUF_BUDGET_LOCK);
+	mem->reserved = 0;
+}
+
+size_t membuf_growth(membuf_t *mem, size_t len)
+{
+	/* more bytes charged once len more are written */
+	size_t need = mem->size + len + 1;
+	size_t capacity = (need > mem->capacity) ? bufpool_capacity(need) : mem->capacity;
+	size_t held = capacity ? capacity : mem->size + len;
+	return (held > mem->reserved) ? held - mem->reserved : 0;
+}
+
+void membuf_drop_memory(membuf_t *mem)
+{
+	/* buffer goes back to the pool, or to malloc */
+	if (mem->capacity)
+		bufpool_put(mem->memory, mem->capacity);
+	else
+		free(mem->memory);
+	mem->memory = NULL;
+	mem->capacity = 0;
+}
+
+int membuf_grow(membuf_t *mem, size_t need)
+{
+	/* room for need bytes, contents and terminator are kept
+	 * buffers large enough for the pool come from it, returns 0 on success
+	 */
+	if (need <= mem->capacity)
+		return 0;
+	size_t capacity = bufpool_capacity(need);
+	char *memory = capacity ? bufpool_get(capacity) : NULL;
+	if (!memory && mem->capacity) /* too large for the pool, or it couldn't map one */
+	{
+		memory = (char *) malloc(need);
+		capacity = 0; /* not the pool's to take back */
+	}
+	if (memory)
+	{
+		memcpy(memory, mem->memory, mem->size + 1);
+		membuf_drop_memory(mem);
+		mem->memory = memory;
+		mem->capacity = capacity;
+		return 0;
+	}
+	if (mem->capacity)
+		return -1;
+	memory = (char *) realloc(mem->memory, need);
+	if (!memory)
+		return -1;
+	mem->memory = memory;
+	return 0;
+}
+
+int membuf_write_fd(int fd, const char *data, size_t len)
+{
+	/* returns 0 once everything is written */
+	while (len)
+	{
+		ssize_t written = write(fd, data, len);
+		if (written < 0)
+			return -1;
+		data += written;
+		len -= written;
+	}
+	return 0;
+}
+
+int membuf_temp_file(void)
+{
+	/* unlinked temp file, gone once closed, -1 on failure */
+	const char *dir = getenv("TMPDIR");
+	if (!dir)
+		dir = "/tmp";
+	char *path = (char *) malloc(sizeof(char) * (strlen(dir) + 16));
+	sprintf(path, "%s/bc-dl.XXXXXX", dir);
+	int fd = mkstemp(path);
+	if (fd >= 0)
+		unlink(path);
+	free(path);
+	return fd;
+}
+
+int membuf_spill(membuf_t *mem)
+{
+	/* move contents to an unlinked temp file, returns 0 on success */
+	int fd = membuf_temp_file();
+	if (fd < 0)
+		return -1;
+	if (membuf_write_fd(fd, mem->memory, mem->size))
+	{
+		close(fd);
+		return -1;
+	}
+	membuf_drop_memory(mem);
+	membuf_release(mem);
+	mem->spill_fd = fd;
+	pthread_mutex_lock(&MEMBUF_BUDGET_LOCK);
+	MEMBUF_BUDGET.spills++;
+	pthread_mutex_unlock(&MEMBUF_BUDGET_LOCK);
+	return 0;
+}
+
 size_t membuf_write(void *ptr, size_t size, size_t nmemb, void *stream)
 {
-	/* simulate fwrite(), write to memory instead */
+	/* simulate fwrite(), write to memory instead
+	 * returns 0 if buffer cannot be expanded, libcurl treats this as an error
+	 */
 	size_t realsize = size * nmemb;
 	membuf_t *mem = (membuf_t *) stream;
-	mem->memory = realloc(mem->memory, mem->size + realsize + 1);
-	if (mem->memory == NULL)
+	if (mem->mapped) /* contents are final once mapped */
+		return 0;
+	if (mem->can_spill && mem->spill_fd < 0 &&
+	    (!membuf_budget_headroom(membuf_growth(mem, realsize)) ||
+	     (MEMBUF_BUDGET.spill_threshold && mem->size + realsize > MEMBUF_BUDGET.spill_threshold)))
+		membuf_spill(mem); /* stays in memory if this fails */
+	if (mem->spill_fd >= 0)
 	{
-		program_error(ERROR_MEM_IO);
-		abort();
+		if (membuf_write_fd(mem->spill_fd, (char *) ptr, realsize))
+			return 0;
+		mem->size += realsize;
+		return realsize;
 	}
+	if (membuf_grow(mem, mem->size + realsize + 1))
+		return 0;
 	memcpy(&mem->memory[mem->size], ptr, realsize);
 	mem->size += realsize;
 	mem->memory[mem->size] = 0;
-
-	static unsigned progress = 0;
-	if (progress++ == 5) /* flush stdout only sparingly */
-	{
-		animate_progress_bar(mem->size); /* progress bar */
-		progress = 0;
-	}
+	membuf_charge(mem);
 	return realsize;
 }
 
 membuf_t *membuf_init(void)
 {
-	membuf_t *out = (membuf_t *) malloc(sizeof(membuf_t));
+	membuf_t *out = (membuf_t *) calloc(1, sizeof(membuf_t));
 	out->memory = (char *) malloc(sizeof(char));
-	out->size = 0;
+	out->memory[0] = 0;
+	out->spill_fd = -1;
 	return out;
 }
 
-void membuf_free(membuf_t *ptr)
+membuf_t *membuf_alloc(size_t size)
 {
-	ptr->size = 0;
-	free(ptr->memory);
-	if (ptr->filename)
-		free(ptr->filename);
-	free(ptr);
+	/* membuf of exactly size bytes, for callers that know the size up front
+	 * contents are left uninitialized, returns NULL if out of memory
+	 */
+	membuf_t *out = membuf_init();
+	if (membuf_grow(out, size + 1))
+	{
+		membuf_free(out);
+		return NULL;
+	}
+	out->memory[size] = 0;
+	out->size = size;
+	membuf_charge(out);
+	return out;
+}
+
+void membuf_expect(membuf_t *mem, size_t size)
+{
+	/* size an empty buffer for size bytes up front, eg. from Content-Length,
+	 * so it's taken from the pool once rather than grown through each class
+	 * left alone unless the pool has a class for it and it fits the budget
+	 */
+	if (mem->size || mem->spill_fd >= 0 || !bufpool_capacity(size + 1) ||
+	    (mem->can_spill && MEMBUF_BUDGET.spill_threshold && size > MEMBUF_BUDGET.spill_threshold) ||
+	    !membuf_budget_headroom(bufpool_capacity(size + 1)))
+		return;
+	if (!membuf_grow(mem, size + 1))
+		membuf_charge(mem);
+}
+
+int membuf_reserve(membuf_t *mem, size_t size)
+{
+	/* turn an empty membuf into a temp file of size bytes, allocated up
+	 * front, to be filled out of order with membuf_write_at()
+	 * returns 0 on success
+	 */
+	if (mem->size || mem->spill_fd >= 0)
+		return -1;
+	int fd = membuf_temp_file();
+	if (fd < 0)
+		return -1;
+	if (posix_fallocate(fd, 0, size) && ftruncate(fd, size)) /* sparse if need be */
+	{
+		close(fd);
+		return -1;
+	}
+	lseek(fd, size, SEEK_SET); /* membuf_map() terminates at the end */
+	membuf_drop_memory(mem);
+	membuf_release(mem);
+	mem->spill_fd = fd;
+	mem->size = size;
+	return 0;
 }
 
-membuf_t *membuf_download(const char *url, char *filename)
+int membuf_write_at(membuf_t *mem, size_t offset, const char *data, size_t len)
 {
-	fflush(stdout);
-	CURL *dl_context = curl_easy_init();
-	membuf_t *membuf = membuf_init();
-	membuf->filename = filename;
-	if (dl_context)
+	/* write into a membuf_reserve()d file, returns 0 on success */
+	if (mem->spill_fd < 0 || mem->mapped || offset + len > mem->size)
+		return -1;
+	while (len)
 	{
-		curl_easy_setopt(dl_context, CURLOPT_URL, url);
- 		curl_easy_setopt(dl_context, CURLOPT_WRITEFUNCTION, membuf_write);
-		curl_easy_setopt(dl_context, CURLOPT_WRITEDATA, (void *) membuf);
-		curl_easy_setopt(dl_context, CURLOPT_FOLLOWLOCATION, 1); /* redirects */
-		CURLcode res = curl_easy_perform(dl_context); /* download */
-	 	curl_easy_cleanup(dl_context);
-		if (res != CURLE_OK) /* download error */
- 		{
- 			program_error(ERROR_CONNECTION);
-			abort();
- 		}
- 		else
- 			return membuf;
+		ssize_t written = pwrite(mem->spill_fd, data, len, (off_t) offset);
+		if (written < 0)
+			return -1;
+		data += written;
+		offset += written;
+		len -= written;
 	}
+	return 0;
+}
+
+int membuf_map(membuf_t *mem)
+{
+	/* make spilled contents addressable through mem->memory again
+	 * null terminated, same as buffers that never left memory
+	 * returns 0 on success
+	 */
+	if (mem->spill_fd < 0 || mem->mapped)
+		return 0;
+	if (membuf_write_fd(mem->spill_fd, "", 1))
+		return -1;
+	void *map = mmap(NULL, mem->size + 1, PROT_READ | PROT_WRITE, MAP_PRIVATE, mem->spill_fd, 0);
+	if (map == MAP_FAILED)
+		return -1;
+	mem->memory = (char *) map;
+	mem->mapped = 1;
+	return 0;
+}
+
+void membuf_free(membuf_t *ptr)
+{
+	if (ptr->mapped)
+		munmap(ptr->memory, ptr->size + 1);
 	else
-		return NULL;
+		membuf_drop_memory(ptr);
+	if (ptr->spill_fd >= 0)
+		close(ptr->spill_fd);
+	membuf_release(ptr);
+	if (ptr->header)
+		membuf_free(ptr->header);
+	if (ptr->filename && !ptr->borrowed)
+		free(ptr->filename);
+	free(ptr);
 }
 
-void membuf_commit_to_disk(membuf_t *ptr)
+membuf_t *membuf_load(const char *filename)
 {
-	animate_progress_bar(ptr->size);
-	printf("Writing to: '%s'...", ptr->filename);
-	fflush(stdout);
-	FILE *file = fopen(ptr->filename, "w+");
+	/* read whole file into a new membuf, NULL if it can't be read */
+	FILE *file = fopen(filename, "rb");
 	if (!file)
+		return NULL;
+	membuf_t *mem = membuf_init();
+	char chunk[BUFSIZ];
+	size_t len;
+	while ((len = fread(chunk, 1, sizeof(chunk), file)) > 0)
+	{
+		if (!membuf_write(chunk, len, 1, mem))
+			break;
+	}
+	if (ferror(file) || !feof(file))
 	{
-		program_error(ERROR_FILE_IO);
-		abort();
+		fclose(file);
+		membuf_free(mem);
+		return NULL;
 	}
-	fwrite(ptr->memory, ptr->size, 1, file);
-	fflush(file);
 	fclose(file);
-	printf("done.\n");
+	return mem;
+}
+
+ferror_t membuf_commit_to_disk(membuf_t *ptr)
+{
+	/* header, if any, goes in front of content
+	 * file appears under its name complete or not at all, see disk.c
+	 */
+	const char *head = ptr->header ? ptr->header->memory : NULL;
+	size_t head_len = ptr->header ? ptr->header->size : 0;
+	if (disk_write(ptr->filename, head, head_len, ptr->memory + ptr->offset, ptr->size - ptr->offset))
+		return ERROR_FILE_IO;
+	return EVERYTHING_IS_FINE;
 }
@@ -0,0 +1,245 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "error.h"
+#include "membuf.h"
+#include "id3.h"
+#include "hash.h"
+#include "mpeg.h"
+
+/*
+ *	mpeg.c
+ *	This file is part of bc-dl.
+ *	See bc-dl.c for copyright or LICENSE for license information.
+ */
+
+/* MPEG AUDIO FRAME WALKER
+ * checks a stream frame by frame as it arrives, without a second pass
+ * only the first few bytes of each frame are looked at, the rest is skipped
+ * a leading ID3v2 tag and a trailing ID3v1 tag are allowed
+ * so are APEv2 and Lyrics3 tags after the audio, they come in either
+ * order and Lyrics3v1 gives no length, so past the start of one
+ * nothing more is checked
+ * audio frames are hashed on the way through, so identical audio
+ * can be recognized whatever it's tagged with
+ *
+ * AAAAAAAA AAABBCCD EEEEFFGH IIJJKLMM
+ * A sync word      B version     C layer        D no CRC
+ * E bitrate index  F sample rate G padding      H private
+ * I channel mode   J mode ext.   K copyright    L original   M emphasis
+ */
+
+enum _mpeg_version { MPEG_25, MPEG_RESERVED, MPEG_2, MPEG_1 };
+enum _mpeg_layer { LAYER_RESERVED, LAYER_III, LAYER_II, LAYER_I };
+
+/* kbps, indexed by [MPEG_1 ? 0 : 1][layer][bitrate index], 0 is invalid */
+const unsigned MPEG_BITRATE[2][4][16] = {
+	{
+		{ 0 },
+		{ 0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 0 },
+		{ 0, 32, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384, 0 },
+		{ 0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448, 0 }
+	},
+	{
+		{ 0 },
+		{ 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160, 0 },
+		{ 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160, 0 },
+		{ 0, 32, 48, 56, 64, 80, 96, 112, 128, 144, 160, 176, 192, 224, 256, 0 }
+	}
+};
+
+/* Hz, indexed by [version][sample rate index] */
+const unsigned MPEG_SAMPLE_RATE[4][4] = {
+	{ 11025, 12000, 8000, 0 },
+	{ 0, 0, 0, 0 },
+	{ 22050, 24000, 16000, 0 },
+	{ 44100, 48000, 32000, 0 }
+};
+
+#define ID3V1_LENGTH 128
+#define APE_PREAMBLE "APETAGEX"
+#define LYRICS3_BEGIN "LYRICSBEGIN"
+
+void mpeg_init(mpeg_t *m)
+{
+	memset(m, 0, sizeof(mpeg_t));
+	m->need = 4;
+	m->status = MPEG_OK;
+	hash_init(&m->hash);
+}
+
+unsigned mpeg_side_info(const unsigned char *h)
+{
+	/* Layer III side info length, covered by CRC along with header */
+	int mono = (h[3] >> 6) == 3;
+	if (((h[1] >> 3) & 3) == MPEG_1)
+		return mono ? 17 : 32;
+	return mono ? 9 : 17;
+}
+
+int mpeg_crc_ok(const unsigned char *h, unsigned side)
+{
+	/* CRC-16, polynomial 0x8005, over last 2 header bytes and side info */
+	unsigned crc = 0xFFFF;
+	unsigned i, j;
+	for (i = 2; i < 6 + side; i++)
+	{
+		if (i == 4) /* skip stored CRC */
+			i = 6;
+		crc ^= h[i] << 8;
+		for (j = 0; j < 8; j++)
+			crc = (crc & 0x8000) ? ((crc << 1) ^ 0x8005) & 0xFFFF : (crc << 1) & 0xFFFF;
+	}
+	return crc == (unsigned) ((h[4] << 8) | h[5]);
+}
+
+size_t mpeg_frame_length(const unsigned char *h, unsigned *samples, unsigned *rate)
+{
+	/* returns 0 if this isn't a valid frame header */
+	if (h[0] != 0xFF || (h[1] & 0xE0) != 0xE0)
+		return 0;
+	unsigned version = (h[1] >> 3) & 3;
+	unsigned layer = (h[1] >> 1) & 3;
+	unsigned kbps = MPEG_BITRATE[version == MPEG_1 ? 0 : 1][layer][h[2] >> 4];
+	*rate = MPEG_SAMPLE_RATE[version][(h[2] >> 2) & 3];
+	unsigned padding = (h[2] >> 1) & 1;
+	if (version == MPEG_RESERVED || layer == LAYER_RESERVED || !kbps || !*rate)
+		return 0;
+	if (layer == LAYER_I)
+	{
+		*samples = 384;
+		return (12 * kbps * 1000 / *rate + padding) * 4;
+	}
+	if (layer == LAYER_III && version != MPEG_1)
+	{
+		*samples = 576;
+		return 72 * kbps * 1000 / *rate + padding;
+	}
+	*samples = 1152;
+	return 144 * kbps * 1000 / *rate + padding;
+}
+
+mstatus_t mpeg_head(mpeg_t *m)
+{
+	/* head holds as many bytes as it needs, check it and skip the rest */
+	const unsigned char *h = m->head;
+	if (m->position == m->have && !memcmp(h, "ID3", 3)) /* leading tag */
+	{
+		if (m->need < ID3_HEADER_LENGTH)
+		{
+			m->need = ID3_HEADER_LENGTH;
+			return MPEG_OK;
+		}
+		size_t length = id3_tag_length((const char *) h, m->have);
+		if (!length)
+			return MPEG_LOST_SYNC;
+		m->in_frame = 0;
+		m->skip = length - m->have;
+		m->have = 0;
+		m->need = 4;
+		return MPEG_OK;
+	}
+	const char *tag = !memcmp(h, APE_PREAMBLE, 4) ? APE_PREAMBLE :
+	                  !memcmp(h, LYRICS3_BEGIN, 4) ? LYRICS3_BEGIN : NULL;
+	if (tag && m->frames) /* trailing APEv2 or Lyrics3 tag */
+	{
+		if (m->need < strlen(tag))
+		{
+			m->need = strlen(tag);
+			return MPEG_OK;
+		}
+		if (memcmp(h, tag, m->need))
+			return MPEG_LOST_SYNC;
+		m->tail = 1;
+		m->have = 0;
+		return MPEG_OK;
+	}
+	if (!memcmp(h, "TAG", 3)) /* trailing ID3v1 tag */
+	{
+		m->trailer = 1;
+		m->in_frame = 0;
+		m->skip = ID3V1_LENGTH - m->have;
+		m->have = 0;
+		return MPEG_OK;
+	}
+	unsigned samples, rate;
+	size_t length = mpeg_frame_length(h, &samples, &rate);
+	if (!length || length < m->have)
+		return MPEG_LOST_SYNC;
+	int layer = (h[1] >> 1) & 3;
+	if (!(h[1] & 1) && layer == LAYER_III) /* CRC protected */
+	{
+		unsigned side = mpeg_side_info(h);
+		if (m->need < 6 + side)
+		{
+			m->need = 6 + side;
+			return length < m->need ? MPEG_LOST_SYNC : MPEG_OK;
+		}
+		if (!mpeg_crc_ok(h, side))
+			return MPEG_BAD_CRC;
+	}
+	m->frames++;
+	m->duration += (double) samples / rate;
+	m->in_frame = 1;
+	hash_update(&m->hash, h, m->have);
+	m->skip = length - m->have;
+	m->have = 0;
+	m->need = 4;
+	return MPEG_OK;
+}
+
+mstatus_t mpeg_feed(mpeg_t *m, const char *data, size_t len)
+{
+	/* walk the next chunk of the stream
+	 * once anything is wrong, the stream stays failed
+	 */
+	while (len && m->status == MPEG_OK)
+	{
+		if (m->skip)
+		{
+			size_t n = (m->skip < len) ? m->skip : len;
+			if (m->in_frame)
+				hash_update(&m->hash, data, n);
+			m->skip -= n;
+			m->position += n;
+			data += n;
+			len -= n;
+			continue;
+		}
+		if (m->tail)
+		{
+			m->position += len;
+			break;
+		}
+		if (m->trailer) /* nothing may follow ID3v1 */
+		{
+			m->status = MPEG_LOST_SYNC;
+			break;
+		}
+		while (len && m->have < m->need)
+		{
+			m->head[m->have++] = *data++;
+			m->position++;
+			len--;
+		}
+		if (m->have == m->need)
+			m->status = mpeg_head(m);
+	}
+	return m->status;
+}
+
+mstatus_t mpeg_finish(mpeg_t *m)
+{
+	/* end of stream, a frame cut short means a truncated download */
+	if (m->status == MPEG_OK && (m->skip || m->have))
+		m->status = MPEG_TRUNCATED;
+	if (m->status == MPEG_OK && !m->frames)
+		m->status = MPEG_EMPTY;
+	return m->status;
+}
+
+unsigned long mpeg_duration_ms(mpeg_t *m)
+{
+	return (unsigned long) (m->duration * 1000 + 0.5);
+}
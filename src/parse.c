@@ -2,9 +2,9 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "error.h"
 #include "membuf.h"
 #include "parse.h"
-#include "cli.h"
 
 /*
  *	parse.c
@@ -17,12 +17,15 @@ char *create_substring(const char *haystack, char *start, char *end)
 	/* determine range to copy by subracting ptrs between start and end strings
 	 * copy diff-offset bytes from haystack to new substring
 	 */
+	/* returns NULL if either string can't be found */
 	char *from, *to;
 	long diff;
 	long offset;
 
-	from = strstr(haystack, start);
-	to = strstr(from, end);
+	if (!haystack || !(from = strstr(haystack, start)))
+		return NULL;
+	if (!(to = strstr(from, end)))
+		return NULL;
 	diff = to - from;
 	offset = strlen(start);
 
@@ -41,6 +44,8 @@ unsigned count_occurances_of(char *haystack, char *keyword)
 	char *tmp = create_substring(start_of_data, "trackinfo", "var CurrencyData");
 	/* operates on the assumption that 'var CurrencyData will
 	   never be moved above the trackinfo block */
+	if (!tmp)
+		return 0;
 	char *tok = strtok(tmp, ":\",");
 	while (tok != NULL)
 	{
@@ -55,18 +60,28 @@ unsigned count_occurances_of(char *haystack, char *keyword)
 char **iterative_data_scraper(int iters, char *haystack, char *start, char *end)
 {
 	/* iterate over haystack, obtain data encapsulated between start + end strings
-	   return 2D char array containing scraped data */
-	char **char_array = (char **) malloc(sizeof(char *) * iters);
+	   return 2D char array containing scraped data, NULL if data runs out early */
 	const char *TRACK_INFO = "trackinfo : [{";
 	char *start_of_data = strstr(haystack, TRACK_INFO);
 	char *tmp = create_substring(start_of_data, "trackinfo", "var CurrencyData");
 	char *tmp_start = tmp; /* so the handle doesn't disappear in the heap */
 	/* operates on the assumption that 'var CurrencyData will
 	   never be moved above the trackinfo block */
+	if (!tmp)
+		return NULL;
+	char **char_array = (char **) malloc(sizeof(char *) * iters);
 	unsigned i;
 	for (i = 0; i < iters; i++)
 	{
 		char_array[i] = create_substring(tmp, start, end);
+		if (!char_array[i])
+		{
+			while (i--)
+				free(char_array[i]);
+			free(char_array);
+			free(tmp_start);
+			return NULL;
+		}
 		tmp = strstr(tmp, char_array[i]); /* advance ptr */
 		tmp += strlen(char_array[i]); /* skip forward */
 
@@ -181,15 +196,14 @@ album_t *scrub_unicode_literals(album_t *data)
 
 album_t *parse_album_data(membuf_t *ptr)
 {
-	/* parse JSON, scrape data into album container struct */
+	/* parse JSON, scrape data into album container struct
+	 * returns NULL if page layout isn't what we expect
+	 */
 	const char *JSON_START = "var BandData";
 	char *start_of_data = strstr(ptr->memory, JSON_START);
 	if (!start_of_data)
-	{
-		program_error(ERROR_JSON);
-		abort();
-	}
-	album_t *data = (album_t *) malloc(sizeof(album_t));
+		return NULL;
+	album_t *data = (album_t *) calloc(1, sizeof(album_t));
 
 	/* URL album art */
 	data->url_album_art = create_substring(start_of_data, "artFullsizeUrl: \"", "\",");
@@ -203,43 +217,54 @@ album_t *parse_album_data(membuf_t *ptr)
 	/* album artist */
 	data->album_artist = create_substring(start_of_data, "name: \"", "\",");
 
+	/* filetype */
+	data->filetype = create_substring(start_of_data, "track?enc=", "-128&");
+
+	if (!data->url_album_art || !data->album_title || !data->artist ||
+	    !data->album_artist || !data->filetype)
+		goto fail;
+
 	/* comment */
 	char *pt1 = "Visit ";
 	char *pt2 = create_substring(start_of_data, "linkback: \"", "\" + \"");
+	if (!pt2)
+		goto fail;
 	data->comment = (char *) malloc(sizeof(char) * strlen(pt1) + strlen(pt2) + 2);
 	sprintf(data->comment, "%s%s/", pt1, pt2);
 	free(pt2);
 
 	/* release date */
 	char *date_str = create_substring(start_of_data, "album_release_date: \"", "\",");
+	if (!date_str)
+		goto fail;
 	char *tok = strtok(date_str, " ");
 	unsigned d; /* just get the year */
-	for (d = 0; d < 2; d++)
+	for (d = 0; d < 2 && tok; d++)
 		tok = strtok(NULL, " ");
-	if (strlen(tok) != 4) /* if this fails, everything else is probably broken too */
-	{
-		program_error(ERROR_JSON);
-		abort();
-	}
-	else
+	if (!tok || strlen(tok) != 4) /* if this fails, everything else is probably broken too */
 	{
-		char *date = (char *) malloc(sizeof(char) * strlen(tok) + 1);
-		strcpy(date, tok);
-		data->release_date = date;
-		free(date_str); tok = NULL;
+		free(date_str);
+		goto fail;
 	}
-
-	/* filetype */
-	data->filetype = create_substring(start_of_data, "track?enc=", "-128&");
+	char *date = (char *) malloc(sizeof(char) * strlen(tok) + 1);
+	strcpy(date, tok);
+	data->release_date = date;
+	free(date_str); tok = NULL;
 
 	/* track count */
 	data->track_count = count_occurances_of(start_of_data, "track_id");
+	if (!data->track_count)
+		goto fail;
 
 	/* song titles */
 	data->song_titles = iterative_data_scraper(data->track_count, start_of_data, "\"title\":\"", "\",");
+	if (!data->song_titles)
+		goto fail;
 
 	/* stream urls */
 	data->stream_urls = iterative_data_scraper(data->track_count, start_of_data, "\"mp3-128\":\"//", "\"},");
+	if (!data->stream_urls)
+		goto fail;
 	data->stream_urls = prefix_stream_urls(data->track_count, data->stream_urls);
 
 	/* sanitize certain fields for '\u003C' unicode literals */
@@ -247,12 +272,103 @@ album_t *parse_album_data(membuf_t *ptr)
 
 	/* just in case */
 	if (duplicates_urls_exist(data))
+		goto fail;
+
+	return data;
+
+	fail: free_album_data(data);
+	return NULL;
+}
+
+int album_page_complete(membuf_t *ptr, size_t *scanned)
+{
+	/* nonzero once everything parse_album_data() reads has arrived,
+	 * which ends where 'var CurrencyData' starts
+	 * called as the page downloads, scanned is how far earlier calls
+	 * got and should start at 0
+	 */
+	const char *JSON_END = "var CurrencyData";
+	size_t overlap = strlen(JSON_END) - 1; /* marker split across chunks */
+	if (ptr->spill_fd >= 0 || ptr->size < overlap) /* page not in memory */
+		return 0;
+	size_t from = (*scanned > overlap) ? *scanned - overlap : 0;
+	*scanned = ptr->size;
+	char *end = strstr(ptr->memory + from, JSON_END);
+	if (!end)
+		return 0;
+	char *start = strstr(ptr->memory, "var BandData");
+	return start && start < end;
+}
+
+int page_is_album(membuf_t *ptr)
+{
+	/* artists with a single release serve the album page at their root */
+	return strstr(ptr->memory, "var BandData") && strstr(ptr->memory, "trackinfo");
+}
+
+char **parse_discography(membuf_t *ptr, const char *url, unsigned *count)
+{
+	/* scrape album and track links from an artist's music grid
+	 * grid items past the first few only appear in the
+	 * HTML-escaped JSON of data-client-items, scrape both
+	 * relative links are prefixed with scheme + host of url,
+	 * or all of url if there's no path to cut off
+	 */
+	const char *LINK_START[] = { "href=\"", "page_url&quot;:&quot;" };
+	const char *LINK_END[] = { "\"", "&quot;" };
+	const char *scheme_end = strstr(url, "//");
+	const char *host_end = scheme_end ? strchr(scheme_end + 2, '/') : NULL;
+	size_t host_len = host_end ? (size_t) (host_end - url) : strlen(url);
+	unsigned capacity = 16;
+	char **links = (char **) malloc(sizeof(char *) * capacity);
+	*count = 0;
+	unsigned p;
+	for (p = 0; p < 2; p++)
 	{
-		program_error(ERROR_JSON);
-		abort();
+		char *from = ptr->memory;
+		while ((from = strstr(from, LINK_START[p])))
+		{
+			from += strlen(LINK_START[p]);
+			char *to = strstr(from, LINK_END[p]);
+			if (!to)
+				break;
+			if (strncmp(from, "/album/", 7) && strncmp(from, "/track/", 7))
+				continue;
+			size_t len = strcspn(from, "?#\"&");
+			if (len > (size_t) (to - from))
+				len = to - from;
+			char *link = (char *) malloc(sizeof(char) * (host_len + len + 1));
+			memcpy(link, url, host_len);
+			memcpy(link + host_len, from, len);
+			link[host_len + len] = '\0';
+			unsigned i; /* discard duplicates */
+			for (i = 0; i < *count; i++)
+			{
+				if (!strcmp(links[i], link))
+					break;
+			}
+			if (i < *count)
+			{
+				free(link);
+				continue;
+			}
+			if (*count == capacity)
+			{
+				capacity *= 2;
+				links = (char **) realloc(links, sizeof(char *) * capacity);
+			}
+			links[(*count)++] = link;
+		}
 	}
+	return links;
+}
 
-	return data;
+void free_discography(char **links, unsigned count)
+{
+	unsigned i;
+	for (i = 0; i < count; i++)
+		free(links[i]);
+	free(links);
 }
 
 void display_album_data(album_t *ptr)
@@ -283,12 +399,11 @@ void free_album_data(album_t *ptr)
 	free(ptr->album_title);
 	free(ptr->artist);
 	free(ptr->album_artist);
-	unsigned i;
-	for (i = 0; i < ptr->track_count; i++)
-	{
+	unsigned i; /* either array may be missing if parsing failed */
+	for (i = 0; ptr->song_titles && i < ptr->track_count; i++)
 		free(ptr->song_titles[i]);
+	for (i = 0; ptr->stream_urls && i < ptr->track_count; i++)
 		free(ptr->stream_urls[i]);
-	}
 	free(ptr->song_titles);
 	free(ptr->stream_urls);
 	free(ptr->filetype);
@@ -0,0 +1,174 @@
+#define _POSIX_C_SOURCE 200809L /* pthreads */
+
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "pool.h"
+
+/*
+ *	pool.c
+ *	This file is part of bc-dl.
+ *	See bc-dl.c for copyright or LICENSE for license information.
+ */
+
+/* fixed set of worker threads taking jobs first come first served
+ * finished jobs are collected by whichever thread owns the pool with
+ * pool_reap(), so everything but a job's run function stays on that thread
+ * jobs are allocated and freed by the caller, the pool only links them
+ */
+
+void pool_unlink(pool_job_t **list, pool_job_t *job)
+{
+	while (*list && *list != job)
+		list = &(*list)->next;
+	if (*list)
+		*list = job->next;
+	job->next = NULL;
+}
+
+void *pool_worker(void *arg)
+{
+	pool_t *pool = (pool_t *) arg;
+	pthread_mutex_lock(&pool->lock);
+	for (;;)
+	{
+		while (!pool->queue && !pool->stopping)
+			pthread_cond_wait(&pool->work, &pool->lock);
+		if (!pool->queue) /* stopping */
+			break;
+		pool_job_t *job = pool->queue;
+		pool->queue = job->next;
+		if (!pool->queue)
+			pool->queue_tail = NULL;
+		job->running = 1;
+		job->next = pool->running;
+		pool->running = job;
+		pthread_mutex_unlock(&pool->lock);
+		job->run(job);
+		pthread_mutex_lock(&pool->lock);
+		pool_unlink(&pool->running, job);
+		job->running = 0;
+		job->next = pool->done;
+		pool->done = job;
+		pthread_cond_broadcast(&pool->idle);
+		if (pool->notify)
+			pool->notify(pool->userdata);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return NULL;
+}
+
+pool_t *pool_init(unsigned threads, void (*notify)(void *), void *userdata)
+{
+	/* notify is called from a worker with the pool locked, it mustn't
+	 * call back into the pool
+	 * returns NULL if no thread could be started
+	 */
+	pool_t *pool = (pool_t *) calloc(1, sizeof(pool_t));
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->work, NULL);
+	pthread_cond_init(&pool->idle, NULL);
+	pool->notify = notify;
+	pool->userdata = userdata;
+	if (threads > POOL_MAX_THREADS)
+		threads = POOL_MAX_THREADS;
+	while (pool->thread_count < threads &&
+	       !pthread_create(&pool->threads[pool->thread_count], NULL, pool_worker, (void *) pool))
+		pool->thread_count++;
+	if (!pool->thread_count)
+	{
+		pool_cleanup(pool);
+		return NULL;
+	}
+	return pool;
+}
+
+void pool_submit(pool_t *pool, pool_job_t *job)
+{
+	job->running = 0;
+	job->next = NULL;
+	pthread_mutex_lock(&pool->lock);
+	if (pool->queue_tail)
+		pool->queue_tail->next = job;
+	else
+		pool->queue = job;
+	pool->queue_tail = job;
+	pthread_cond_signal(&pool->work);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+pool_job_t *pool_reap(pool_t *pool)
+{
+	/* take every finished job, oldest first, NULL if there are none */
+	pool_job_t *done, *reversed = NULL;
+	pthread_mutex_lock(&pool->lock);
+	done = pool->done;
+	pool->done = NULL;
+	pthread_mutex_unlock(&pool->lock);
+	while (done)
+	{
+		pool_job_t *next = done->next;
+		done->next = reversed;
+		reversed = done;
+		done = next;
+	}
+	return reversed;
+}
+
+pool_job_t *pool_cancel(pool_t *pool, void *owner)
+{
+	/* take back owner's jobs, queued or finished, once none of them is
+	 * running, blocks until the ones on a worker are done
+	 * returns them as a list, their run function may not have been called
+	 */
+	pool_job_t *taken = NULL, **link, *job;
+	pthread_mutex_lock(&pool->lock);
+	for (;;)
+	{
+		for (job = pool->running; job && job->owner != owner; job = job->next);
+		if (!job)
+			break;
+		pthread_cond_wait(&pool->idle, &pool->lock);
+	}
+	pool_job_t **lists[2];
+	lists[0] = &pool->queue;
+	lists[1] = &pool->done;
+	unsigned i;
+	for (i = 0; i < 2; i++)
+	{
+		for (link = lists[i]; *link;)
+		{
+			job = *link;
+			if (job->owner != owner)
+			{
+				link = &job->next;
+				continue;
+			}
+			*link = job->next;
+			job->next = taken;
+			taken = job;
+		}
+	}
+	for (pool->queue_tail = pool->queue; pool->queue_tail && pool->queue_tail->next;
+	     pool->queue_tail = pool->queue_tail->next);
+	pthread_mutex_unlock(&pool->lock);
+	return taken;
+}
+
+void pool_cleanup(pool_t *pool)
+{
+	/* finishes jobs already queued, then stops every thread
+	 * jobs not reaped by then are left to the caller
+	 */
+	unsigned i;
+	pthread_mutex_lock(&pool->lock);
+	pool->stopping = 1;
+	pthread_cond_broadcast(&pool->work);
+	pthread_mutex_unlock(&pool->lock);
+	for (i = 0; i < pool->thread_count; i++)
+		pthread_join(pool->threads[i], NULL);
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->work);
+	pthread_cond_destroy(&pool->idle);
+	free(pool);
+}
@@ -2,10 +2,11 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "error.h"
 #include "membuf.h"
 #include "parse.h"
+#include "id3.h"
 #include "tag.h"
-#include "utilities.h"
 
 /*
  *	tag.c
@@ -23,7 +24,8 @@ const frame_t ID3_FRAME[NUMBER_OF_FRAMES] = {
 	{ "TRCK", TRCK },
 	{ "COMM", COMM },
 	{ "TPE2", TPE2 },
-	{ "APIC", APIC }
+	{ "APIC", APIC },
+	{ "TLEN", TLEN }
 };
 
 /* ID3v2.4 FRAME / ENUM TABLE
@@ -35,6 +37,7 @@ const frame_t ID3_FRAME[NUMBER_OF_FRAMES] = {
  * COMM | Comment
  * TPE2 | Album Artist
  * APIC | Embedded Image
+ * TLEN | Length in milliseconds, only if known
  */
 
 /* ID3v2.4 LAYOUT
@@ -55,33 +58,6 @@ const frame_t ID3_FRAME[NUMBER_OF_FRAMES] = {
  * +-----------------+
  */
 
-void *memmem(void *memblk, size_t h_len, void *matchblk, size_t n_len)
-{
-	char *haystack = (char *) memblk;
-	char *needle = (char *) matchblk;
-	if (n_len > h_len)
-		goto end;
-
-	unsigned i, j;
-	for (i = 0; i < h_len; i++)
-	{
-		if (i + n_len < h_len) /* bounds checking */
-		{
-			unsigned matches = 0;
-			for (j = 0; j < n_len; j++)
-			{
-				if (haystack[i + j] == needle[j])
-					matches++;
-			}
-			if (matches == n_len)
-				return (void *) haystack + i;
-		}
-		else
-			goto end;
-	}
-	end: return NULL;
-}
-
 int is_ASCII(const char *str)
 {
 	/* detects if string is 7-bit ASCII */
@@ -96,39 +72,34 @@ int is_ASCII(const char *str)
 	return 1;
 }
 
-void id3_text_field(char *frame, size_t *offset, char *text)
+const char *id3_encoding(const char *text)
+{
+	/* Text encoding    $xx */
+	return is_ASCII(text) ? "\x00" /* ISO-8859-1 */ : "\x03"; /* UTF-8 */
+}
+
+void id3_text_field(payload_t *frame, const char *text)
 {
 	/* Text encoding    $xx
 	 * Information    <text string according to encoding>
 	 */
-	char encoding; /* detect encoding */
-	if (is_ASCII(text))
-		encoding = 0x00; /* ISO-8859-1 */
-	else
-		encoding = 0x03; /* UTF-8 */
-	memcpy(frame + *offset, &encoding, 1);
-	*offset += 1;
-
-	/* copy null terminated string */
-	memcpy(frame + *offset, text, strlen(text) + 1);
-	*offset += strlen(text) + 1;
+	id3_add_field(frame, id3_encoding(text), 1);
+	id3_add_field(frame, text, strlen(text) + 1); /* null terminated */
 }
 
-void id3_comment_field(char *frame, size_t *offset, char *comment)
+void id3_comment_field(payload_t *frame, const char *comment)
 {
 	/* Text encoding           $xx
 	 * Language                $xx xx xx
 	 * Short content descrip.  <text string according to encoding> $00 (00)
 	 * The actual text         <full text string according to encoding>
 	 */
-	char padding[5] = { 0x00, 0x00, 0x00, 0x00, 0x00 };
-	memcpy(frame + *offset, padding, 5);
-	*offset += 5;
-	memcpy(frame + *offset, comment, strlen(comment) + 1);
-	*offset += strlen(comment) + 1;
+	id3_add_field(frame, id3_encoding(comment), 1);
+	id3_add_field(frame, "\x00\x00\x00\x00", 4); /* no language, empty desc */
+	id3_add_field(frame, comment, strlen(comment) + 1);
 }
 
-void id3_embedded_image(char *frame, size_t *offset, membuf_t *art)
+void id3_embedded_image(payload_t *frame, membuf_t *art)
 {
 	/* Text encoding   $xx
 	 * MIME type       <text string> $00
@@ -136,190 +107,134 @@ void id3_embedded_image(char *frame, size_t *offset, membuf_t *art)
 	 * Description     <text string according to encoding> $00 (00)
 	 * Picture data    <binary data>
 	 */
-	char encoding[] = { 0x00 }; /* ISO-8859-1 */
-	memcpy(frame + *offset, encoding, 1);
-	*offset += 1;
-	char mime_type[] = "image/jpeg"; /* MIME type */
-	memcpy(frame + *offset, mime_type, 11);
-	*offset += 11;
-	char pic_type[] = { 0x03 }; /* Cover (front) */
-	memcpy(frame + *offset, pic_type, 1);
-	*offset += 1;
-	char desc[] = { 0x00 }; /* empty desc */
-	memcpy(frame + *offset, desc, 1);
-	*offset += 1;
-	char *picture_data = art->memory; /* binary data */
-	size_t data_size = art->size;
-	memcpy(frame + *offset, picture_data, data_size);
-	*offset += data_size;
+	id3_add_field(frame, "\x00", 1); /* ISO-8859-1 */
+	id3_add_field(frame, "image/jpeg", 11);
+	id3_add_field(frame, "\x03", 1); /* Cover (front) */
+	id3_add_field(frame, "\x00", 1); /* empty desc */
+	id3_add_field(frame, art->memory, art->size);
 }
 
-void id3_track_numbering(char *frame, size_t *offset, int track, int track_count)
+membuf_t *id3_create_tag(membuf_t *art, album_t *album, unsigned track, unsigned long length_ms, size_t fit)
 {
-	/* create string from track number, pass it off as normal text field */
-	unsigned tr_len = uintlen(track+1);
-	unsigned tr_count_len = uintlen(track);
-	if (track+1 < 10) /* 01, 02, 03... */
-		tr_len++;
-	if (track_count < 10)
-		tr_count_len++;
-
-	char *tr_str = (char *) malloc(sizeof(char) * tr_len + 2);
-	if (track+1 < 10) /* track number */
-		sprintf(tr_str, "0%u", track+1);
-	else
-		sprintf(tr_str, "%u", track+1);
-
-	char *tr_count_str = (char *) malloc(sizeof(char) * tr_count_len + 2);
-	if (track_count < 10) /* total tracks */
-		sprintf(tr_count_str, "0%u", track_count);
-	else
-		sprintf(tr_count_str, "%u", track_count);
-
-	char *numbering = (char *) malloc(sizeof(char) * tr_len + tr_count_len + 3);
-	sprintf(numbering, "%s/%s", tr_str, tr_count_str); /* 04/09 */
-	id3_text_field(frame, offset, numbering);
-	free(tr_str);
-	free(tr_count_str);
-	free(numbering);
-}
-
-size_t id3_read_28bit_length(void *start)
-{
-	/* converts 4-byte 28-bit uint value to unsigned long long
-	 * length value is decoded from a 28-bit uint value across 4 bytes
-	 * using only 7 effective bits per byte, MSB (bit 7) is skipped for each byte
-	 * ID3v2 size              4 * %0xxxxxxx
+	/* build a complete ID3v2.4 tag, see id3_serialize() for padding
+	 * length of 0 means unknown, TLEN is left out
+	 * returns NULL if out of memory
 	 */
-	char *location = (char *) start;
-	const unsigned BIT_LENGTH = 7;
-	const unsigned WORD_SIZE = 4;
-	size_t length = 0;
-	int i, j;
-	unsigned k = 0; /* length integer bit index */
-	for (i = WORD_SIZE - 1; i >= 0; i--)
+	payload_t frames[NUMBER_OF_FRAMES];
+	char numbering[2 * 20 + 2]; /* 04/09 */
+	sprintf(numbering, "%02u/%02u", track+1, album->track_count);
+	char length[20 + 1];
+	sprintf(length, "%lu", length_ms);
+	unsigned i, count = 0;
+	for (i = 0; i < NUMBER_OF_FRAMES; i++) /* describe ID3 frames */
 	{
-		for (j = 0; j < BIT_LENGTH; j++)
+		if (ID3_FRAME[i].frame == TLEN && !length_ms)
+			continue;
+		payload_t *frame = &frames[count++];
+		frame->id = ID3_FRAME[i].id;
+		frame->fields = 0;
+		switch (ID3_FRAME[i].frame)
 		{
-			if (location[i] & (1 << j))
-				length |= (1 << k);
-			k++;
+			case TIT2: id3_text_field(frame, album->song_titles[track]); break;
+			case TPE1: id3_text_field(frame, album->artist); break;
+			case TALB: id3_text_field(frame, album->album_title); break;
+			case TDRC: id3_text_field(frame, album->release_date); break;
+			case TPE2: id3_text_field(frame, album->album_artist); break;
+			case TRCK: id3_text_field(frame, numbering); break;
+			case COMM: id3_comment_field(frame, album->comment); break;
+			case APIC: id3_embedded_image(frame, art); break;
+			case TLEN: id3_text_field(frame, length); break;
+			default: break;
 		}
 	}
-	return length + ID3_HEADER_LENGTH;
+	return id3_serialize(frames, count, fit);
 }
 
-void id3_write_28bit_length(size_t length, void *start)
+ferror_t write_id3_tags(membuf_t *file, membuf_t *art, album_t *album, unsigned track, unsigned long length_ms)
 {
-	/* converts unsigned long long to 4 byte 28-bit uint value
-	 * length value is encoded to a 28-bit uint value across 4 bytes
-	 * using only 7 effective bits per byte, MSB (bit 7) is skipped for each byte
-	 * ID3v2 size              4 * %0xxxxxxx
+	/* attach a new ID3v2.4 tag as header of file membuf
+	 * if tags exist in file, skip past them, audio is never copied
+	 * length is the track duration in milliseconds, 0 if unknown
 	 */
-	char *location = (char *) start;
-	const unsigned BIT_LENGTH = 7;
-	const unsigned WORD_SIZE = 4;
-	int i, j;
-	unsigned k = 0; /* length integer bit index */
-	for (i = WORD_SIZE - 1; i >= 0; i--)
-	{
-		for (j = 0; j < BIT_LENGTH; j++)
-		{
-			if (length & (1 << k++))
-				location[i] |= (1 << j);
-		}
-	}
+	file->offset = id3_tag_length(file->memory, file->size);
+	if (file->offset > file->size)
+		file->offset = file->size;
+	if (file->header)
+		membuf_free(file->header);
+	file->header = id3_create_tag(art, album, track, length_ms, 0);
+	return file->header ? EVERYTHING_IS_FINE : ERROR_MEM_IO;
 }
 
-char *id3_create_frame(const frame_t *id3, size_t *len, unsigned track, album_t *album, membuf_t *art)
+ferror_t id3_retag_file(const char *filename, membuf_t *art, album_t *album, unsigned track)
 {
-	const unsigned BIG_ENOUGH = art->size * 2;
-	char *frame = (char *) calloc(sizeof(char), BIG_ENOUGH);
-	/* Frame ID       $xx xx xx xx (four characters)
-	 * Size           $xx xx xx xx
-	 * Flags          $xx xx
+	/* replace the tag of a file already on disk
+	 * new tag is padded out to the size of the old one, so only the tag
+	 * region is rewritten and the audio is never read
+	 * if it no longer fits, file is rewritten once with fresh padding
+	 * track length is carried over from the old tag
 	 */
-	size_t offset = 0; /* total size */
-
-	/* write frame header */
-	memcpy(frame+offset, id3->id, strlen(id3->id));
-	offset += strlen(id3->id);
-	char padding[6] = { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
-	memcpy(frame+offset, padding, 6);
-	offset += 6;
-
-	/* write frame data */
-	switch (id3->frame)
+	FILE *file = fopen(filename, "r+b");
+	if (!file)
+		return ERROR_FILE_IO;
+	char header[ID3_HEADER_LENGTH];
+	size_t old_length = id3_tag_length(header, fread(header, 1, ID3_HEADER_LENGTH, file));
+	unsigned long length_ms = 0;
+	if (old_length)
 	{
-		case TIT2: id3_text_field(frame, &offset, album->song_titles[track]); break;
-		case TPE1: id3_text_field(frame, &offset, album->artist); break;
-		case TALB: id3_text_field(frame, &offset, album->album_title); break;
-		case TDRC: id3_text_field(frame, &offset, album->release_date); break;
-		case TPE2: id3_text_field(frame, &offset, album->album_artist); break;
-		case TRCK: id3_track_numbering(frame, &offset, track, album->track_count); break;
-		case COMM: id3_comment_field(frame, &offset, album->comment); break;
-		case APIC: id3_embedded_image(frame, &offset, art); break;
-		default: break;
+		char *old_tag = (char *) malloc(sizeof(char) * old_length);
+		memcpy(old_tag, header, ID3_HEADER_LENGTH);
+		size_t len = ID3_HEADER_LENGTH + fread(old_tag + ID3_HEADER_LENGTH, 1, old_length - ID3_HEADER_LENGTH, file);
+		size_t size;
+		const char *tlen = id3_find_frame(old_tag, len, "TLEN", &size);
+		if (tlen && size > 1 && size < 20)
+		{
+			char text[20];
+			memcpy(text, tlen + 1, size - 1); /* skip encoding */
+			text[size - 1] = '\0';
+			length_ms = strtoul(text, NULL, 10);
+		}
+		free(old_tag);
 	}
-
-	/* write total size of frame to frame header */
-	id3_write_28bit_length(offset - ID3_HEADER_LENGTH, frame + ID3_FRAME_LEN_OFFSET);
-	frame = (char *) realloc(frame, offset); /* shrink */
-	*len = offset; /* pass total length to external scope */
-	return frame;
-}
-
-membuf_t *write_id3_tags(membuf_t *file, membuf_t *art, album_t *album, unsigned track)
-{
-	/* write ID3v2.4 tags to a new membuf
-	 * if tags exist in file, truncate tags
-	 * concat new tag + file membufs
-	 * return concatenated membuf
-	 */
-	fflush(stdout);
-
-	/* ID3v2/file identifier   "ID3"
-	 * ID3v2 version           $03 00
-	 * ID3v2 flags             %abc00000
-	 * ID3v2 size              4 * %0xxxxxxx
-	 */
-	char v3_header_seq[] = { 0x49, 0x44, 0x33, 0x03, 0x00, 0x00 }; /* ID3v2.3.0 */
-	char v4_header_seq[] = { 0x49, 0x44, 0x33, 0x04, 0x00, 0x00 }; /* ID3v2.4.0 */
-	char size_padding[] = { 0x00, 0x00, 0x00, 0x00 };
-
-	/* search for first 4 bytes of ID3 header */
-	char *tag = (char *) memmem(file->memory, file->size, v3_header_seq, strlen(v3_header_seq));
-	if (tag != NULL) /* if tag exists, truncate tags from file */
+	membuf_t *tag = id3_create_tag(art, album, track, length_ms, old_length);
+	if (!tag)
 	{
-		size_t tag_length = id3_read_28bit_length(tag + ID3_HEADER_LEN_OFFSET);
-		file->size -= tag_length;
-		memmove(file->memory, file->memory+tag_length, file->size);
-		file->memory = (char *) realloc(file->memory, file->size);
+		fclose(file);
+		return ERROR_MEM_IO;
 	}
-
-	/* create tags */
-	membuf_t *id3_tag = membuf_init();
-	id3_tag->filename = NULL; /* this won't be used */
-	membuf_write(v4_header_seq, 6, 1, id3_tag);
-	membuf_write(size_padding, 4, 1, id3_tag); /* 4 bytes padding for 28-bit tag size */
-	unsigned i;
-	for (i = 0; i < NUMBER_OF_FRAMES; i++) /* generate ID3 frames */
+	ferror_t err = EVERYTHING_IS_FINE;
+	if (tag->size == old_length) /* fits in place */
 	{
-		size_t frame_length = 0; /* includes frame headers */
-		char *frame = id3_create_frame(&ID3_FRAME[i], &frame_length, track, album, art);
-		membuf_write(frame, frame_length, 1, id3_tag);
-		free(frame);
+		if (fseek(file, 0, SEEK_SET) || fwrite(tag->memory, 1, tag->size, file) != tag->size)
+			err = ERROR_FILE_IO;
+		if (fclose(file))
+			err = ERROR_FILE_IO;
+		membuf_free(tag);
+		return err;
 	}
-	/* write total size of tag to tag header */
-	id3_write_28bit_length(id3_tag->size - ID3_HEADER_LENGTH, id3_tag->memory + ID3_HEADER_LEN_OFFSET);
 
-	/* concatenate tag + file */
-	char *merged = (char *) malloc(sizeof(char) * id3_tag->size + file->size);
-	memcpy(merged, id3_tag->memory, id3_tag->size);
-	memcpy(&merged[id3_tag->size], file->memory, file->size);
-	file->size += id3_tag->size;
-	membuf_free(id3_tag);
-	free(file->memory);
-	file->memory = merged;
-	return file;
+	/* read audio past the old tag, write tag + audio to a temp file */
+	membuf_t *audio = membuf_init();
+	audio->header = tag;
+	audio->filename = (char *) malloc(sizeof(char) * (strlen(filename) + 7));
+	sprintf(audio->filename, "%s.retag", filename);
+	char chunk[BUFSIZ];
+	size_t len;
+	if (fseek(file, old_length, SEEK_SET))
+		err = ERROR_FILE_IO;
+	while (err == EVERYTHING_IS_FINE && (len = fread(chunk, 1, sizeof(chunk), file)) > 0)
+	{
+		if (!membuf_write(chunk, len, 1, audio))
+			err = ERROR_MEM_IO;
+	}
+	if (ferror(file))
+		err = ERROR_FILE_IO;
+	fclose(file);
+	if (err == EVERYTHING_IS_FINE)
+		err = membuf_commit_to_disk(audio);
+	if (err == EVERYTHING_IS_FINE && rename(audio->filename, filename))
+		err = ERROR_FILE_IO;
+	if (err != EVERYTHING_IS_FINE)
+		remove(audio->filename);
+	membuf_free(audio);
+	return err;
 }
@@ -0,0 +1,1113 @@
+#define _POSIX_C_SOURCE 200809L /* clock_gettime, localtime_r */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <curl/curl.h> /* libcurl */
+
+#include "error.h"
+#include "membuf.h"
+#include "transfer.h"
+#include "utilities.h"
+
+/*
+ *	transfer.c
+ *	This file is part of bc-dl.
+ *	See bc-dl.c for copyright or LICENSE for license information.
+ */
+
+/* every transfer is driven by a curl multi handle through its socket
+ * interface, sockets libcurl asks for are watched with epoll and only
+ * the ones with events are handed back to it, so the cost of a pass
+ * doesn't grow with the number of transfers in flight
+ * finished connections are kept alive and reused by later transfers
+ * to the same host, resolved hosts and TLS sessions are cached for
+ * the life of the engine
+ * HTTPS hosts that speak HTTP/2 get every transfer multiplexed over one
+ * connection, new transfers wait for it rather than opening their own
+ * a host can be warmed up ahead of time, see engine_prewarm()
+ *
+ * how many transfers run at once against each host is tuned as we go,
+ * additive increase / multiplicative decrease:
+ * while transfers are queued and the sum of libcurl's per-transfer
+ * download rates keeps rising, the host's limit grows by one per step
+ * an error, HTTP 429 or 503, or a time to first byte far above the best
+ * seen halves it, transfers past the limit wait in a per-host queue
+ *
+ * bandwidth is shaped with a token bucket per group of transfers,
+ * the process-wide rate is split evenly between groups with transfers
+ * in flight, each share capped by TRANSFER_SHAPER.share
+ * a transfer that runs out of tokens is paused until its group's bucket
+ * is refilled, so a group with many transfers gets no more than one
+ * with a single transfer, queued transfers are let in the same way,
+ * from whichever group has the fewest in flight
+ *
+ * a transfer with a split threshold whose first response is larger than
+ * that is split into TRANSFER_SEGMENTS range requests once its first chunk
+ * arrives, the body goes into a temp file reserved up front and each
+ * request writes its own part of it in place
+ * the original request carries on with the first part and stops once past
+ * it, unless a server answers a range with anything but 206 and the right
+ * length, then the other requests are dropped and it fetches everything
+ *
+ * a transfer receiving less than TRANSFER_STALL_RATE for TRANSFER_STALL_TIME
+ * is aborted, time spent paused doesn't count
+ * one far slower than the average of the other transfers in its group gets
+ * a duplicate on a fresh connection, whichever finishes first is kept
+ * duplicates don't wait for a slot, the transfer they stand in for has one
+ */
+
+struct _shaper TRANSFER_SHAPER = {
+	.rate = 0,
+	.share = 0,
+	.windows = 0,
+	.halvings = 0
+};
+
+void transfer_set_bandwidth(size_t rate, size_t share)
+{
+	/* applies to every engine in the process, 0 for unlimited
+	 * a new rate is taken as it is, earlier scaling is dropped
+	 */
+	TRANSFER_SHAPER.rate = rate;
+	TRANSFER_SHAPER.share = share;
+	TRANSFER_SHAPER.halvings = 0;
+}
+
+void transfer_scale_bandwidth(int halvings)
+{
+	/* halve the rate in effect this many times, double it for negative,
+	 * schedule windows included, kept within what a size_t can shift
+	 */
+	int most = sizeof(size_t) * 8;
+	halvings += TRANSFER_SHAPER.halvings;
+	TRANSFER_SHAPER.halvings = (halvings > most) ? most : (halvings < -most) ? -most : halvings;
+}
+
+size_t transfer_rate(void)
+{
+	/* process-wide limit right now, first schedule window wins,
+	 * then scaled, an unlimited rate stays unlimited
+	 */
+	size_t rate = TRANSFER_SHAPER.rate;
+	int halvings = TRANSFER_SHAPER.halvings;
+	time_t now = time(NULL);
+	struct tm local;
+	localtime_r(&now, &local);
+	unsigned minute = local.tm_hour * 60 + local.tm_min;
+	unsigned i;
+	for (i = 0; i < TRANSFER_SHAPER.windows; i++)
+	{
+		const struct _rate_window *w = &TRANSFER_SHAPER.schedule[i];
+		if (w->start <= w->end ? (minute >= w->start && minute < w->end)
+		                       : (minute >= w->start || minute < w->end))
+		{
+			rate = w->rate;
+			break;
+		}
+	}
+	for (; rate > 1 && halvings > 0; halvings--)
+		rate /= 2;
+	for (; rate && rate <= (size_t) -1 / 2 && halvings < 0; halvings++)
+		rate *= 2;
+	return rate;
+}
+
+int transfer_set_schedule(const char *spec)
+{
+	/* comma separated HH:MM-HH:MM=SIZE windows, empty string clears them
+	 * returns 0 on success, schedule is left alone otherwise
+	 */
+	struct _rate_window schedule[TRANSFER_MAX_WINDOWS];
+	unsigned windows = 0;
+	while (*spec)
+	{
+		unsigned h1, m1, h2, m2;
+		int used = 0;
+		char size[32];
+		size_t len;
+		if (windows == TRANSFER_MAX_WINDOWS ||
+		    sscanf(spec, "%2u:%2u-%2u:%2u=%n", &h1, &m1, &h2, &m2, &used) != 4 || !used ||
+		    h1 > 23 || m1 > 59 || m2 > 59 || h2 * 60 + m2 > 24 * 60)
+			return -1;
+		spec += used;
+		len = strcspn(spec, ",");
+		if (len >= sizeof(size))
+			return -1;
+		memcpy(size, spec, len);
+		size[len] = '\0';
+		if (parse_size(size, &schedule[windows].rate))
+			return -1;
+		schedule[windows].start = h1 * 60 + m1;
+		schedule[windows].end = h2 * 60 + m2; /* 24:00 for midnight */
+		windows++;
+		spec += len;
+		if (*spec == ',')
+			spec++;
+	}
+	memcpy(TRANSFER_SHAPER.schedule, schedule, sizeof(schedule[0]) * windows);
+	TRANSFER_SHAPER.windows = windows;
+	return 0;
+}
+
+void transfer_split(transfer_t *t)
+{
+	/* on the first chunk, reserve the body and have the rest of it fetched
+	 * in ranges if it's large enough, or size the buffer for it if not
+	 */
+	long status = 0;
+	curl_off_t length = -1;
+	char *url = NULL;
+	t->split_checked = 1;
+	if (t->parent || t->compressed || t->hedge || t->hedge_of) /* a race finishes in one piece */
+		return;
+	curl_easy_getinfo(t->handle, CURLINFO_RESPONSE_CODE, &status);
+	curl_easy_getinfo(t->handle, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &length);
+	curl_easy_getinfo(t->handle, CURLINFO_EFFECTIVE_URL, &url);
+	if (status != 200 || length < 0)
+		return;
+	if (!t->split || length < TRANSFER_SEGMENTS || (size_t) length <= t->split || !url ||
+	    membuf_reserve(t->membuf, (size_t) length))
+	{
+		membuf_expect(t->membuf, (size_t) length); /* in memory, sized once */
+		return;
+	}
+	t->segmented = 1;
+	t->unordered = 1;
+	t->split_pending = 1;
+	t->offset = 0;
+	t->length = (size_t) length / TRANSFER_SEGMENTS;
+	t->split_url = (char *) malloc(sizeof(char) * (strlen(url) + 1));
+	strcpy(t->split_url, url);
+}
+
+int transfer_confirmed(transfer_t *t)
+{
+	/* every segment of a whole transfer is known to be good */
+	transfer_t *s;
+	if (t->split_pending || t->split_failed)
+		return 0;
+	for (s = t->segments; s; s = s->sibling)
+	{
+		if (!s->confirmed)
+			return 0;
+	}
+	return 1;
+}
+
+size_t transfer_write_segment(transfer_t *t, const char *data, size_t len)
+{
+	/* write chunk in place, on_data of the whole transfer sees it */
+	transfer_t *whole = t->parent ? t->parent : t;
+	if (t->parent && !t->confirmed)
+	{
+		long status = 0;
+		curl_off_t length = -1;
+		curl_easy_getinfo(t->handle, CURLINFO_RESPONSE_CODE, &status);
+		curl_easy_getinfo(t->handle, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &length);
+		if (whole->split_failed || status != 206 || length != (curl_off_t) t->length)
+		{
+			whole->split_failed = 1; /* no ranges, fall back to one request */
+			whole->length = whole->membuf->size;
+			return 0;
+		}
+		t->confirmed = 1;
+	}
+	size_t limit = t->parent ? t->length : whole->membuf->size - t->offset;
+	if (t->received + len > limit) /* not the body we were promised */
+		return 0;
+	if (membuf_write_at(whole->membuf, t->offset + t->received, data, len))
+	{
+		whole->out_of_memory = 1;
+		return 0;
+	}
+	t->received += len;
+	if (whole->on_data && !whole->on_data(whole, data, len, whole->userdata))
+		return 0;
+	if (t == whole && t->received >= t->length && transfer_confirmed(t))
+	{
+		t->cut = 1; /* rest is with the segments */
+		return 0;
+	}
+	return len;
+}
+
+size_t transfer_write(void *ptr, size_t size, size_t nmemb, void *stream)
+{
+	/* append chunk to membuf, then let on_data have a look at it
+	 * libcurl holds on to the chunk while we're paused
+	 */
+	transfer_t *t = (transfer_t *) stream;
+	if (t->group->rate && t->group->tokens <= 0)
+	{
+		t->paused = t->group->paused = 1;
+		return CURL_WRITEFUNC_PAUSE;
+	}
+	if (t->group->rate) /* unlimited groups run up no debt */
+		t->group->tokens -= (double) size * nmemb;
+	if (!t->split_checked)
+		transfer_split(t);
+	if (t->segmented || t->parent)
+		return transfer_write_segment(t, (char *) ptr, size * nmemb);
+	size_t realsize = membuf_write(ptr, size, nmemb, t->membuf);
+	if (!realsize && size * nmemb != 0)
+		t->out_of_memory = 1;
+	if (realsize && t->on_data && !t->on_data(t, (char *) ptr, realsize, t->userdata))
+		return 0;
+	return realsize;
+}
+
+double transfer_clock(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+int transfer_progress(void *clientp, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow)
+{
+	/* called by libcurl about once a second, nonzero aborts a stalled transfer
+	 * window restarts while paused, nothing is aborted while a duplicate
+	 * runs in its place
+	 */
+	transfer_t *t = (transfer_t *) clientp;
+	double now = transfer_clock();
+	if (t->peer)
+	{
+		t->group->live_bytes += (double) (dlnow - t->peer_bytes);
+		t->peer_bytes = dlnow;
+	}
+	if (t->paused || t->group->paused)
+	{
+		t->window_start = now;
+		t->window_bytes = dlnow;
+		return 0;
+	}
+	if (t->hedge || now - t->window_start < TRANSFER_STALL_TIME)
+		return 0;
+	if ((dlnow - t->window_bytes) / (now - t->window_start) < TRANSFER_STALL_RATE)
+		return 1;
+	t->window_start = now;
+	t->window_bytes = dlnow;
+	return 0;
+}
+
+host_t *engine_host(engine_t *engine, const char *url)
+{
+	/* controller state for the host part of url, created on first use */
+	const char *start = strstr(url, "://");
+	start = start ? start + 3 : url;
+	size_t len = strcspn(start, "/?#");
+	host_t *host;
+	for (host = engine->hosts; host; host = host->next)
+	{
+		if (strlen(host->name) == len && !strncmp(host->name, start, len))
+			return host;
+	}
+	host = (host_t *) calloc(1, sizeof(host_t));
+	host->name = (char *) malloc(sizeof(char) * (len + 1));
+	memcpy(host->name, start, len);
+	host->name[len] = '\0';
+	host->limit = TRANSFER_INITIAL_HOST_LIMIT;
+	if (host->limit > engine->max_host)
+		host->limit = engine->max_host;
+	host->next = engine->hosts;
+	engine->hosts = host;
+	return host;
+}
+
+void host_unlink(transfer_t **list, transfer_t *t)
+{
+	while (*list && *list != t)
+		list = &(*list)->next;
+	if (*list)
+		*list = t->next;
+	t->next = NULL;
+}
+
+void engine_start(engine_t *engine, transfer_t *t)
+{
+	/* hand transfer to libcurl */
+	t->handle = curl_easy_init();
+	curl_easy_setopt(t->handle, CURLOPT_URL, t->url);
+	curl_easy_setopt(t->handle, CURLOPT_WRITEFUNCTION, transfer_write);
+	curl_easy_setopt(t->handle, CURLOPT_WRITEDATA, (void *) t);
+	curl_easy_setopt(t->handle, CURLOPT_FOLLOWLOCATION, 1L); /* redirects */
+	curl_easy_setopt(t->handle, CURLOPT_PRIVATE, (void *) t);
+	curl_easy_setopt(t->handle, CURLOPT_SHARE, engine->share);
+	curl_easy_setopt(t->handle, CURLOPT_DNS_CACHE_TIMEOUT, (long) TRANSFER_DNS_CACHE_TIMEOUT);
+	curl_easy_setopt(t->handle, CURLOPT_HTTP_VERSION, (long) CURL_HTTP_VERSION_2TLS);
+	curl_easy_setopt(t->handle, CURLOPT_PIPEWAIT, 1L); /* multiplex rather than connect */
+	curl_easy_setopt(t->handle, CURLOPT_CONNECTTIMEOUT, (long) TRANSFER_CONNECT_TIMEOUT);
+	curl_easy_setopt(t->handle, CURLOPT_XFERINFOFUNCTION, transfer_progress);
+	curl_easy_setopt(t->handle, CURLOPT_XFERINFODATA, (void *) t);
+	curl_easy_setopt(t->handle, CURLOPT_NOPROGRESS, 0L);
+	if (t->hedge_of) /* the original's connection may be the slow part */
+		curl_easy_setopt(t->handle, CURLOPT_FRESH_CONNECT, 1L);
+	if (t->compressed)
+		curl_easy_setopt(t->handle, CURLOPT_ACCEPT_ENCODING, ""); /* whatever libcurl can decode */
+	if (t->head_only)
+		curl_easy_setopt(t->handle, CURLOPT_NOBODY, 1L);
+	if (t->parent)
+	{
+		char range[64];
+		sprintf(range, "%lu-%lu", (unsigned long) t->offset, (unsigned long) (t->offset + t->length - 1));
+		curl_easy_setopt(t->handle, CURLOPT_RANGE, range);
+	}
+	t->queued = 0;
+	t->paused = 0;
+	t->started = t->window_start = transfer_clock();
+	t->window_bytes = 0;
+	t->peer = !t->hedge_of && !t->head_only;
+	t->peer_bytes = 0;
+	if (t->peer)
+	{
+		t->group->live++;
+		t->group->live_started += t->started;
+	}
+	t->next = t->host->running;
+	t->host->running = t;
+	t->host->active++;
+	if (!t->group->running++)
+	{
+		t->group->next = engine->groups;
+		engine->groups = t->group;
+	}
+	curl_multi_add_handle(engine->multi, t->handle);
+}
+
+void engine_release(engine_t *engine, transfer_t *t)
+{
+	/* take a transfer out of libcurl and give up its slot */
+	curl_multi_remove_handle(engine->multi, t->handle);
+	curl_easy_cleanup(t->handle);
+	t->handle = NULL;
+	host_unlink(&t->host->running, t);
+	if (t->peer)
+	{
+		t->group->live--;
+		t->group->live_started -= t->started;
+		t->group->live_bytes -= (double) t->peer_bytes;
+		t->peer = 0;
+	}
+	t->host->active--;
+	t->host->last_used = transfer_clock();
+	engine->active--;
+	if (!--t->group->running)
+	{
+		group_t **link = &engine->groups;
+		while (*link != t->group)
+			link = &(*link)->next;
+		*link = t->group->next;
+		t->group->next = NULL;
+		t->group->paused = 0;
+	}
+}
+
+void engine_admit(engine_t *engine, host_t *host)
+{
+	/* start queued transfers while host is under its limit
+	 * oldest transfer of the group with the fewest in flight goes first
+	 * HEAD requests carry no body, past the limit they may go on up to
+	 * the ceiling, so sizes of a whole album are probed at once
+	 */
+	while (host->queue && host->active < engine->max_host)
+	{
+		int full = host->active >= host->limit;
+		transfer_t **link, **pick = NULL;
+		for (link = &host->queue; *link; link = &(*link)->next)
+		{
+			if (full && !(*link)->head_only)
+				continue;
+			if (!pick || (*link)->group->running < (*pick)->group->running)
+				pick = link;
+		}
+		if (!pick)
+			break;
+		transfer_t *t = *pick;
+		*pick = t->next;
+		if (host->queue_tail == t)
+			for (host->queue_tail = host->queue; host->queue_tail && host->queue_tail->next;
+			     host->queue_tail = host->queue_tail->next);
+		engine_start(engine, t);
+	}
+}
+
+void engine_finished(engine_t *engine, transfer_t *t)
+{
+	/* feed outcome of a transfer to its host's controller, and its group's
+	 * record of how fast transfers go
+	 */
+	host_t *host = t->host;
+	double latency = 0;
+	curl_easy_getinfo(t->handle, CURLINFO_STARTTRANSFER_TIME, &latency);
+	if (t->result == CURLE_OK && !t->head_only)
+	{
+		curl_off_t received = 0;
+		curl_easy_getinfo(t->handle, CURLINFO_SIZE_DOWNLOAD_T, &received);
+		t->group->bytes += (double) received;
+		t->group->seconds += transfer_clock() - t->started;
+		t->group->finished++;
+	}
+	if (t->status == 429 || t->status == 503) /* throttled */
+		host->backoff = 1;
+	else if (t->result == CURLE_WRITE_ERROR) /* stopped on our side, not the host's fault */
+		return;
+	else if (t->result != CURLE_OK)
+		host->backoff = 1;
+	else if (latency > 0)
+	{
+		if (!host->best_latency || latency < host->best_latency)
+			host->best_latency = latency;
+		else if (latency > TRANSFER_LATENCY_FLOOR &&
+		         latency > host->best_latency * TRANSFER_LATENCY_SPIKE)
+			host->backoff = 1;
+	}
+}
+
+double transfer_peer_speed(transfer_t *t)
+{
+	/* download rate of the rest of t's group, finished transfers included
+	 * weighted by time taken, so small transfers count for little
+	 * kept as running sums, duplicates and HEAD requests left out
+	 * 0 if there are too few to tell
+	 */
+	group_t *group = t->group;
+	double now = transfer_clock();
+	double bytes = group->bytes + group->live_bytes;
+	double seconds = group->seconds + group->live * now - group->live_started;
+	unsigned peers = group->finished + group->live;
+	if (t->peer)
+	{
+		bytes -= (double) t->peer_bytes;
+		seconds -= now - t->started;
+		peers--;
+	}
+	return (peers >= 2 && seconds > 0) ? bytes / seconds : 0;
+}
+
+void engine_hedge(engine_t *engine)
+{
+	/* race a duplicate against each transfer far slower than its peers
+	 * duplicates start at the head of running lists, and are skipped
+	 */
+	host_t *host;
+	transfer_t *t;
+	double now = transfer_clock();
+	for (host = engine->hosts; host; host = host->next)
+	{
+		for (t = host->running; t && engine->hedges < TRANSFER_MAX_HEDGES; t = t->next)
+		{
+			curl_off_t speed = 0;
+			if (t->hedge || t->hedge_of || t->parent || t->segmented || t->internal ||
+			    t->head_only || t->paused || now - t->started < TRANSFER_HEDGE_AGE)
+				continue;
+			curl_easy_getinfo(t->handle, CURLINFO_SPEED_DOWNLOAD_T, &speed);
+			double peers = transfer_peer_speed(t);
+			if (!peers || (double) speed * TRANSFER_HEDGE_RATIO >= peers)
+				continue;
+			transfer_t *h = transfer_init(t->url, NULL);
+			h->compressed = t->compressed;
+			h->group = t->group;
+			h->hedge_of = t;
+			t->hedge = h;
+			engine->hedges++;
+			engine_add(engine, h);
+		}
+	}
+}
+
+void engine_tune(engine_t *engine)
+{
+	/* one controller step per TRANSFER_TUNE_INTERVAL */
+	double now = transfer_clock();
+	if ((now - engine->last_tune) * 1000 < TRANSFER_TUNE_INTERVAL)
+		return;
+	engine->last_tune = now;
+	engine->rate = transfer_rate(); /* schedule or runtime change */
+	host_t *host;
+	for (host = engine->hosts; host; host = host->next)
+	{
+		double throughput = 0;
+		transfer_t *t;
+		for (t = host->running; t; t = t->next)
+		{
+			curl_off_t speed = 0;
+			curl_easy_getinfo(t->handle, CURLINFO_SPEED_DOWNLOAD_T, &speed);
+			throughput += (double) speed;
+		}
+		if (host->backoff) /* multiplicative decrease */
+		{
+			host->limit = (host->limit > 1) ? host->limit / 2 : 1;
+			host->backoff = 0;
+		}
+		else if (host->queue && host->active >= host->limit &&
+		         throughput > host->throughput * TRANSFER_GAIN &&
+		         host->limit < engine->max_host) /* additive increase */
+			host->limit++;
+		host->throughput = throughput;
+		engine_admit(engine, host);
+	}
+	engine_hedge(engine);
+}
+
+void engine_resume(engine_t *engine, group_t *group)
+{
+	/* unpause a group's transfers, libcurl may deliver held data right away */
+	host_t *host;
+	transfer_t *t;
+	group->paused = 0;
+	for (host = engine->hosts; host; host = host->next)
+	{
+		for (t = host->running; t; t = t->next)
+		{
+			if (t->group == group && t->paused)
+			{
+				t->paused = 0;
+				curl_easy_pause(t->handle, CURLPAUSE_CONT);
+			}
+		}
+	}
+}
+
+void engine_shape(engine_t *engine)
+{
+	/* refill every group's bucket with its share of the rate limit */
+	double now = transfer_clock();
+	double elapsed = now - engine->last_shape;
+	engine->last_shape = now;
+	unsigned groups = 0;
+	group_t *group;
+	for (group = engine->groups; group; group = group->next)
+		groups++;
+	size_t share = 0;
+	if (engine->rate && groups)
+		share = (engine->rate / groups) ? engine->rate / groups : 1;
+	if (TRANSFER_SHAPER.share && (!share || TRANSFER_SHAPER.share < share))
+		share = TRANSFER_SHAPER.share;
+	for (group = engine->groups; group; group = group->next)
+	{
+		if (!group->rate) /* limit just set, start with an empty bucket */
+			group->tokens = 0;
+		group->rate = share;
+		group->tokens += share * elapsed;
+		if (group->tokens > share * TRANSFER_BURST)
+			group->tokens = share * TRANSFER_BURST;
+		if (group->tokens < -(share * TRANSFER_BURST)) /* debt from a higher rate */
+			group->tokens = -(share * TRANSFER_BURST);
+		if (group->paused && (!share || group->tokens > 0))
+			engine_resume(engine, group);
+	}
+}
+
+int engine_paused(engine_t *engine)
+{
+	group_t *group;
+	for (group = engine->groups; group; group = group->next)
+	{
+		if (group->paused)
+			return 1;
+	}
+	return 0;
+}
+
+int engine_socket(CURL *easy, curl_socket_t s, int what, void *userp, void *socketp)
+{
+	/* keep epoll set in step with the sockets libcurl wants watched */
+	engine_t *engine = (engine_t *) userp;
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.data.fd = s;
+	if (what == CURL_POLL_REMOVE)
+	{
+		epoll_ctl(engine->epoll, EPOLL_CTL_DEL, s, &ev);
+		return 0;
+	}
+	ev.events = ((what & CURL_POLL_IN) ? EPOLLIN : 0) | ((what & CURL_POLL_OUT) ? EPOLLOUT : 0);
+	if (epoll_ctl(engine->epoll, EPOLL_CTL_MOD, s, &ev) && errno == ENOENT)
+		epoll_ctl(engine->epoll, EPOLL_CTL_ADD, s, &ev);
+	return 0;
+}
+
+int engine_timer(CURLM *multi, long timeout_ms, void *userp)
+{
+	/* libcurl wants CURL_SOCKET_TIMEOUT handled once timeout_ms is up,
+	 * done from engine_perform(), it mustn't be called from here
+	 */
+	engine_t *engine = (engine_t *) userp;
+	engine->deadline = (timeout_ms < 0) ? -1 : transfer_clock() + timeout_ms / 1000.0;
+	return 0;
+}
+
+engine_t *engine_init(void)
+{
+	engine_t *engine = (engine_t *) malloc(sizeof(engine_t));
+	engine->multi = curl_multi_init();
+	engine->epoll = epoll_create1(EPOLL_CLOEXEC);
+	engine->deadline = -1;
+	if (pipe(engine->wake))
+		engine->wake[0] = engine->wake[1] = -1;
+	else
+	{
+		struct epoll_event ev;
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.fd = engine->wake[0];
+		fcntl(engine->wake[0], F_SETFL, O_NONBLOCK);
+		fcntl(engine->wake[1], F_SETFL, O_NONBLOCK);
+		epoll_ctl(engine->epoll, EPOLL_CTL_ADD, engine->wake[0], &ev);
+	}
+	engine->share = curl_share_init(); /* DNS and TLS sessions outlive connections */
+	curl_share_setopt(engine->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+	curl_share_setopt(engine->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+	engine->active = 0;
+	engine->hosts = NULL;
+	engine->max_host = TRANSFER_MAX_HOST_CONNECTIONS;
+	engine->last_tune = transfer_clock();
+	engine->groups = NULL;
+	memset(&engine->loose, 0, sizeof(engine->loose));
+	engine->rate = transfer_rate();
+	engine->last_shape = engine->last_tune;
+	engine->hedges = 0;
+	curl_multi_setopt(engine->multi, CURLMOPT_MAX_TOTAL_CONNECTIONS, (long) TRANSFER_MAX_CONNECTIONS);
+	curl_multi_setopt(engine->multi, CURLMOPT_MAX_HOST_CONNECTIONS, (long) TRANSFER_MAX_HOST_CONNECTIONS);
+	curl_multi_setopt(engine->multi, CURLMOPT_PIPELINING, (long) CURLPIPE_MULTIPLEX);
+	curl_multi_setopt(engine->multi, CURLMOPT_SOCKETFUNCTION, engine_socket);
+	curl_multi_setopt(engine->multi, CURLMOPT_SOCKETDATA, (void *) engine);
+	curl_multi_setopt(engine->multi, CURLMOPT_TIMERFUNCTION, engine_timer);
+	curl_multi_setopt(engine->multi, CURLMOPT_TIMERDATA, (void *) engine);
+	return engine;
+}
+
+void engine_add(engine_t *engine, transfer_t *t)
+{
+	/* starts right away if the host has a free slot, queued otherwise */
+	t->done = 0;
+	t->out_of_memory = 0;
+	t->host = engine_host(engine, t->url);
+	if (!t->group)
+		t->group = &engine->loose;
+	if (t->hedge_of) /* stands in for a transfer holding a slot already */
+	{
+		engine->active++;
+		engine_start(engine, t);
+		return;
+	}
+	t->queued = 1;
+	t->next = NULL;
+	if (t->host->queue_tail)
+		t->host->queue_tail->next = t;
+	else
+		t->host->queue = t;
+	t->host->queue_tail = t;
+	engine->active++;
+	engine_admit(engine, t->host);
+}
+
+void engine_drop_hedge(engine_t *engine, transfer_t *t)
+{
+	/* cancel and free t's duplicate, or detach t from its original */
+	if (t->hedge_of)
+	{
+		t->hedge_of->hedge = NULL;
+		t->hedge_of = NULL;
+		engine->hedges--;
+	}
+	else if (t->hedge)
+	{
+		transfer_t *h = t->hedge;
+		engine_remove(engine, h);
+		transfer_free(h);
+	}
+}
+
+void engine_drop_segments(engine_t *engine, transfer_t *t)
+{
+	/* cancel and free every segment of a whole transfer */
+	while (t->segments)
+	{
+		transfer_t *s = t->segments;
+		t->segments = s->sibling;
+		engine_remove(engine, s);
+		transfer_free(s);
+	}
+}
+
+void engine_remove(engine_t *engine, transfer_t *t)
+{
+	/* cancel a transfer still in flight or queued, on_done is not called */
+	host_t *host = t->host;
+	engine_drop_segments(engine, t);
+	engine_drop_hedge(engine, t);
+	if (t->queued)
+	{
+		host_unlink(&host->queue, t);
+		for (host->queue_tail = host->queue; host->queue_tail && host->queue_tail->next;
+		     host->queue_tail = host->queue_tail->next);
+		t->queued = 0;
+		engine->active--;
+		return;
+	}
+	if (!t->handle)
+		return;
+	engine_release(engine, t);
+	engine_admit(engine, host);
+}
+
+void engine_set_max_host(engine_t *engine, unsigned max_host)
+{
+	/* ceiling for concurrent transfers to any one host, at least 1 */
+	host_t *host;
+	engine->max_host = max_host ? max_host : 1;
+	for (host = engine->hosts; host; host = host->next)
+	{
+		if (host->limit > engine->max_host)
+			host->limit = engine->max_host;
+	}
+	curl_multi_setopt(engine->multi, CURLMOPT_MAX_HOST_CONNECTIONS, (long) engine->max_host);
+}
+
+void engine_prewarm(engine_t *engine, const char *url)
+{
+	/* resolve url's host and leave a connection to it in the pool,
+	 * handshakes included, by sending a HEAD request for url
+	 * nothing is done if the host is busy or was used recently
+	 */
+	host_t *host = engine_host(engine, url);
+	if (host->active || host->queue ||
+	    (host->last_used && transfer_clock() - host->last_used < TRANSFER_WARM_AGE))
+		return;
+	transfer_t *t = transfer_init(url, NULL);
+	t->head_only = 1;
+	t->internal = 1;
+	engine_add(engine, t);
+}
+
+transfer_t *engine_splitting(engine_t *engine)
+{
+	/* a whole transfer whose segments are to be started or dropped */
+	host_t *host;
+	transfer_t *t;
+	for (host = engine->hosts; host; host = host->next)
+	{
+		for (t = host->running; t; t = t->next)
+		{
+			if (t->split_pending || (t->split_failed && t->segments))
+				return t;
+		}
+	}
+	return NULL;
+}
+
+void engine_split(engine_t *engine)
+{
+	/* libcurl can't take new handles from inside a write callback,
+	 * segments are started here instead, lists are scanned again after
+	 * every change
+	 */
+	transfer_t *t;
+	while ((t = engine_splitting(engine)))
+	{
+		if (t->split_failed)
+		{
+			engine_drop_segments(engine, t);
+			continue;
+		}
+		t->split_pending = 0;
+		unsigned i;
+		for (i = 1; i < TRANSFER_SEGMENTS; i++)
+		{
+			transfer_t *s = transfer_init(t->split_url, NULL);
+			s->parent = t;
+			s->group = t->group;
+			s->offset = t->length * i;
+			s->length = (i + 1 < TRANSFER_SEGMENTS) ? t->length : t->membuf->size - s->offset;
+			s->sibling = t->segments;
+			t->segments = s;
+			engine_add(engine, s);
+		}
+	}
+}
+
+void engine_stitch(engine_t *engine, transfer_t *t, transfer_t *part)
+{
+	/* one request of split transfer t is over, t completes once all of
+	 * them are, or as soon as one fails
+	 */
+	transfer_t *s;
+	if (part == t)
+		t->finished = 1;
+	else
+		part->done = 1;
+	if (part != t && !part->confirmed) /* range ignored, whole request carries on */
+	{
+		t->split_failed = 1;
+		t->length = t->membuf->size;
+		engine_drop_segments(engine, t);
+		if (!t->finished)
+			return;
+	}
+	else if (part == t && t->result == CURLE_OK) /* got there first, segments aren't needed */
+		engine_drop_segments(engine, t);
+	else if (part->result != CURLE_OK && !part->cut) /* no point in the others carrying on */
+	{
+		t->result = part->result;
+		t->status = part->status;
+		t->finished = 1;
+		engine_remove(engine, t);
+		engine_drop_segments(engine, t);
+	}
+	if (!t->finished)
+		return;
+	for (s = t->segments; s; s = s->sibling)
+	{
+		if (!s->done)
+			return;
+	}
+	if (t->cut)
+		t->result = CURLE_OK;
+	engine_drop_segments(engine, t);
+	engine_drop_hedge(engine, t);
+	if (membuf_map(t->membuf))
+		t->out_of_memory = 1;
+	t->done = 1;
+	if (t->on_done) /* may free t */
+		t->on_done(t, t->userdata);
+}
+
+void engine_hedge_done(engine_t *engine, transfer_t *h)
+{
+	/* duplicate finished first, original takes its body if it's good */
+	transfer_t *t = h->hedge_of;
+	engine_drop_hedge(engine, h);
+	if (transfer_error(h) != EVERYTHING_IS_FINE) /* original carries on */
+	{
+		transfer_free(h);
+		return;
+	}
+	engine_remove(engine, t);
+	membuf_t *body = h->membuf;
+	body->filename = t->membuf->filename; /* destination stays the original's */
+	body->borrowed = t->membuf->borrowed;
+	t->membuf->filename = NULL;
+	h->membuf = t->membuf;
+	t->membuf = body;
+	t->result = h->result;
+	t->status = h->status;
+	t->unordered = 1;
+	t->done = 1;
+	transfer_free(h);
+	if (t->on_done) /* may free t */
+		t->on_done(t, t->userdata);
+}
+
+unsigned engine_perform(engine_t *engine)
+{
+	/* make progress on every transfer without blocking
+	 * completion callbacks are run from here
+	 * returns number of transfers still in flight
+	 */
+	int running, left, i;
+	CURLMsg *msg;
+	struct epoll_event events[TRANSFER_EVENTS];
+	int count = epoll_wait(engine->epoll, events, TRANSFER_EVENTS, 0);
+	for (i = 0; i < count; i++)
+	{
+		if (events[i].data.fd == engine->wake[0])
+		{
+			char drain[64];
+			while (read(engine->wake[0], drain, sizeof(drain)) > 0);
+			continue;
+		}
+		int mask = ((events[i].events & EPOLLIN) ? CURL_CSELECT_IN : 0) |
+		           ((events[i].events & EPOLLOUT) ? CURL_CSELECT_OUT : 0) |
+		           ((events[i].events & (EPOLLERR | EPOLLHUP)) ? CURL_CSELECT_ERR : 0);
+		curl_multi_socket_action(engine->multi, events[i].data.fd, mask, &running);
+	}
+	if (engine->deadline >= 0 && transfer_clock() >= engine->deadline)
+	{
+		engine->deadline = -1;
+		curl_multi_socket_action(engine->multi, CURL_SOCKET_TIMEOUT, 0, &running);
+	}
+	engine_split(engine);
+	while ((msg = curl_multi_info_read(engine->multi, &left)))
+	{
+		if (msg->msg != CURLMSG_DONE)
+			continue;
+		transfer_t *t;
+		curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **) &t);
+		t->result = msg->data.result;
+		curl_easy_getinfo(t->handle, CURLINFO_RESPONSE_CODE, &t->status);
+		curl_easy_getinfo(t->handle, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &t->content_length);
+		if (!t->segmented && !t->parent && membuf_map(t->membuf)) /* spilled to disk, bring it back */
+			t->out_of_memory = 1;
+		engine_finished(engine, t);
+		engine_release(engine, t);
+		engine_admit(engine, t->host);
+		if (t->segmented || t->parent)
+		{
+			engine_stitch(engine, t->parent ? t->parent : t, t);
+			continue;
+		}
+		if (t->hedge_of)
+		{
+			engine_hedge_done(engine, t);
+			continue;
+		}
+		engine_drop_hedge(engine, t); /* finished first, duplicate isn't needed */
+		t->done = 1;
+		if (t->internal)
+			transfer_free(t);
+		else if (t->on_done) /* may free t */
+			t->on_done(t, t->userdata);
+	}
+	engine_tune(engine);
+	engine_shape(engine);
+	return engine->active;
+}
+
+void engine_wait(engine_t *engine, int timeout_ms)
+{
+	/* sleep until there's socket activity, libcurl's timer is up,
+	 * engine_wakeup() is called or timeout
+	 * events are left for engine_perform() to pick up
+	 */
+	struct epoll_event ev;
+	long timeout = engine_timeout(engine);
+	if (timeout < 0 || timeout > timeout_ms)
+		timeout = timeout_ms;
+	epoll_wait(engine->epoll, &ev, 1, (int) timeout);
+}
+
+int engine_fdset(engine_t *engine, fd_set *read_fds, fd_set *write_fds, fd_set *exc_fds, int *max_fd)
+{
+	/* for callers driving the engine from their own select() loop
+	 * one descriptor stands for every socket, readable when any has events
+	 */
+	if (engine->epoll < 0)
+		return -1;
+	FD_SET(engine->epoll, read_fds);
+	if (engine->epoll > *max_fd)
+		*max_fd = engine->epoll;
+	return 0;
+}
+
+long engine_timeout(engine_t *engine)
+{
+	/* milliseconds until engine_perform() should be called again, -1 if idle
+	 * paused transfers have no socket to wake us, refill again soon
+	 */
+	long timeout = -1;
+	if (engine->deadline >= 0)
+	{
+		double left = engine->deadline - transfer_clock();
+		timeout = (left > 0) ? (long) (left * 1000) + 1 : 0;
+	}
+	if (engine_paused(engine) && (timeout < 0 || timeout > TRANSFER_SHAPE_INTERVAL))
+		timeout = TRANSFER_SHAPE_INTERVAL;
+	return timeout;
+}
+
+void engine_wakeup(engine_t *engine)
+{
+	/* make engine_wait() return early, safe to call from any thread */
+	if (engine->wake[1] >= 0)
+	{
+		ssize_t written = write(engine->wake[1], "", 1); /* full pipe has one pending */
+		(void) written;
+	}
+}
+
+void engine_run(engine_t *engine)
+{
+	/* block until every queued transfer has finished */
+	while (engine_perform(engine))
+		engine_wait(engine, 1000);
+}
+
+void engine_cleanup(engine_t *engine)
+{
+	/* transfers of the engine's own are dropped, any others are the caller's */
+	while (engine->hosts)
+	{
+		host_t *next = engine->hosts->next;
+		transfer_t *lists[2], *t, *after;
+		lists[0] = engine->hosts->running;
+		lists[1] = engine->hosts->queue;
+		unsigned i;
+		for (i = 0; i < 2; i++)
+		{
+			for (t = lists[i]; t; t = after)
+			{
+				after = t->next;
+				if (!t->internal)
+					continue;
+				if (t->handle)
+				{
+					curl_multi_remove_handle(engine->multi, t->handle);
+					curl_easy_cleanup(t->handle);
+				}
+				transfer_free(t);
+			}
+		}
+		free(engine->hosts->name);
+		free(engine->hosts);
+		engine->hosts = next;
+	}
+	curl_multi_cleanup(engine->multi);
+	curl_share_cleanup(engine->share);
+	close(engine->epoll);
+	if (engine->wake[0] >= 0)
+	{
+		close(engine->wake[0]);
+		close(engine->wake[1]);
+	}
+	free(engine);
+}
+
+transfer_t *transfer_init(const char *url, char *filename)
+{
+	/* filename is handed off to the membuf */
+	transfer_t *t = (transfer_t *) calloc(1, sizeof(transfer_t));
+	t->url = (char *) malloc(sizeof(char) * (strlen(url) + 1));
+	strcpy(t->url, url);
+	t->membuf = membuf_init();
+	t->membuf->filename = filename;
+	t->membuf->can_spill = 1;
+	t->result = CURLE_OK;
+	t->content_length = -1;
+	return t;
+}
+
+ferror_t transfer_error(transfer_t *t)
+{
+	/* map result of a finished transfer to a program error */
+	if (t->out_of_memory)
+		return ERROR_MEM_IO;
+	if (t->result != CURLE_OK || t->status >= 400)
+		return ERROR_CONNECTION;
+	return EVERYTHING_IS_FINE;
+}
+
+void transfer_free(transfer_t *t)
+{
+	/* membuf is left alone if the caller took ownership of it */
+	if (t->hedge) /* out of the engine by now, see engine_drop_hedge() */
+		transfer_free(t->hedge);
+	while (t->segments) /* already out of the engine */
+	{
+		transfer_t *s = t->segments;
+		t->segments = s->sibling;
+		transfer_free(s);
+	}
+	if (t->membuf)
+		membuf_free(t->membuf);
+	free(t->split_url);
+	free(t->url);
+	free(t);
+}
@@ -1,6 +1,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
 #include <regex.h> /* POSIX Regular Expressions */
 #include <sys/ioctl.h> /* handles term width */
 #include <unistd.h>
@@ -13,76 +16,67 @@
  *  See bc-dl.c for copyright or LICENSE for license information.
  */
 
-char *create_filebuffer(const char *filename)
+url_reader_t *url_reader_open(const char *filename)
 {
-	FILE *fp = fopen(filename, "r");
+	/* URLs are read one at a time as they are requested
+	 * a filename of "-" reads from stdin, so a producer can pipe URLs in
+	 * returns NULL if file can't be opened
+	 */
+	FILE *fp;
+	if (!strcmp(filename, "-"))
+		fp = stdin;
+	else
+		fp = fopen(filename, "r");
 	if (!fp)
-	{
-		perror("[!] Could not open file.\n");
-		abort();
-	}
-	fseek(fp, 0, SEEK_END);
-	long pos = ftell(fp);
-	char *buffer = (char *) malloc(sizeof(char) * pos + 1);
-	fseek(fp, 0, SEEK_SET);
-	fread(buffer, pos, 1, fp);
-	fclose(fp);
-	buffer[pos] = '\0'; /* null terminate */
-	return buffer;
-}
-
-void destroy_filebuffer(char *buf)
-{
-	free(buf);
+		return NULL;
+	url_reader_t *reader = (url_reader_t *) malloc(sizeof(url_reader_t));
+	reader->fp = fp;
+	reader->capacity = 256; /* grows to fit the longest URL seen */
+	reader->token = (char *) malloc(sizeof(char) * reader->capacity);
+	reader->count = 0;
+	return reader;
 }
 
-char **create_URL_buffer(const char *buf, unsigned *elements)
+char *url_reader_next(url_reader_t *reader)
 {
-	unsigned max_len = 0;
-	long buf_len = strlen(buf);
-	char *tmp = (char *) malloc(sizeof(char) * buf_len + 1);
-	strcpy(tmp, buf);
-	char *tok = strtok(tmp, " \n");
-	while (tok != NULL) /* dry run */
-	{
-		(*elements)++;
-		unsigned current_len = strlen(tok);
-		if (current_len > max_len)
-			max_len = current_len;
-		tok = strtok(NULL, " \n");
-	}
-	free(tmp);
-	unsigned i; /* 2D array malloc */
-	char **url_buffer = (char **) malloc(sizeof(char *) * *elements);
-	for (i = 0; i < *elements; i++)
-		url_buffer[i] = (char *) malloc(sizeof(char) * max_len + 1);
-	char *tmp2 = (char *) malloc(sizeof(char) * buf_len + 1);
-	strcpy(tmp2, buf);
-	char *tok2 = strtok(tmp2, " \n");
-	unsigned j = 0;
-	while (tok2 != NULL) /* for real this time */
+	/* return next whitespace-separated URL, or NULL when input runs out
+	 * returned string is owned by the reader, valid until the next call
+	 */
+	size_t len = 0;
+	int c;
+	do /* skip leading whitespace */
+		c = getc(reader->fp);
+	while (c == ' ' || c == '\n' || c == '\r' || c == '\t');
+	while (c != EOF && c != ' ' && c != '\n' && c != '\r' && c != '\t')
 	{
-		strcpy(url_buffer[j++], tok2);
-		tok2 = strtok(NULL, " \n");
+		if (len + 1 == reader->capacity)
+		{
+			reader->capacity *= 2;
+			reader->token = (char *) realloc(reader->token, reader->capacity);
+		}
+		reader->token[len++] = (char) c;
+		c = getc(reader->fp);
 	}
-	free(tmp2);
-	return url_buffer;
+	if (!len)
+		return NULL;
+	reader->token[len] = '\0';
+	reader->count++;
+	return reader->token;
 }
 
-void destroy_URL_buffer(char **buf, unsigned elements)
+void url_reader_close(url_reader_t *reader)
 {
-	unsigned i;
-	for (i = 0; i < elements; i++)
-		free(buf[i]);
-	free(buf);
+	if (reader->fp != stdin)
+		fclose(reader->fp);
+	free(reader->token);
+	free(reader);
 }
 
-int URL_is_valid(const char *str)
+int URL_matches(const char *str, const char *expr)
 {
 	int reg_err;
 	regex_t regex;
-	char url_expr[] = "^(http|https)\\:\\/{2}.*\\.(bandcamp)\\..*\\/(album|single)\\/.*$";
-	reg_err = regcomp(&regex, url_expr, REG_EXTENDED); /* compile */
+	reg_err = regcomp(&regex, expr, REG_EXTENDED | REG_NOSUB); /* compile */
 	if (reg_err)
 	{
 		printf("%s\n", "INVALID REGEX");
@@ -94,6 +88,60 @@ int URL_is_valid(const char *str)
 	return valid;
 }
 
+enum _url_type URL_type(const char *str)
+{
+	/* album pages, or an artist root / discography page to be expanded */
+	char album_expr[] = "^(http|https)\\:\\/{2}.*\\.(bandcamp)\\..*\\/(album|single|track)\\/.*$";
+	char discography_expr[] = "^(http|https)\\:\\/{2}[^/]*\\.(bandcamp)\\.[^/]*(\\/|\\/music\\/?)?(\\?.*)?$";
+	if (URL_matches(str, album_expr))
+		return URL_ALBUM;
+	if (URL_matches(str, discography_expr))
+		return URL_DISCOGRAPHY;
+	return URL_INVALID;
+}
+
+int URL_is_valid(const char *str)
+{
+	return URL_type(str) != URL_INVALID;
+}
+
+int parse_size(const char *str, size_t *size)
+{
+	/* byte count with optional binary K, M or G suffix
+	 * returns 0 on success, nonzero if it's signed or doesn't fit
+	 */
+	char *end;
+	unsigned long multiplier = 1;
+	if (!isdigit((unsigned char) *str)) /* strtoul() takes "-1" as ULONG_MAX */
+		return -1;
+	errno = 0;
+	unsigned long n = strtoul(str, &end, 10);
+	if (errno == ERANGE)
+		return -1;
+	switch (*end)
+	{
+		case 'G': case 'g': multiplier *= 1024;
+		case 'M': case 'm': multiplier *= 1024;
+		case 'K': case 'k': multiplier *= 1024;
+			end++;
+	}
+	if (*end || n > ULONG_MAX / multiplier || n * multiplier > (size_t) -1)
+		return -1;
+	*size = n * multiplier;
+	return 0;
+}
+
+int parse_uint(const char *str, unsigned *n)
+{
+	/* plain decimal number, returns 0 on success */
+	char *end;
+	unsigned long value = strtoul(str, &end, 10);
+	if (end == str || *end || *str == '-')
+		return -1;
+	*n = (unsigned) value;
+	return 0;
+}
+
 unsigned uintlen(unsigned n)
 {
 	/* return number of places in a number */
@@ -0,0 +1,187 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "error.h"
+#include "membuf.h"
+#include "id3.h"
+
+/*
+ *	id3.c
+ *	This file is part of bc-dl.
+ *	See bc-dl.c for copyright or LICENSE for license information.
+ */
+
+/* ID3 ROUND TRIP
+ * tags are serialized and read back with the same functions the
+ * downloader and the retagger use, run with make check
+ * exits nonzero if any check fails
+ */
+
+unsigned FAILED = 0;
+
+#define CHECK(cond) check((cond), #cond, __LINE__)
+
+void check(int ok, const char *what, int line)
+{
+	if (ok)
+		return;
+	fprintf(stderr, "[!] tests/id3.c:%d: %s\n", line, what);
+	FAILED++;
+}
+
+int all_zero(const char *data, size_t len)
+{
+	size_t i;
+	for (i = 0; i < len; i++)
+		if (data[i])
+			return 0;
+	return 1;
+}
+
+void check_syncsafe(void)
+{
+	const unsigned long values[] = { 0, 1, 0x7F, 0x80, 0x3FFF, 0x4000, 0x0FFFFFFF };
+	unsigned char bytes[4];
+	unsigned i;
+	for (i = 0; i < sizeof(values) / sizeof(values[0]); i++)
+	{
+		id3_syncsafe_encode(values[i], bytes);
+		CHECK(!((bytes[0] | bytes[1] | bytes[2] | bytes[3]) & 0x80));
+		CHECK(id3_syncsafe_decode(bytes) == values[i]);
+	}
+	id3_syncsafe_encode(0x80, bytes);
+	CHECK(!memcmp(bytes, "\x00\x00\x01\x00", 4));
+	id3_syncsafe_encode(0x0FFFFFFF, bytes);
+	CHECK(!memcmp(bytes, "\x7F\x7F\x7F\x7F", 4));
+}
+
+void check_round_trip(void)
+{
+	/* a text frame and a frame past 127 bytes, whose size needs both
+	 * syncsafe bytes
+	 */
+	char picture[300];
+	memset(picture, 'P', sizeof(picture));
+	payload_t frames[2];
+	memset(frames, 0, sizeof(frames));
+	frames[0].id = "TIT2";
+	id3_add_field(&frames[0], "\x03", 1);
+	id3_add_field(&frames[0], "Title", 5);
+	frames[1].id = "APIC";
+	id3_add_field(&frames[1], "\x00image/jpeg\x00\x03\x00", 14);
+	id3_add_field(&frames[1], picture, sizeof(picture));
+	CHECK(id3_frame_length(&frames[0]) == ID3_HEADER_LENGTH + 6);
+	CHECK(id3_frame_length(&frames[1]) == ID3_HEADER_LENGTH + 314);
+
+	size_t used = ID3_HEADER_LENGTH + id3_frame_length(&frames[0]) + id3_frame_length(&frames[1]);
+	membuf_t *tag = id3_serialize(frames, 2, 0);
+	CHECK(tag != NULL);
+	if (!tag)
+		return;
+	CHECK(tag->size == used + ID3_PADDING);
+	CHECK(!memcmp(tag->memory, "ID3\x04\x00\x00", 6));
+	CHECK(id3_syncsafe_decode(tag->memory + ID3_HEADER_LEN_OFFSET) == tag->size - ID3_HEADER_LENGTH);
+	CHECK(id3_tag_length(tag->memory, tag->size) == tag->size);
+
+	const char *frame = tag->memory + ID3_HEADER_LENGTH;
+	CHECK(!memcmp(frame, "TIT2", 4));
+	CHECK(id3_syncsafe_decode(frame + ID3_FRAME_LEN_OFFSET) == 6);
+	CHECK(!frame[8] && !frame[9]); /* flags */
+	frame += id3_frame_length(&frames[0]);
+	CHECK(!memcmp(frame, "APIC", 4));
+	CHECK(!memcmp(frame + ID3_FRAME_LEN_OFFSET, "\x00\x00\x02\x3A", 4)); /* 314 */
+
+	size_t size;
+	const char *body = id3_find_frame(tag->memory, tag->size, "TIT2", &size);
+	CHECK(body && size == 6 && !memcmp(body, "\x03Title", 6));
+	body = id3_find_frame(tag->memory, tag->size, "APIC", &size);
+	CHECK(body && size == 314 && !memcmp(body + 14, picture, sizeof(picture)));
+	CHECK(!id3_find_frame(tag->memory, tag->size, "TALB", &size)); /* stops at padding */
+	CHECK(all_zero(tag->memory + used, ID3_PADDING));
+
+	/* truncated, the APIC frame runs past the end */
+	CHECK(!id3_find_frame(tag->memory, used - 1, "APIC", &size));
+	membuf_free(tag);
+}
+
+void check_padding(void)
+{
+	payload_t frame;
+	memset(&frame, 0, sizeof(frame));
+	frame.id = "TALB";
+	id3_add_field(&frame, "\x03", 1);
+	id3_add_field(&frame, "Album", 5);
+	size_t used = ID3_HEADER_LENGTH + id3_frame_length(&frame);
+
+	/* padded out to exactly fit bytes, as the retagger asks */
+	membuf_t *tag = id3_serialize(&frame, 1, 4096);
+	CHECK(tag && tag->size == 4096);
+	if (tag)
+	{
+		CHECK(id3_syncsafe_decode(tag->memory + ID3_HEADER_LEN_OFFSET) == 4096 - ID3_HEADER_LENGTH);
+		CHECK(all_zero(tag->memory + used, 4096 - used));
+		membuf_free(tag);
+	}
+
+	/* exactly the size of the frames, no padding at all */
+	tag = id3_serialize(&frame, 1, used);
+	CHECK(tag && tag->size == used);
+	if (tag)
+	{
+		size_t size;
+		CHECK(id3_tag_length(tag->memory, tag->size) == used);
+		CHECK(id3_find_frame(tag->memory, tag->size, "TALB", &size) && size == 6);
+		membuf_free(tag);
+	}
+
+	/* too small to fit, default padding instead */
+	tag = id3_serialize(&frame, 1, used - 1);
+	CHECK(tag && tag->size == used + ID3_PADDING);
+	if (tag)
+		membuf_free(tag);
+}
+
+void check_headers(void)
+{
+	/* footers, other versions and sizes that aren't syncsafe */
+	char tag[64];
+	memset(tag, 0, sizeof(tag));
+	memcpy(tag, "ID3\x04\x00\x10", 6);
+	id3_syncsafe_encode(20, tag + ID3_HEADER_LEN_OFFSET);
+	CHECK(id3_tag_length(tag, sizeof(tag)) == ID3_HEADER_LENGTH + 20 + ID3_HEADER_LENGTH);
+	tag[3] = 0x03; /* ID3v2.3 has no footer, the flag means nothing */
+	CHECK(id3_tag_length(tag, sizeof(tag)) == ID3_HEADER_LENGTH + 20);
+	tag[3] = 0x02;
+	CHECK(id3_tag_length(tag, sizeof(tag)) == 0);
+	tag[3] = 0x04;
+	tag[9] |= 0x80;
+	CHECK(id3_tag_length(tag, sizeof(tag)) == 0);
+	CHECK(id3_tag_length(tag, ID3_HEADER_LENGTH - 1) == 0);
+	CHECK(id3_tag_length("RIFF\x04\x00\x00\x00\x00\x00", ID3_HEADER_LENGTH) == 0);
+
+	/* ID3v2.3 frame sizes are plain big-endian, 200 isn't syncsafe */
+	char v3[ID3_HEADER_LENGTH * 2 + 200];
+	memset(v3, 'x', sizeof(v3));
+	memcpy(v3, "ID3\x03\x00\x00", 6);
+	id3_syncsafe_encode(sizeof(v3) - ID3_HEADER_LENGTH, v3 + ID3_HEADER_LEN_OFFSET);
+	memcpy(v3 + ID3_HEADER_LENGTH, "TPE1\x00\x00\x00\xC8\x00\x00", ID3_HEADER_LENGTH);
+	size_t size;
+	const char *body = id3_find_frame(v3, sizeof(v3), "TPE1", &size);
+	CHECK(body == v3 + ID3_HEADER_LENGTH * 2 && size == 200);
+}
+
+int main(void)
+{
+	check_syncsafe();
+	check_round_trip();
+	check_padding();
+	check_headers();
+	if (FAILED)
+	{
+		fprintf(stderr, "[!] %u ID3 checks failed.\n", FAILED);
+		return 1;
+	}
+	printf("ID3 checks passed.\n");
+	return 0;
+}
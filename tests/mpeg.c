@@ -0,0 +1,154 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "error.h"
+#include "membuf.h"
+#include "hash.h"
+#include "mpeg.h"
+
+/*
+ *	mpeg.c
+ *	This file is part of bc-dl.
+ *	See bc-dl.c for copyright or LICENSE for license information.
+ */
+
+/* MPEG FRAME WALKER
+ * a few frames of silence with and without the tags found after audio,
+ * fed in one go and a byte at a time, run with make check
+ * exits nonzero if any check fails
+ */
+
+#define FRAME_LENGTH 417 /* MPEG-1 Layer III, 128 kbps, 44.1 kHz, no padding */
+#define FRAMES 3
+#define APE_LENGTH 64 /* header, one item and footer */
+
+unsigned FAILED = 0;
+
+#define CHECK(cond) check((cond), #cond, __LINE__)
+
+void check(int ok, const char *what, int line)
+{
+	if (ok)
+		return;
+	fprintf(stderr, "[!] tests/mpeg.c:%d: %s\n", line, what);
+	FAILED++;
+}
+
+size_t add_frames(char *out)
+{
+	unsigned i;
+	memset(out, 0, FRAME_LENGTH * FRAMES);
+	for (i = 0; i < FRAMES; i++)
+		memcpy(out + i * FRAME_LENGTH, "\xFF\xFB\x90\x00", 4);
+	return FRAME_LENGTH * FRAMES;
+}
+
+size_t add_ape(char *out)
+{
+	memset(out, 0, APE_LENGTH);
+	memcpy(out, "APETAGEX", 8);
+	memcpy(out + APE_LENGTH - 32, "APETAGEX", 8);
+	return APE_LENGTH;
+}
+
+size_t add_lyrics3(char *out)
+{
+	const char *tag = "LYRICSBEGININD0000210LYR00005hello000031LYRICS200";
+	memcpy(out, tag, strlen(tag));
+	return strlen(tag);
+}
+
+size_t add_id3v1(char *out)
+{
+	memset(out, 0, 128);
+	memcpy(out, "TAG", 3);
+	return 128;
+}
+
+mstatus_t walk(const char *data, size_t len, int bytewise, mpeg_t *m)
+{
+	mpeg_init(m);
+	if (!bytewise)
+		mpeg_feed(m, data, len);
+	else
+	{
+		size_t i;
+		for (i = 0; i < len; i++)
+			mpeg_feed(m, data + i, 1);
+	}
+	return mpeg_finish(m);
+}
+
+void check_stream(const char *data, size_t len, mstatus_t expect, unsigned long frames)
+{
+	mpeg_t m;
+	int bytewise;
+	for (bytewise = 0; bytewise < 2; bytewise++)
+	{
+		CHECK(walk(data, len, bytewise, &m) == expect);
+		if (expect == MPEG_OK)
+		{
+			CHECK(m.frames == frames);
+			CHECK(m.position == len);
+		}
+	}
+}
+
+int main(void)
+{
+	char stream[FRAME_LENGTH * FRAMES + 1024];
+	size_t len;
+	mpeg_t m;
+
+	len = add_frames(stream);
+	check_stream(stream, len, MPEG_OK, FRAMES);
+	walk(stream, len, 0, &m);
+	hash64_t audio = hash_digest(&m.hash);
+	CHECK(mpeg_duration_ms(&m) == 78); /* 3 * 1152 / 44100 */
+
+	/* tags after the audio, in the orders they're found in */
+	len = add_frames(stream);
+	len += add_ape(stream + len);
+	check_stream(stream, len, MPEG_OK, FRAMES);
+	len += add_id3v1(stream + len);
+	check_stream(stream, len, MPEG_OK, FRAMES);
+	walk(stream, len, 0, &m);
+	CHECK(hash_digest(&m.hash) == audio); /* tags are left out */
+
+	len = add_frames(stream);
+	len += add_lyrics3(stream + len);
+	len += add_ape(stream + len);
+	len += add_id3v1(stream + len);
+	check_stream(stream, len, MPEG_OK, FRAMES);
+
+	/* only after audio, and only whole preambles */
+	len = add_ape(stream);
+	check_stream(stream, len, MPEG_LOST_SYNC, 0);
+	len = add_frames(stream);
+	memcpy(stream + len, "APETAGEZ", 8);
+	check_stream(stream, len + 8, MPEG_LOST_SYNC, 0);
+	memcpy(stream + len, "LYRICSBEGAN", 11);
+	check_stream(stream, len + 11, MPEG_LOST_SYNC, 0);
+
+	/* anything else after the audio, or after ID3v1, is still an error */
+	len = add_frames(stream);
+	memset(stream + len, 'x', 16);
+	check_stream(stream, len + 16, MPEG_LOST_SYNC, 0);
+	len = add_frames(stream);
+	len += add_id3v1(stream + len);
+	len += add_ape(stream + len);
+	check_stream(stream, len, MPEG_LOST_SYNC, 0);
+
+	/* cut short partway through a frame */
+	len = add_frames(stream);
+	check_stream(stream, len - 1, MPEG_TRUNCATED, 0);
+
+	if (FAILED)
+	{
+		fprintf(stderr, "[!] %u MPEG checks failed.\n", FAILED);
+		return 1;
+	}
+	printf("MPEG checks passed.\n");
+	return 0;
+}